@@ -2,7 +2,7 @@ TARGET = limpynet
 TEMPLATE = app
 CONFIG -= app_bundle
 CONFIG -= qt
-CONFIG += console c++11
+CONFIG += console c++11 thread
 
 OBJECTS_DIR = generated_files
 MOC_DIR = generated_files
@@ -10,18 +10,56 @@ UI_DIR = generated_files
 
 SOURCES += src/main.cpp \
     src/nnetwork/nnetwork.cpp \
+    src/nnetwork/nnetwork_file.cpp \
+    src/nnetwork/quantized_nnetwork.cpp \
+    src/nnetwork/kernels/kernels.cpp \
+    src/nnetwork/kernels/gemm.cpp \
+    src/nnetwork/kernels/activation_kernels.cpp \
+    src/nnetwork/kernels/kernels_sse2.cpp \
+    src/nnetwork/kernels/kernels_avx2.cpp \
+    src/nnetwork/kernels/kernels_avx512.cpp \
+    src/nnetwork/kernels/kernels_avxvnni.cpp \
     src/cmd_line/cmd_line.cpp \
     src/file/file.cpp \
+    src/file/mapped_file.cpp \
+    src/file/idx_file.cpp \
     src/train_on/mnist/train_on_mnist.cpp \
-    src/train_on/mnist/mnist_data.cpp
+    src/train_on/mnist/mnist_data.cpp \
+    src/train_on/mnist/mnist_batch_pipeline.cpp \
+    src/train_on/streaming_dataset.cpp \
+    src/train_on/sharded_dataset.cpp \
+    src/thread/thread_pool.cpp \
+    src/timer/phase_timer.cpp \
+    src/server/inference_server.cpp
 
 HEADERS  += src/nnetwork/nnetwork.h \
+    src/nnetwork/quantized_nnetwork.h \
+    src/nnetwork/kernels/kernels.h \
+    src/nnetwork/kernels/gemm.h \
+    src/nnetwork/kernels/activation_kernels.h \
     src/common.h \
     src/types.h \
     src/cmd_line/cmd_line.h \
     src/file/file.h \
+    src/file/mapped_file.h \
+    src/file/idx_file.h \
     src/train_on/train_on.h \
-    src/train_on/mnist/mnist_data.h
+    src/train_on/dataset.h \
+    src/train_on/streaming_dataset.h \
+    src/train_on/sharded_dataset.h \
+    src/train_on/mnist/mnist_data.h \
+    src/train_on/mnist/mnist_batch_pipeline.h \
+    src/memory/aligned_buffer.h \
+    src/memory/array_view.h \
+    src/thread/thread_pool.h \
+    src/thread/spsc_queue.h \
+    src/timer/phase_timer.h \
+    src/random/philox.h \
+    src/server/inference_server.h
+
+# Builds in the timers that break each training epoch's time down by phase (see
+# src/timer/phase_timer.h). Comment out to compile them out.
+DEFINES += LIMPYNET_PHASE_TIMERS
 
 # C++. For GCC/Clang/MinGW.
 QMAKE_CXXFLAGS += -g
@@ -0,0 +1,50 @@
+# Microbenchmarks of the net's training passes. Builds the net's sources into a separate
+# executable, with src/bench/bench.cpp in place of the main program.
+
+TARGET = limpynet_bench
+TEMPLATE = app
+CONFIG -= app_bundle
+CONFIG -= qt
+CONFIG += console c++11 thread
+
+OBJECTS_DIR = generated_files_bench
+MOC_DIR = generated_files_bench
+UI_DIR = generated_files_bench
+
+SOURCES += src/bench/bench.cpp \
+    src/nnetwork/nnetwork.cpp \
+    src/nnetwork/nnetwork_file.cpp \
+    src/nnetwork/kernels/kernels.cpp \
+    src/nnetwork/kernels/gemm.cpp \
+    src/nnetwork/kernels/activation_kernels.cpp \
+    src/nnetwork/kernels/kernels_sse2.cpp \
+    src/nnetwork/kernels/kernels_avx2.cpp \
+    src/nnetwork/kernels/kernels_avx512.cpp \
+    src/nnetwork/kernels/kernels_avxvnni.cpp \
+    src/file/file.cpp \
+    src/file/mapped_file.cpp \
+    src/thread/thread_pool.cpp \
+    src/timer/phase_timer.cpp
+
+HEADERS  += src/nnetwork/nnetwork.h \
+    src/nnetwork/kernels/kernels.h \
+    src/nnetwork/kernels/gemm.h \
+    src/nnetwork/kernels/activation_kernels.h \
+    src/common.h \
+    src/types.h \
+    src/file/file.h \
+    src/file/mapped_file.h \
+    src/memory/aligned_buffer.h \
+    src/memory/array_view.h \
+    src/thread/thread_pool.h \
+    src/timer/phase_timer.h \
+    src/random/philox.h
+
+# C++. For GCC/Clang/MinGW.
+QMAKE_CXXFLAGS += -g
+QMAKE_CXXFLAGS += -O2
+QMAKE_CXXFLAGS += -Wall
+QMAKE_CXXFLAGS += -ansi
+QMAKE_CXXFLAGS += -pipe
+QMAKE_CXXFLAGS += -pedantic
+QMAKE_CXXFLAGS += -std=c++11
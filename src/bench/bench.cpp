@@ -0,0 +1,309 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * Microbenchmarks of the net's training passes over a range of layer widths and
+ * activation functions. Runs on synthetic data, so doesn't need the MNIST files.
+ *
+ */
+
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include "../../src/nnetwork/kernels/kernels.h"
+#include "../../src/nnetwork/nnetwork.h"
+
+// Gives the benchmarks access to the individual stages of nnetwork_c's training step.
+template <typename T>
+struct nnetwork_bench_s
+{
+    static void load_sample(nnetwork_c<T> &net, const array_view_s<T> input, const uint expectedClass)
+    {
+        net.set_inputs(net.context, input);
+        net.set_expected_class(expectedClass);
+
+        return;
+    }
+
+    static void propagate_forward(nnetwork_c<T> &net) { net.propagate_forward(net.context); }
+    static void propagate_back_and_update(nnetwork_c<T> &net) { net.propagate_back_and_update(); }
+};
+
+struct bench_settings_s
+{
+    // How many times to time each operation.
+    uint numRepeats = 5;
+
+    // The least time that each repeat should take. The number of calls per repeat is
+    // chosen to match.
+    double minRepeatSeconds = 0.05;
+
+    // The number of samples in each call of train_batch().
+    uint batchSize = 32;
+};
+
+// The amount of work that one call of an operation does.
+struct bench_cost_s
+{
+    uint numSamples = 1;
+    double numFlops = 0;
+
+    // The bytes of weights and biases that the call reads or writes, counting each
+    // access of each matrix once.
+    double numBytes = 0;
+};
+
+// Times the given operation, and prints the results on a row of the results table.
+static void run_benchmark(const char *const topologyName, const char *const operationName,
+                          const std::function<void()> &operation, const bench_cost_s &cost,
+                          const bench_settings_s &settings)
+{
+    typedef std::chrono::steady_clock clock_t;
+
+    const auto time_calls = [&](const u64 numCalls)
+    {
+        const auto startTime = clock_t::now();
+
+        for (u64 i = 0; i < numCalls; i++)
+        {
+            operation();
+        }
+
+        return std::chrono::duration<double>(clock_t::now() - startTime).count();
+    };
+
+    // Warm up, and find how many calls it takes to fill a repeat.
+    u64 numCalls = 1;
+    while (true)
+    {
+        const double seconds = time_calls(numCalls);
+
+        if (seconds >= settings.minRepeatSeconds)
+        {
+            break;
+        }
+
+        const double estimate = ((settings.minRepeatSeconds / std::max(seconds, 1e-9)) * numCalls * 1.1);
+        numCalls = std::max((numCalls * 2), std::min(u64(estimate), (numCalls * 100)));
+    }
+
+    std::vector<double> callsPerSecond;
+    for (uint r = 0; r < settings.numRepeats; r++)
+    {
+        callsPerSecond.push_back(numCalls / time_calls(numCalls));
+    }
+
+    double mean = 0;
+    for (const double rate: callsPerSecond)
+    {
+        mean += rate;
+    }
+    mean /= callsPerSecond.size();
+
+    double variance = 0;
+    for (const double rate: callsPerSecond)
+    {
+        variance += ((rate - mean) * (rate - mean));
+    }
+    variance /= std::max(size_t(1), (callsPerSecond.size() - 1));
+
+    printf("%-24s %-14s %14.0f %7.2f%% %10.2f %10.2f\n",
+           topologyName, operationName,
+           (mean * cost.numSamples),
+           ((std::sqrt(variance) / mean) * 100),
+           ((mean * cost.numFlops) / 1e9),
+           ((mean * cost.numBytes) / 1e9));
+
+    return;
+}
+
+// Returns the letter that the net's configuration printout uses for the given activation function.
+static char activation_letter(const activation_function_e functionType)
+{
+    switch (functionType)
+    {
+        case activation_function_e::leaky_relu:   return 'L';
+        case activation_function_e::relu:         return 'R';
+        case activation_function_e::log_sigmoid:  return 'G';
+        case activation_function_e::tanh_sigmoid: return 'T';
+        case activation_function_e::softmax:      return 'S';
+        case activation_function_e::none:         return 'N';
+        default: return '?';
+    }
+}
+
+// Benchmarks the training passes of a net of the given number of inputs, two hidden layers of
+// the given width and activation function, and ten softmax outputs.
+template <typename T>
+static void benchmark_topology(const uint numInputs, const uint width, const activation_function_e functionType,
+                               const bench_settings_s &settings)
+{
+    nnetwork_c<T> net;
+    net.set_random_seed(1234);
+    net.add_layer(numInputs, activation_function_e::none);
+    net.add_layer(width, functionType);
+    net.add_layer(width, functionType);
+    net.add_layer(10, activation_function_e::softmax);
+
+    // Keep the weights from drifting far over the repeated updates.
+    net.set_learning_rate(T(1e-6));
+
+    std::string topologyName;
+    for (uint i = 0; i < net.num_layers(); i++)
+    {
+        topologyName += (std::string(i? "-" : "") + activation_letter(net.layer(i).activationFunction) + std::to_string(net.num_neurons_in_layer(i)));
+    }
+
+    // Synthetic samples, cycled through by the operations.
+    const uint numSamples = 64;
+    std::mt19937 randomNumberGenerator(1234);
+    std::uniform_real_distribution<T> randomDistribution(0, 1);
+
+    std::vector<std::vector<T>> inputs(numSamples, std::vector<T>(numInputs));
+    std::vector<uint> classes(numSamples);
+    for (uint n = 0; n < numSamples; n++)
+    {
+        std::generate(inputs.at(n).begin(), inputs.at(n).end(), [&]{ return randomDistribution(randomNumberGenerator); });
+        classes.at(n) = (randomNumberGenerator() % 10);
+    }
+
+    // The cost of each pass for one sample.
+    bench_cost_s forwardCost, backCost;
+    for (uint i = 1; i < net.num_layers(); i++)
+    {
+        const auto &layer = net.layer(i);
+        const double matrixBytes = ((layer.weights.size() + layer.biases.size()) * sizeof(T));
+        const double matrixFlops = (2.0 * layer.numNeurons * layer.numInputs);
+
+        forwardCost.numFlops += matrixFlops;
+        forwardCost.numBytes += matrixBytes;
+
+        // The weights and biases are read and written by the update. The error terms are propagated back through
+        // all but the first hidden layer's weights, in the same pass over them.
+        backCost.numFlops += ((i > 1)? (2 * matrixFlops) : matrixFlops);
+        backCost.numBytes += (2 * matrixBytes);
+    }
+
+    bench_cost_s trainCost;
+    trainCost.numFlops = (forwardCost.numFlops + backCost.numFlops);
+    trainCost.numBytes = (forwardCost.numBytes + backCost.numBytes);
+
+    // A batch does each sample's arithmetic, but accesses the weights once per batch.
+    bench_cost_s batchCost = trainCost;
+    batchCost.numSamples = settings.batchSize;
+    batchCost.numFlops *= settings.batchSize;
+
+    uint sampleIdx = 0;
+    const auto next_sample = [&]
+    {
+        sampleIdx = ((sampleIdx + 1) % numSamples);
+        nnetwork_bench_s<T>::load_sample(net, inputs.at(sampleIdx), classes.at(sampleIdx));
+    };
+
+    run_benchmark(topologyName.c_str(), "forward", [&]
+    {
+        next_sample();
+        nnetwork_bench_s<T>::propagate_forward(net);
+    }, forwardCost, settings);
+
+    // The backward pass works off of the most recent forward pass.
+    next_sample();
+    nnetwork_bench_s<T>::propagate_forward(net);
+
+    run_benchmark(topologyName.c_str(), "back+update", [&]
+    {
+        nnetwork_bench_s<T>::propagate_back_and_update(net);
+    }, backCost, settings);
+
+    run_benchmark(topologyName.c_str(), "train", [&]
+    {
+        sampleIdx = ((sampleIdx + 1) % numSamples);
+        net.train(inputs.at(sampleIdx), classes.at(sampleIdx));
+    }, trainCost, settings);
+
+    std::vector<array_view_s<T>> batchInputs(settings.batchSize);
+    std::vector<uint> batchClasses(settings.batchSize);
+    const std::string batchName = ("train_batch/" + std::to_string(settings.batchSize));
+
+    run_benchmark(topologyName.c_str(), batchName.c_str(), [&]
+    {
+        for (uint b = 0; b < settings.batchSize; b++)
+        {
+            sampleIdx = ((sampleIdx + 1) % numSamples);
+            batchInputs.at(b) = inputs.at(sampleIdx);
+            batchClasses.at(b) = classes.at(sampleIdx);
+        }
+
+        net.train_batch(batchInputs, batchClasses);
+    }, batchCost, settings);
+
+    return;
+}
+
+template <typename T>
+static void run_benchmarks(const bench_settings_s &settings)
+{
+    printf("Precision: %s. Kernels: %s. Repeats: %u of at least %.0f ms each.\n",
+           ((sizeof(T) == sizeof(float))? "single" : "double"), kkernels<T>().name,
+           settings.numRepeats, (settings.minRepeatSeconds * 1000));
+
+    printf("%-24s %-14s %14s %8s %10s %10s\n", "Topology", "Operation", "Samples/s", "StdDev", "GFLOP/s", "GB/s");
+
+    const uint widths[] = {64, 256, 1024};
+    const activation_function_e functionTypes[] = {activation_function_e::relu,
+                                                   activation_function_e::leaky_relu,
+                                                   activation_function_e::tanh_sigmoid,
+                                                   activation_function_e::log_sigmoid};
+
+    for (const uint width: widths)
+    {
+        for (const activation_function_e functionType: functionTypes)
+        {
+            benchmark_topology<T>(784, width, functionType, settings);
+        }
+    }
+
+    return;
+}
+
+int main(int argc, char *argv[])
+{
+    kkernels_initialize();
+
+    bench_settings_s settings;
+    bool singlePrecision = false;
+
+    int c = 0;
+    while ((c = getopt(argc, argv, "fr:t:b:")) != -1)
+    {
+        switch (c)
+        {
+            case 'f': singlePrecision = true; break;
+            case 'r': settings.numRepeats = std::max(1l, strtol(optarg, NULL, 10)); break;
+            case 't': settings.minRepeatSeconds = (std::max(1l, strtol(optarg, NULL, 10)) / 1000.0); break;
+            case 'b': settings.batchSize = std::max(1l, strtol(optarg, NULL, 10)); break;
+            default:
+            {
+                fprintf(stderr, "Usage: %s [-f] [-r repeats] [-t min. ms per repeat] [-b batch size]\n", argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    if (singlePrecision)
+    {
+        run_benchmarks<float>(settings);
+    }
+    else
+    {
+        run_benchmarks<double>(settings);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -3,21 +3,141 @@
  *
  */
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
+#include <thread>
 #include <unistd.h>
+#include <getopt.h>
+#include "../../src/nnetwork/kernels/kernels.h"
 #include "../../src/nnetwork/nnetwork.h"
+#include "../../src/cmd_line/cmd_line.h"
 
-bool k_parse_command_line(const int argc, char *const argv[], nnetwork_c *const net)
+static const char OPTIONS[] = "R:L:T:G:N:S:e:b:j:r:o:l:w:s:m:p:a:c:d:W:P:xkfqHV";
+
+// The options that only have a long form. Their identifiers are kept out of the range of the short options'.
+enum
+{
+    OPTION_SEED = 1000
+};
+
+static const struct option LONG_OPTIONS[] = {{"seed", required_argument, NULL, OPTION_SEED},
+                                             {NULL, 0, NULL, 0}};
+
+// Scans the command line for the given option, without acting on any of the options. Returns true if
+// the option was given, and sets argument to its argument (if it takes one) on the last occurrence.
+static bool scan_command_line(const int argc, char *const argv[], const int option, const char **argument)
+{
+    bool found = false;
+
+    // This may be called after the main parsing pass, so start over from the first argument; and leave
+    // any complaints about unknown options to the main parsing pass.
+    opterr = 0;
+    optind = 1;
+
+    int c = 0;
+    while ((c = getopt_long(argc, argv, OPTIONS, LONG_OPTIONS, NULL)) != -1)
+    {
+        if (c == option)
+        {
+            found = true;
+            *argument = optarg;
+        }
+    }
+
+    // Reset getopt() for any further parsing passes.
+    opterr = 1;
+    optind = 1;
+
+    return found;
+}
+
+bool k_command_line_wants_single_precision(const int argc, char *const argv[])
+{
+    return k_command_line_has_option(argc, argv, 'f');
+}
+
+const char* k_command_line_option_argument(const int argc, char *const argv[], const char option)
+{
+    const char *argument = NULL;
+    scan_command_line(argc, argv, option, &argument);
+
+    return argument;
+}
+
+bool k_command_line_has_option(const int argc, char *const argv[], const char option)
+{
+    const char *argument = NULL;
+
+    return scan_command_line(argc, argv, option, &argument);
+}
+
+bool k_command_line_seed(const int argc, char *const argv[], u64 *const seed)
+{
+    const char *argument = NULL;
+    if (!scan_command_line(argc, argv, OPTION_SEED, &argument))
+    {
+        return false;
+    }
+
+    *seed = strtoull(argument, NULL, 10);
+
+    return true;
+}
+
+template <typename T>
+bool k_parse_command_line(const int argc, char *const argv[], nnetwork_c<T> *const net)
 {
+    // The seed needs to be set before any layers are added, wherever on the command line it's given.
+    u64 seed = 0;
+    if (k_command_line_seed(argc, argv, &seed))
+    {
+        net->set_random_seed(seed);
+    }
+
     int c = 0;
-    while ((c = getopt(argc, argv, "R:L:T:G:N:S:e:r:x")) != -1)
+    while ((c = getopt_long(argc, argv, OPTIONS, LONG_OPTIONS, NULL)) != -1)
     {
         switch (c)
         {
+            case 'f':
+            {
+                // Handled by k_command_line_wants_single_precision().
+                break;
+            }
+            case OPTION_SEED:
+            {
+                // Handled above.
+                break;
+            }
+            case 'l':
+            case 'w':
+            case 's':
+            case 'm':
+            case 'q':
+            case 'p':
+            case 'a':
+            case 'c':
+            case 'd':
+            case 'W':
+            case 'P':
+            case 'V':
+            {
+                // Handled via k_command_line_option_argument() and k_command_line_has_option(), by the code
+                // that loads/saves/serves/quantizes/trains the net.
+                break;
+            }
             case 'x':
             {
                 printf("Running XOR test... "); fflush(stdout);
-                printf("XOR test result: %.3f%%\n", nnetwork_c::xor_test());
+                printf("XOR test result: %.3f%%\n", nnetwork_c<T>::xor_test());
+
+                break;
+            }
+            case 'k':
+            {
+                printf("Verifying the %s kernels against the scalar reference...\n", kkernels<T>().name);
+                printf("Kernel verification %s.\n", (kkernels_verify()? "passed" : "failed"));
 
                 break;
             }
@@ -70,9 +190,40 @@ bool k_parse_command_line(const int argc, char *const argv[], nnetwork_c *const
 
                 break;
             }
+            case 'b':
+            {
+                uint batchSize = strtol(optarg, NULL, 10);
+                if (batchSize == 0)
+                {
+                    NBENE(("Invalid batch size: %s.", optarg));
+                    batchSize = 1;
+                }
+
+                net->set_batch_size(batchSize);
+
+                break;
+            }
+            case 'j':
+            {
+                uint numThreads = strtol(optarg, NULL, 10);
+                if (numThreads == 0)
+                {
+                    numThreads = std::max(1u, std::thread::hardware_concurrency());
+                }
+
+                net->set_num_threads(numThreads);
+
+                break;
+            }
+            case 'H':
+            {
+                net->set_hogwild(true);
+
+                break;
+            }
             case 'r':
             {
-                real learningRate = strtod(optarg, NULL);
+                T learningRate = strtod(optarg, NULL);
                 if (learningRate <= 0)
                 {
                     NBENE(("Invalid learning rate: %f.", learningRate));
@@ -81,6 +232,25 @@ bool k_parse_command_line(const int argc, char *const argv[], nnetwork_c *const
 
                 net->set_learning_rate(learningRate);
 
+                break;
+            }
+            case 'o':
+            {
+                uint optimizerIdx = 0;
+                while ((optimizerIdx < uint(optimizer_e::count)) &&
+                       strcmp(optarg, koptimizer_name(optimizer_e(optimizerIdx))))
+                {
+                    optimizerIdx++;
+                }
+
+                if (optimizerIdx == uint(optimizer_e::count))
+                {
+                    NBENE(("Unknown optimizer '%s'; expected one of sgd, momentum, nesterov, or adam.", optarg));
+                    return false;
+                }
+
+                net->set_optimizer(optimizer_e(optimizerIdx));
+
                 break;
             }
         }
@@ -89,3 +259,5 @@ bool k_parse_command_line(const int argc, char *const argv[], nnetwork_c *const
     return true;
 }
 
+template bool k_parse_command_line(const int, char *const[], nnetwork_c<float> *const);
+template bool k_parse_command_line(const int, char *const[], nnetwork_c<double> *const);
@@ -1,13 +1,34 @@
-/*
- * 2018 Tarpeeksi Hyvae Soft
- *
- */
-
-#ifndef COMMAND_LINE_H
-#define COMMAND_LINE_H
-
-class nnetwork_c;
-
-bool k_parse_command_line(const int argc, char *const argv[], nnetwork_c *const net);
-
-#endif
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ */
+
+#ifndef COMMAND_LINE_H
+#define COMMAND_LINE_H
+
+#include "../../src/types.h"
+
+template <typename T> class nnetwork_c;
+
+template <typename T>
+bool k_parse_command_line(const int argc, char *const argv[], nnetwork_c<T> *const net);
+
+// Returns true if the command line asks for the net to be run in single rather than
+// double precision. Needs to be known before the net is created, so this is checked
+// separately from the rest of the command line.
+bool k_command_line_wants_single_precision(const int argc, char *const argv[]);
+
+// Returns the argument given on the command line to the given option (e.g. the filename
+// given to -l), or NULL if the option wasn't given. For options that are acted on outside
+// of k_parse_command_line().
+const char* k_command_line_option_argument(const int argc, char *const argv[], const char option);
+
+// Returns true if the given option was given on the command line. As above, for options
+// that are acted on outside of k_parse_command_line().
+bool k_command_line_has_option(const int argc, char *const argv[], const char option);
+
+// Returns true and sets seed to the random seed given on the command line (--seed), if one
+// was; otherwise, returns false and leaves seed as it was.
+bool k_command_line_seed(const int argc, char *const argv[], u64 *const seed);
+
+#endif
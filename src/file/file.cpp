@@ -141,6 +141,23 @@ void kfile_fill(const unsigned char byte, const unsigned long len, const file_ha
     return;
 }
 
+// Like kfile_fill(), but returns false instead of asserting if the write fails.
+//
+bool kfile_try_fill(const unsigned char byte, const unsigned long len, const file_handle_t handle)
+{
+    FILE *const f = kfile_exposed_file_handle(handle);
+
+    for (unsigned long i = 0; i < len; i++)
+    {
+        if (fputc(byte, f) == EOF)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 void kfile_flush_file(const file_handle_t handle)
 {
     const int r = fflush(kfile_exposed_file_handle(handle));
@@ -168,6 +185,13 @@ void kfile_write_byte_array(const unsigned char *const src, const unsigned long
     return;
 }
 
+// Like kfile_write_byte_array(), but returns false instead of asserting if the write fails.
+//
+bool kfile_try_write_byte_array(const unsigned char *const src, const unsigned long len, const file_handle_t handle)
+{
+    return (fwrite(src, 1, len, kfile_exposed_file_handle(handle)) == len);
+}
+
 long kfile_position(const file_handle_t handle)
 {
     return ftell(kfile_exposed_file_handle(handle));
@@ -223,6 +247,24 @@ file_handle_t kfile_open_file(const char *const filename, const char *const mode
     return h;
 }
 
+// Like kfile_open_file(), but returns false instead of asserting if the file can't be opened.
+// On success, the file's handle is placed in 'handle'.
+//
+bool kfile_try_open_file(const char *const filename, const char *const mode, file_handle_t *const handle)
+{
+    const file_handle_t h = f_next_free_handle();
+
+    FILE_HANDLE_CACHE[h] = fopen(filename, mode);
+    if (FILE_HANDLE_CACHE[h] == NULL)
+    {
+        return false;
+    }
+
+    *handle = h;
+
+    return true;
+}
+
 // Seek to a delta from the current position.
 //
 void kfile_jump(const i32 posDelta, const file_handle_t handle)
@@ -262,3 +304,14 @@ void kfile_close_file(const file_handle_t handle)
 
     return;
 }
+
+// Like kfile_close_file(), but returns false instead of asserting if the file fails to close
+// (e.g. if its buffered writes can't be flushed). The handle is released either way.
+//
+bool kfile_try_close_file(const file_handle_t handle)
+{
+    const int cl = fclose(kfile_exposed_file_handle(handle));
+    FILE_HANDLE_CACHE[handle] = NULL;
+
+    return (cl == 0);
+}
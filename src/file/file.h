@@ -34,6 +34,10 @@ file_handle_t kfile_open_file(const char *const filename, const char *const mode
 
 void kfile_close_file(const file_handle_t handle);
 
+// Non-asserting versions of the above, which return false on failure.
+bool kfile_try_open_file(const char *const filename, const char *const mode, file_handle_t *const handle);
+bool kfile_try_close_file(const file_handle_t handle);
+
 void kfile_seek(const u32 pos, const file_handle_t handle);
 
 void kfile_jump(const i32 posDelta, const file_handle_t handle);
@@ -93,6 +97,10 @@ void kfile_fill(const unsigned char byte, const unsigned long len, const file_ha
 
 void kfile_write_byte_array(const unsigned char *const src, const unsigned long len, const file_handle_t handle);
 
+// Non-asserting versions of the above, which return false on failure.
+bool kfile_try_fill(const unsigned char byte, const unsigned long len, const file_handle_t handle);
+bool kfile_try_write_byte_array(const unsigned char *const src, const unsigned long len, const file_handle_t handle);
+
 void kfile_write_string(const char *const str, const file_handle_t handle);
 
 #endif
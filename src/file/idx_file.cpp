@@ -0,0 +1,152 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * A reader for files in the IDX format (as used by MNIST).
+ *
+ */
+
+#include <algorithm>
+#include "../../src/nnetwork/kernels/kernels.h"
+#include "../../src/thread/thread_pool.h"
+#include "../../src/file/idx_file.h"
+
+// The IDX type code of unsigned byte data.
+static const u8 IDX_TYPE_U8 = 0x08;
+
+// Returns the big-endian u32 at the given address.
+static u32 read_be_u32(const u8 *const src)
+{
+    return ((u32(src[0]) << 24) | (u32(src[1]) << 16) | (u32(src[2]) << 8) | u32(src[3]));
+}
+
+idx_file_c::idx_file_c(const char *const filename)
+{
+    if (this->file.open(filename) &&
+        !this->parse_header(filename))
+    {
+        this->file.close();
+        this->dims.clear();
+    }
+
+    return;
+}
+
+bool idx_file_c::parse_header(const char *const filename)
+{
+    if (!kidx_parse_header(this->file.data(), this->file.size(), filename, &this->dims, &this->payloadOffset))
+    {
+        return false;
+    }
+
+    if ((this->file.size() - this->payloadOffset) < kidx_payload_size(this->dims))
+    {
+        NBENE(("'%s' is too small for the payload its header describes.", filename));
+        return false;
+    }
+
+    return true;
+}
+
+bool kidx_parse_header(const u8 *const contents, const size_t numBytes, const char *const filename,
+                       std::vector<uint> *const dims, size_t *const payloadOffset)
+{
+    // The header opens with two zero bytes, then the data type, then the number of dimensions.
+    if ((numBytes < 4) ||
+        (contents[0] != 0) ||
+        (contents[1] != 0))
+    {
+        NBENE(("'%s' doesn't look like an IDX file.", filename));
+        return false;
+    }
+
+    if (contents[2] != IDX_TYPE_U8)
+    {
+        NBENE(("Expected the IDX data in '%s' to be of type unsigned byte.", filename));
+        return false;
+    }
+
+    const uint numDims = contents[3];
+    *payloadOffset = (4 + (numDims * sizeof(u32)));
+
+    if (!numDims ||
+        (numBytes < *payloadOffset))
+    {
+        NBENE(("Malformed IDX header in '%s'.", filename));
+        return false;
+    }
+
+    // Followed by the size of each dimension.
+    dims->clear();
+    for (uint i = 0; i < numDims; i++)
+    {
+        dims->push_back(read_be_u32(contents + 4 + (i * sizeof(u32))));
+    }
+
+    return true;
+}
+
+size_t kidx_payload_size(const std::vector<uint> &dims)
+{
+    size_t payloadSize = 1;
+
+    for (const uint dim: dims)
+    {
+        payloadSize *= dim;
+    }
+
+    return payloadSize;
+}
+
+uint idx_file_c::item_size(void) const
+{
+    uint size = 1;
+
+    for (size_t i = 1; i < this->dims.size(); i++)
+    {
+        size *= this->dims.at(i);
+    }
+
+    return size;
+}
+
+array_view_s<u8> idx_file_c::payload(void) const
+{
+    if (!this->is_open())
+    {
+        return array_view_s<u8>();
+    }
+
+    return array_view_s<u8>((this->file.data() + this->payloadOffset), (size_t(this->num_items()) * this->item_size()));
+}
+
+template <typename T>
+void idx_file_c::convert_payload(T *const dst, const T scale, thread_pool_c *const threadPool) const
+{
+    const array_view_s<u8> src = this->payload();
+    const dense_kernels_s<T> &kernels = kkernels<T>();
+
+    const uint numTasks = (threadPool? threadPool->num_threads() : 1);
+    const size_t elementsPerTask = ((src.size() + numTasks - 1) / numTasks);
+
+    const auto convert_share = [&](const uint taskIdx)
+    {
+        const size_t first = std::min(src.size(), (taskIdx * elementsPerTask));
+        const size_t count = std::min(elementsPerTask, (src.size() - first));
+
+        kernels.scale_u8((src.data() + first), scale, (dst + first), count);
+    };
+
+    if (threadPool)
+    {
+        threadPool->run(numTasks, convert_share);
+    }
+    else
+    {
+        convert_share(0);
+    }
+
+    return;
+}
+
+template void idx_file_c::convert_payload(float *const, const float, thread_pool_c *const) const;
+template void idx_file_c::convert_payload(double *const, const double, thread_pool_c *const) const;
@@ -0,0 +1,74 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * A reader for files in the IDX format (as used by MNIST).
+ *
+ */
+
+#ifndef IDX_FILE_H
+#define IDX_FILE_H
+
+#include <vector>
+#include "../../src/file/mapped_file.h"
+#include "../../src/memory/array_view.h"
+#include "../../src/common.h"
+
+class thread_pool_c;
+
+// The most bytes that an IDX header can take up: the magic number, and the sizes of up to
+// 255 dimensions.
+static const uint IDX_MAX_HEADER_SIZE = (4 + (255 * sizeof(u32)));
+
+// Parses the IDX header at the start of the given bytes of the given file (named for error
+// messages), which need only cover the header; see IDX_MAX_HEADER_SIZE. On success, returns
+// true and sets dims to the size of each of the payload's dimensions, and payloadOffset to the
+// byte offset of the payload from the start of the file. Doesn't check that the file is large
+// enough to hold the payload.
+bool kidx_parse_header(const u8 *const contents, const size_t numBytes, const char *const filename,
+                       std::vector<uint> *const dims, size_t *const payloadOffset);
+
+// Returns the number of bytes in a u8 payload of the given dimensions.
+size_t kidx_payload_size(const std::vector<uint> &dims);
+
+// Memory-maps an IDX file and validates its header, after which the payload can be
+// accessed in place. Only u8 payloads are supported.
+class idx_file_c
+{
+public:
+    // Opens the given file, and verifies that its header is valid and that the file is
+    // large enough to hold the payload the header describes. If not, the object is left
+    // closed (is_open() returns false).
+    explicit idx_file_c(const char *const filename);
+
+    bool is_open(void) const { return this->file.is_open(); }
+
+    // The size of each of the payload's dimensions, from the outermost to the innermost;
+    // e.g. {60000, 28, 28} for the MNIST training images.
+    const std::vector<uint>& dimensions(void) const { return this->dims; }
+
+    // The number of items in the payload, i.e. the size of its outermost dimension.
+    uint num_items(void) const { return (this->dims.empty()? 0 : this->dims.front()); }
+
+    // The number of elements in each item; e.g. the number of pixels in an image.
+    uint item_size(void) const;
+
+    // A view of the whole payload, without copying it. Valid for the lifetime of this object.
+    array_view_s<u8> payload(void) const;
+
+    // Writes the payload into dst as values of T, multiplied by scale. If a thread pool is
+    // given, the work is split across its threads.
+    template <typename T>
+    void convert_payload(T *const dst, const T scale, thread_pool_c *const threadPool = NULL) const;
+
+private:
+    bool parse_header(const char *const filename);
+
+    mapped_file_c file;
+
+    std::vector<uint> dims;
+
+    // The byte offset of the payload from the start of the file.
+    size_t payloadOffset = 0;
+};
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * Read-only memory-mapped access to a file's contents.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include "../../src/file/mapped_file.h"
+
+#ifdef _WIN32
+    #include <algorithm>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+mapped_file_c::mapped_file_c(const char *const filename, const bool copyOnWrite)
+{
+    this->open(filename, copyOnWrite);
+
+    return;
+}
+
+mapped_file_c::~mapped_file_c()
+{
+    this->close();
+
+    return;
+}
+
+bool mapped_file_c::open(const char *const filename, const bool copyOnWrite)
+{
+    this->close();
+
+    #ifdef _WIN32
+        FILE *const f = fopen(filename, "rb");
+        if (f == NULL)
+        {
+            NBENE(("Failed to open '%s' for reading.", filename));
+            return false;
+        }
+
+        fseek(f, 0, SEEK_END);
+        const long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+
+        u8 *const buffer = (u8*)malloc(std::max(1l, size));
+        const bool readOk = ((size >= 0) && (buffer != NULL) && (fread(buffer, 1, size, f) == size_t(size)));
+        fclose(f);
+
+        if (!readOk)
+        {
+            free(buffer);
+            NBENE(("Failed to read the contents of '%s'.", filename));
+            return false;
+        }
+
+        this->contents = buffer;
+        this->numBytes = size;
+    #else
+        const int fd = ::open(filename, O_RDONLY);
+        if (fd < 0)
+        {
+            NBENE(("Failed to open '%s' for reading.", filename));
+            return false;
+        }
+
+        struct stat fileInfo;
+        if ((fstat(fd, &fileInfo) != 0) ||
+            (fileInfo.st_size <= 0))
+        {
+            ::close(fd);
+            NBENE(("Failed to query the size of '%s', or it's empty.", filename));
+            return false;
+        }
+
+        const int protection = (copyOnWrite? (PROT_READ | PROT_WRITE) : PROT_READ);
+        void *const mapping = mmap(NULL, fileInfo.st_size, protection, MAP_PRIVATE, fd, 0);
+
+        // The mapping stays valid after its file descriptor has been closed.
+        ::close(fd);
+
+        if (mapping == MAP_FAILED)
+        {
+            NBENE(("Failed to memory-map '%s'.", filename));
+            return false;
+        }
+
+        this->contents = (u8*)mapping;
+        this->numBytes = fileInfo.st_size;
+    #endif
+
+    this->isWritable = copyOnWrite;
+
+    return true;
+}
+
+void mapped_file_c::close(void)
+{
+    if (this->contents == NULL)
+    {
+        return;
+    }
+
+    #ifdef _WIN32
+        free(this->contents);
+    #else
+        munmap(this->contents, this->numBytes);
+    #endif
+
+    this->contents = NULL;
+    this->numBytes = 0;
+    this->isWritable = false;
+
+    return;
+}
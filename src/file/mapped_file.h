@@ -0,0 +1,49 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * Read-only memory-mapped access to a file's contents.
+ *
+ */
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include "../../src/common.h"
+
+// Maps a file's contents into memory, so that they can be accessed as an array without
+// first reading them in. The mapping lasts for the lifetime of the object. It's read-only
+// unless opened as copy-on-write, in which case it can be modified in memory without the
+// changes reaching the file. On platforms without mmap(), the contents are instead read
+// into a heap buffer when the file is opened.
+class mapped_file_c
+{
+public:
+    mapped_file_c() {}
+    explicit mapped_file_c(const char *const filename, const bool copyOnWrite = false);
+    ~mapped_file_c();
+
+    mapped_file_c(const mapped_file_c&) = delete;
+    mapped_file_c& operator=(const mapped_file_c&) = delete;
+
+    // Maps the given file, replacing any previous mapping. Returns false if the file
+    // couldn't be opened or mapped, in which case the object is left empty.
+    bool open(const char *const filename, const bool copyOnWrite = false);
+
+    void close(void);
+
+    bool is_open(void) const { return (this->contents != NULL); }
+
+    const u8* data(void) const { return this->contents; }
+
+    // Only valid to write through if the file was opened as copy-on-write.
+    u8* mutable_data(void) { k_assert(this->isWritable, "The mapping is read-only."); return this->contents; }
+
+    size_t size(void) const { return this->numBytes; }
+
+private:
+    u8 *contents = NULL;
+    size_t numBytes = 0;
+    bool isWritable = false;
+};
+
+#endif
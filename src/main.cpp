@@ -6,19 +6,53 @@
  */
 
 #include <cstdlib>
+#include <cstring>
+#include "../src/nnetwork/kernels/kernels.h"
 #include "../src/nnetwork/nnetwork.h"
 #include "../src/train_on/train_on.h"
+#include "../src/cmd_line/cmd_line.h"
+#include "../src/server/inference_server.h"
 
-int main(int argc, char *argv[])
+// Creates a net that operates on scalars of type T, and trains it.
+template <typename T>
+static int run(const int argc, char *const argv[])
 {
-    nnetwork_c net;
+    nnetwork_c<T> net;
 
     if (!k_initialize_net_for_user_data(&net, argc, argv) ||
         !net.announce_current_configuration() ||
-        !k_train_net_on_user_data(&net))
+        !k_train_net_on_user_data(&net, argc, argv))
     {
         return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
 }
+
+int main(int argc, char *argv[])
+{
+    // When serving on stdin/stdout, keep stdout clear of anything but the replies.
+    const char *const serverAddress = k_command_line_option_argument(argc, argv, 's');
+    if (serverAddress &&
+        (strcmp(serverAddress, "-") == 0))
+    {
+        kserver_claim_stdout();
+    }
+
+    // Packing the training data is a job of its own, with no net involved.
+    if (k_command_line_has_option(argc, argv, 'P'))
+    {
+        return (k_pack_user_data(argc, argv)? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    kkernels_initialize();
+
+    if (k_command_line_wants_single_precision(argc, argv))
+    {
+        return run<float>(argc, argv);
+    }
+    else
+    {
+        return run<double>(argc, argv);
+    }
+}
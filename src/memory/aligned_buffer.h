@@ -0,0 +1,214 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * A fixed-size heap array whose storage is aligned for SIMD access.
+ *
+ */
+
+#ifndef ALIGNED_BUFFER_H
+#define ALIGNED_BUFFER_H
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+#include "../../src/common.h"
+
+#ifdef _WIN32
+    #include <malloc.h>
+#endif
+
+// The byte alignment of aligned buffers. Matches the size of a cache line, which is
+// also the width of the widest SIMD registers we might use (AVX-512).
+const uint K_BUFFER_ALIGNMENT = 64;
+
+// Returns the given element count rounded up so that an array of that many T's spans
+// a whole number of aligned blocks. Used to pad matrix rows so that each row starts
+// on an aligned address.
+template <typename T>
+inline size_t k_aligned_count(const size_t count)
+{
+    const size_t elementsPerBlock = (K_BUFFER_ALIGNMENT / sizeof(T));
+
+    return (((count + elementsPerBlock - 1) / elementsPerBlock) * elementsPerBlock);
+}
+
+// Only intended for plain old data, since the contents are moved around with memcpy()
+// and never have their constructors or destructors called.
+//
+// The buffer can also be pointed at memory it doesn't own (see wrap()), e.g. a block in a
+// memory-mapped file; it then reads and writes that memory in place, and doesn't free it.
+template <typename T>
+class aligned_buffer_c
+{
+public:
+    aligned_buffer_c() {}
+
+    explicit aligned_buffer_c(const size_t count, const T initialValue = T(0))
+    {
+        this->resize(count, initialValue);
+    }
+
+    aligned_buffer_c(const aligned_buffer_c &other)
+    {
+        this->operator=(other);
+    }
+
+    aligned_buffer_c(aligned_buffer_c &&other)
+    {
+        this->swap(other);
+    }
+
+    ~aligned_buffer_c()
+    {
+        this->release();
+    }
+
+    aligned_buffer_c& operator=(const aligned_buffer_c &other)
+    {
+        if (this != &other)
+        {
+            this->allocate(other.numElements);
+            if (this->numElements)
+            {
+                memcpy(this->elements, other.elements, (this->numElements * sizeof(T)));
+            }
+        }
+
+        return *this;
+    }
+
+    aligned_buffer_c& operator=(aligned_buffer_c &&other)
+    {
+        this->swap(other);
+
+        return *this;
+    }
+
+    // Reallocates the buffer to hold the given number of elements, all set to the given
+    // value. Any previous contents are discarded.
+    void resize(const size_t count, const T initialValue = T(0))
+    {
+        this->allocate(count);
+        this->fill(initialValue);
+
+        return;
+    }
+
+    void fill(const T value)
+    {
+        for (size_t i = 0; i < this->numElements; i++)
+        {
+            this->elements[i] = value;
+        }
+
+        return;
+    }
+
+    void swap(aligned_buffer_c &other)
+    {
+        std::swap(this->elements, other.elements);
+        std::swap(this->numElements, other.numElements);
+        std::swap(this->ownsElements, other.ownsElements);
+
+        return;
+    }
+
+    // Releases the buffer's current contents, and has it refer to the given externally-owned
+    // array instead. The array must be aligned to K_BUFFER_ALIGNMENT, and must outlive the
+    // buffer (or its next resize).
+    void wrap(T *const externalElements, const size_t count)
+    {
+        k_assert(!(size_t(externalElements) % K_BUFFER_ALIGNMENT), "Expected aligned memory.");
+
+        this->release();
+
+        if (count)
+        {
+            this->elements = externalElements;
+            this->numElements = count;
+            this->ownsElements = false;
+        }
+
+        return;
+    }
+
+    size_t size(void) const { return this->numElements; }
+
+    bool empty(void) const { return !this->numElements; }
+
+    T* data(void) { return this->elements; }
+    const T* data(void) const { return this->elements; }
+
+    T* begin(void) { return this->elements; }
+    T* end(void) { return (this->elements + this->numElements); }
+    const T* begin(void) const { return this->elements; }
+    const T* end(void) const { return (this->elements + this->numElements); }
+
+    T& operator[](const size_t idx) { return this->elements[idx]; }
+    const T& operator[](const size_t idx) const { return this->elements[idx]; }
+
+private:
+    // Makes room for the given number of elements; the contents are left undefined.
+    void allocate(const size_t count)
+    {
+        if ((count == this->numElements) &&
+            this->ownsElements)
+        {
+            return;
+        }
+
+        this->release();
+
+        if (count)
+        {
+            void *mem = NULL;
+
+            #ifdef _WIN32
+                mem = _aligned_malloc((count * sizeof(T)), K_BUFFER_ALIGNMENT);
+            #else
+                if (posix_memalign(&mem, K_BUFFER_ALIGNMENT, (count * sizeof(T))) != 0)
+                {
+                    mem = NULL;
+                }
+            #endif
+
+            if (mem == NULL)
+            {
+                throw std::bad_alloc();
+            }
+
+            this->elements = (T*)mem;
+            this->numElements = count;
+            this->ownsElements = true;
+        }
+
+        return;
+    }
+
+    void release(void)
+    {
+        if (this->ownsElements)
+        {
+            #ifdef _WIN32
+                _aligned_free(this->elements);
+            #else
+                free(this->elements);
+            #endif
+        }
+
+        this->elements = NULL;
+        this->numElements = 0;
+        this->ownsElements = true;
+
+        return;
+    }
+
+    T *elements = NULL;
+    size_t numElements = 0;
+
+    // False if the elements are externally owned (see wrap()).
+    bool ownsElements = true;
+};
+
+#endif
@@ -0,0 +1,58 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * A non-owning, read-only view into a contiguous array.
+ *
+ */
+
+#ifndef ARRAY_VIEW_H
+#define ARRAY_VIEW_H
+
+#include <vector>
+#include "../../src/memory/aligned_buffer.h"
+#include "../../src/common.h"
+
+// Refers to a run of T's that's owned by somebody else; e.g. one image in a dataset's
+// flat array. Lets data be passed around without copying it. The viewed memory must
+// outlive the view.
+template <typename T>
+struct array_view_s
+{
+    array_view_s() {}
+
+    array_view_s(const T *const elements, const size_t numElements) :
+        elements(elements),
+        numElements(numElements)
+    {
+    }
+
+    // Implicit, so that existing containers can be passed wherever a view is expected.
+    array_view_s(const std::vector<T> &vector) :
+        elements(vector.data()),
+        numElements(vector.size())
+    {
+    }
+
+    array_view_s(const aligned_buffer_c<T> &buffer) :
+        elements(buffer.data()),
+        numElements(buffer.size())
+    {
+    }
+
+    size_t size(void) const { return this->numElements; }
+
+    bool empty(void) const { return !this->numElements; }
+
+    const T* data(void) const { return this->elements; }
+
+    const T* begin(void) const { return this->elements; }
+    const T* end(void) const { return (this->elements + this->numElements); }
+
+    const T& operator[](const size_t idx) const { return this->elements[idx]; }
+
+private:
+    const T *elements = NULL;
+    size_t numElements = 0;
+};
+
+#endif
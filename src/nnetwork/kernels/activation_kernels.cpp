@@ -0,0 +1,154 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * Whole-layer kernels for the neurons' activation functions.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "../../../src/nnetwork/kernels/activation_kernels.h"
+#include "../../../src/nnetwork/kernels/kernels.h"
+
+// Each activation function is described by a struct whose forward() and derivative() apply the
+// function and its derivative to a whole layer. Where the arithmetic allows, they're built on the
+// vectorized dense-layer kernels; the exponential functions' forward transforms loop over std::exp()
+// and std::tanh().
+//
+// Note that the derivatives are expressed in terms of the functions' outputs rather than their
+// inputs.
+
+// Passes the sums through as they are.
+template <typename T>
+struct identity_s
+{
+    static void forward(T*, const uint) { return; }
+    static void derivative(const T*, T*, const uint) { return; }
+};
+
+// Rectified linear unit.
+template <typename T>
+struct relu_s
+{
+    static void forward(T *x, const uint n) { kkernels<T>().relu(x, 0, n); }
+    static void derivative(const T *y, T *d, const uint n) { kkernels<T>().relu_derivative(y, 0, d, n); }
+};
+
+// Leaky rectified linear unit.
+template <typename T>
+struct leaky_relu_s
+{
+    static void forward(T *x, const uint n) { kkernels<T>().relu(x, T(0.01), n); }
+    static void derivative(const T *y, T *d, const uint n) { kkernels<T>().relu_derivative(y, T(0.01), d, n); }
+};
+
+// Logistic sigmoid. The derivative is y * (1 - y).
+template <typename T>
+struct log_sigmoid_s
+{
+    static void forward(T *x, const uint n)
+    {
+        for (uint i = 0; i < n; i++)
+        {
+            x[i] = (1 / (1 + std::exp(-x[i])));
+        }
+
+        return;
+    }
+
+    static void derivative(const T *y, T *d, const uint n) { kkernels<T>().quadratic_derivative(y, 0, 1, -1, d, n); }
+};
+
+// Hyperbolic tangent sigmoid. The derivative is 1 - y^2.
+template <typename T>
+struct tanh_sigmoid_s
+{
+    static void forward(T *x, const uint n)
+    {
+        for (uint i = 0; i < n; i++)
+        {
+            x[i] = std::tanh(x[i]);
+        }
+
+        return;
+    }
+
+    static void derivative(const T *y, T *d, const uint n) { kkernels<T>().quadratic_derivative(y, 1, 0, -1, d, n); }
+};
+
+// Modified hyperbolic tangent sigmoid (LeCun et al. 1998). The derivative is (0.6667 / 1.7159) *
+// (1.7159 - y) * (1.7159 + y).
+template <typename T>
+struct mtanh_sigmoid_s
+{
+    static void forward(T *x, const uint n)
+    {
+        for (uint i = 0; i < n; i++)
+        {
+            x[i] = (T(1.7159) * std::tanh(T(0.6667) * x[i]));
+        }
+
+        return;
+    }
+
+    static void derivative(const T *y, T *d, const uint n)
+    {
+        const T k = T(0.6667 / 1.7159);
+
+        kkernels<T>().quadratic_derivative(y, (k * T(1.7159 * 1.7159)), 0, -k, d, n);
+
+        return;
+    }
+};
+
+// Softmax. The derivative is left at 1, on the assumption that softmax is only used on the output
+// layer, with a loss whose gradient at the output is simply the error.
+template <typename T>
+struct softmax_s
+{
+    static void forward(T *x, const uint n)
+    {
+        // Subtract the highest sum from each, for stabilizing potential numerical issues with softmax.
+        const T maxSum = *std::max_element(x, (x + n));
+
+        T expSum = 0;
+        for (uint i = 0; i < n; i++)
+        {
+            x[i] = std::exp(x[i] - maxSum);
+            expSum += x[i];
+        }
+
+        kkernels<T>().scale((1 / expSum), x, n);
+
+        return;
+    }
+
+    static void derivative(const T*, T*, const uint) { return; }
+};
+
+template <typename T, template <typename> class F>
+static const activation_kernels_s<T>& kernels_of(void)
+{
+    static const activation_kernels_s<T> kernels = {F<T>::forward, F<T>::derivative};
+
+    return kernels;
+}
+
+template <typename T>
+const activation_kernels_s<T>& kactivation_kernels(const activation_function_e functionType)
+{
+    switch (functionType)
+    {
+        case activation_function_e::none:          return kernels_of<T, identity_s>();
+        case activation_function_e::relu:          return kernels_of<T, relu_s>();
+        case activation_function_e::leaky_relu:    return kernels_of<T, leaky_relu_s>();
+        case activation_function_e::log_sigmoid:   return kernels_of<T, log_sigmoid_s>();
+        case activation_function_e::tanh_sigmoid:  return kernels_of<T, tanh_sigmoid_s>();
+        case activation_function_e::mtanh_sigmoid: return kernels_of<T, mtanh_sigmoid_s>();
+        case activation_function_e::softmax:       return kernels_of<T, softmax_s>();
+        default: NBENE(("Failed to find an activation function for id %d.", (int)functionType)); return kernels_of<T, identity_s>();
+    }
+}
+
+template const activation_kernels_s<float>& kactivation_kernels<float>(const activation_function_e);
+template const activation_kernels_s<double>& kactivation_kernels<double>(const activation_function_e);
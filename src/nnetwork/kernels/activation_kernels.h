@@ -0,0 +1,43 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * Whole-layer kernels for the neurons' activation functions.
+ *
+ */
+
+#ifndef ACTIVATION_KERNELS_H
+#define ACTIVATION_KERNELS_H
+
+#include "../../../src/common.h"
+
+// Types of functions we can apply to the sum of the inputs to a neuron to produce its output value.
+enum class activation_function_e
+{
+    none = 0,
+    relu,
+    leaky_relu,
+    log_sigmoid,
+    tanh_sigmoid,
+    mtanh_sigmoid,
+    softmax
+};
+
+// The activation function of a layer, applied to all of the layer's neurons at once. Each
+// activation function has its own instance of these kernels, picked for the layer when it's
+// created, so the passes don't need to decide on the function per neuron.
+template <typename T>
+struct activation_kernels_s
+{
+    // Replaces each of the n neuron input sums in x with the neuron's output.
+    void (*forward)(T *x, const uint n);
+
+    // Multiplies each of the n error terms in d by the activation function's derivative at the
+    // corresponding neuron output in y.
+    void (*derivative)(const T *y, T *d, const uint n);
+};
+
+// Returns the kernels for the given activation function.
+template <typename T>
+const activation_kernels_s<T>& kactivation_kernels(const activation_function_e functionType);
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * Cache-blocked matrix multiplication, on top of the kernel sets' register tiles.
+ *
+ */
+
+#include <algorithm>
+#include "../../../src/nnetwork/kernels/gemm.h"
+#include "../../../src/memory/aligned_buffer.h"
+
+// The number of bytes that the blocks are sized to take up in each level of cache: a strip of a panel of
+// op(B) in L1, a block of op(A) in L2, and a panel of op(B) in L3. Kept to about half of the caches'
+// typical sizes, to leave room for C and for whatever else is in there.
+static const uint L1_BLOCK_BYTES = (16 * 1024);
+static const uint L2_BLOCK_BYTES = (256 * 1024);
+static const uint L3_BLOCK_BYTES = (2 * 1024 * 1024);
+
+// Packs the given range of rows and columns of op(X), i.e. of X or (if transposed) of its transpose,
+// into strips of tileSize rows. Each strip is laid out column by column, as numCols steps of tileSize
+// elements, as gemm_tile expects; the rows that the last strip has past the range are set to zero.
+template <typename T>
+static void pack_strips(const T *const x, const uint ld, const bool transposed,
+                        const uint firstRow, const uint numRows, const uint firstCol, const uint numCols,
+                        const uint tileSize, T *packed)
+{
+    for (uint i = 0; i < numRows; i += tileSize, packed += (size_t(tileSize) * numCols))
+    {
+        const uint stripRows = std::min(tileSize, (numRows - i));
+
+        // The rows of op(X) are the columns of X, so each step of the strip is a run of a row of X.
+        if (transposed)
+        {
+            for (uint p = 0; p < numCols; p++)
+            {
+                const T *const source = (x + (size_t(firstCol + p) * ld) + firstRow + i);
+                T *const step = (packed + (size_t(p) * tileSize));
+
+                std::copy(source, (source + stripRows), step);
+                std::fill((step + stripRows), (step + tileSize), T(0));
+            }
+        }
+        // Otherwise, each step of the strip gathers an element from each of the strip's rows.
+        else
+        {
+            const T *const source = (x + (size_t(firstRow + i) * ld) + firstCol);
+
+            for (uint p = 0; p < numCols; p++)
+            {
+                T *const step = (packed + (size_t(p) * tileSize));
+
+                for (uint r = 0; r < stripRows; r++)
+                {
+                    step[r] = source[(size_t(r) * ld) + p];
+                }
+
+                std::fill((step + stripRows), (step + tileSize), T(0));
+            }
+        }
+    }
+
+    return;
+}
+
+template <typename T>
+void kgemm(const dense_kernels_s<T> &kernels, const bool transposeA, const bool transposeB,
+           const uint m, const uint n, const uint k, const T alpha,
+           const T *const a, const uint lda, const T *const b, const uint ldb,
+           T *const c, const uint ldc)
+{
+    if (!m || !n || !k)
+    {
+        return;
+    }
+
+    const uint tileRows = kernels.gemmTileRows;
+    const uint tileCols = kernels.gemmTileCols;
+
+    // Size the blocks to the caches, as per the budgets above. When the matrices are smaller than the
+    // blocks would be, the blocks shrink to fit.
+    const uint kBlock = std::min(k, std::max(1u, uint(L1_BLOCK_BYTES / (tileCols * sizeof(T)))));
+    const uint mBlock = std::min(m, std::max(tileRows, uint(((L2_BLOCK_BYTES / (kBlock * sizeof(T))) / tileRows) * tileRows)));
+    const uint nBlock = std::min(n, std::max(tileCols, uint(((L3_BLOCK_BYTES / (kBlock * sizeof(T))) / tileCols) * tileCols)));
+
+    // The buffers that the blocks are packed into, and that edge tiles are gathered into; kept from call to
+    // call, and per thread, so that they're only allocated once.
+    static thread_local aligned_buffer_c<T> packedA;
+    static thread_local aligned_buffer_c<T> packedB;
+    static thread_local aligned_buffer_c<T> edgeTile;
+
+    const size_t packedASize = (size_t((mBlock + tileRows - 1) / tileRows) * tileRows * kBlock);
+    const size_t packedBSize = (size_t((nBlock + tileCols - 1) / tileCols) * tileCols * kBlock);
+
+    if (packedA.size() < packedASize)
+    {
+        packedA.resize(packedASize);
+    }
+
+    if (packedB.size() < packedBSize)
+    {
+        packedB.resize(packedBSize);
+    }
+
+    if (edgeTile.size() != (tileRows * tileCols))
+    {
+        edgeTile.resize(tileRows * tileCols);
+    }
+
+    for (uint jc = 0; jc < n; jc += nBlock)
+    {
+        const uint nc = std::min(nBlock, (n - jc));
+
+        for (uint pc = 0; pc < k; pc += kBlock)
+        {
+            const uint kc = std::min(kBlock, (k - pc));
+
+            // The columns of op(B) are the rows of its transpose.
+            pack_strips(b, ldb, !transposeB, jc, nc, pc, kc, tileCols, packedB.data());
+
+            for (uint ic = 0; ic < m; ic += mBlock)
+            {
+                const uint mc = std::min(mBlock, (m - ic));
+
+                pack_strips(a, lda, transposeA, ic, mc, pc, kc, tileRows, packedA.data());
+
+                for (uint jr = 0; jr < nc; jr += tileCols)
+                {
+                    const uint tileWidth = std::min(tileCols, (nc - jr));
+                    const T *const bStrip = (packedB.data() + (size_t(jr) * kc));
+
+                    for (uint ir = 0; ir < mc; ir += tileRows)
+                    {
+                        const uint tileHeight = std::min(tileRows, (mc - ir));
+                        const T *const aStrip = (packedA.data() + (size_t(ir) * kc));
+                        T *const cTile = (c + (size_t(ic + ir) * ldc) + jc + jr);
+
+                        if ((tileHeight == tileRows) &&
+                            (tileWidth == tileCols))
+                        {
+                            kernels.gemm_tile(kc, alpha, aStrip, bStrip, cTile, ldc);
+                        }
+                        else
+                        {
+                            edgeTile.fill(0);
+                            kernels.gemm_tile(kc, alpha, aStrip, bStrip, edgeTile.data(), tileCols);
+
+                            for (uint r = 0; r < tileHeight; r++)
+                            {
+                                for (uint col = 0; col < tileWidth; col++)
+                                {
+                                    cTile[(size_t(r) * ldc) + col] += edgeTile[(r * tileCols) + col];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return;
+}
+
+template void kgemm(const dense_kernels_s<float>&, const bool, const bool, const uint, const uint, const uint, const float,
+                    const float *const, const uint, const float *const, const uint, float *const, const uint);
+template void kgemm(const dense_kernels_s<double>&, const bool, const bool, const uint, const uint, const uint, const double,
+                    const double *const, const uint, const double *const, const uint, double *const, const uint);
@@ -0,0 +1,33 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * Cache-blocked matrix multiplication, on top of the kernel sets' register tiles.
+ *
+ */
+
+#ifndef GEMM_H
+#define GEMM_H
+
+#include "../../../src/nnetwork/kernels/kernels.h"
+#include "../../../src/common.h"
+
+// Adds alpha times the product of op(A) and op(B) into C, where op(X) is either X or its transpose, as
+// selected by transposeA and transposeB. op(A) is m x k, op(B) k x n, and C m x n. The matrices are
+// row-major, with the given distances, in elements, between the starts of their rows (before any
+// transposing); so e.g. with transposeA, A is stored as k rows of at least m elements.
+//
+// The multiplication is done in blocks sized to stay in the caches (as per Goto & van de Geijn 2008):
+// op(B) is cut into panels of up to a few hundred rows, each of which is packed into a contiguous
+// buffer, tile-width strip by strip, to be kept in the L2/L3 caches while all of op(A) is run against
+// it; and op(A) into blocks of rows that fit in the L2 cache, packed likewise, tile-height strip by
+// strip. Each pair of strips is then multiplied by the kernel set's gemm_tile, with a strip of the
+// panel staying in the L1 cache for the length of the block. Strips at the edges of the matrices,
+// where there aren't enough rows or columns left for a whole tile, are padded with zeros, and their
+// tiles are gathered into a buffer before being added into C.
+template <typename T>
+void kgemm(const dense_kernels_s<T> &kernels, const bool transposeA, const bool transposeB,
+           const uint m, const uint n, const uint k, const T alpha,
+           const T *const a, const uint lda, const T *const b, const uint ldb,
+           T *const c, const uint ldc);
+
+#endif
@@ -0,0 +1,625 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * Vectorized kernels for the inner loops of the dense layers' passes, with the
+ * implementation chosen at runtime to match the host CPU.
+ *
+ */
+
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <vector>
+#include <cmath>
+#include "../../../src/nnetwork/kernels/kernels.h"
+#include "../../../src/nnetwork/kernels/gemm.h"
+
+template <typename T>
+static T dot_scalar(const T *a, const T *b, const uint n)
+{
+    T sum = 0;
+
+    for (uint i = 0; i < n; i++)
+    {
+        sum += (a[i] * b[i]);
+    }
+
+    return sum;
+}
+
+template <typename T>
+static void dot_x4_scalar(const T *a, const T *b0, const T *b1, const T *b2, const T *b3,
+                          const uint n, T *const dst)
+{
+    dst[0] = dot_scalar(a, b0, n);
+    dst[1] = dot_scalar(a, b1, n);
+    dst[2] = dot_scalar(a, b2, n);
+    dst[3] = dot_scalar(a, b3, n);
+
+    return;
+}
+
+template <typename T>
+static void axpy_scalar(const T alpha, const T *x, T *y, const uint n)
+{
+    for (uint i = 0; i < n; i++)
+    {
+        y[i] += (alpha * x[i]);
+    }
+
+    return;
+}
+
+template <typename T>
+static void backprop_step_scalar(const T delta, const T step, const T *x, T *w, T *y, const uint n)
+{
+    for (uint i = 0; i < n; i++)
+    {
+        y[i] += (delta * w[i]);
+        w[i] += (step * x[i]);
+    }
+
+    return;
+}
+
+template <typename T>
+static void scale_u8_scalar(const u8 *x, const T scale, T *y, const uint n)
+{
+    for (uint i = 0; i < n; i++)
+    {
+        y[i] = (scale * x[i]);
+    }
+
+    return;
+}
+
+template <typename T>
+static void scale_scalar(const T alpha, T *x, const uint n)
+{
+    for (uint i = 0; i < n; i++)
+    {
+        x[i] *= alpha;
+    }
+
+    return;
+}
+
+template <typename T>
+static void relu_scalar(T *x, const T negativeSlope, const uint n)
+{
+    for (uint i = 0; i < n; i++)
+    {
+        x[i] = ((x[i] > 0)? x[i] : (negativeSlope * x[i]));
+    }
+
+    return;
+}
+
+template <typename T>
+static void relu_derivative_scalar(const T *y, const T negativeSlope, T *d, const uint n)
+{
+    for (uint i = 0; i < n; i++)
+    {
+        d[i] *= ((y[i] > 0)? 1 : negativeSlope);
+    }
+
+    return;
+}
+
+template <typename T>
+static void quadratic_derivative_scalar(const T *y, const T a, const T b, const T c, T *d, const uint n)
+{
+    for (uint i = 0; i < n; i++)
+    {
+        d[i] *= (a + (y[i] * (b + (c * y[i]))));
+    }
+
+    return;
+}
+
+template <typename T>
+static void momentum_step_scalar(const T *g, const T stepScale, const T momentum, const T velocityWeight,
+                                 const T gradientWeight, T *v, T *w, const uint n)
+{
+    for (uint i = 0; i < n; i++)
+    {
+        const T step = (stepScale * g[i]);
+
+        v[i] = ((momentum * v[i]) + step);
+        w[i] += ((velocityWeight * v[i]) + (gradientWeight * step));
+    }
+
+    return;
+}
+
+template <typename T>
+static void adam_step_scalar(const T *g, const T gradScale, const T beta1, const T beta2, const T stepSize,
+                             const T epsilon, T *m, T *v, T *w, const uint n)
+{
+    for (uint i = 0; i < n; i++)
+    {
+        const T gradient = (gradScale * g[i]);
+
+        m[i] = ((beta1 * m[i]) + ((1 - beta1) * gradient));
+        v[i] = ((beta2 * v[i]) + ((1 - beta2) * gradient * gradient));
+        w[i] -= ((stepSize * m[i]) / (std::sqrt(v[i]) + epsilon));
+    }
+
+    return;
+}
+
+// The number of rows and columns in the scalar GEMM tile.
+static const uint GEMM_TILE_SIZE_SCALAR = 4;
+
+template <typename T>
+static void gemm_tile_scalar(const uint k, const T alpha, const T *a, const T *b, T *c, const uint ldc)
+{
+    const uint size = GEMM_TILE_SIZE_SCALAR;
+
+    T sums[size][size] = {};
+
+    for (uint p = 0; p < k; p++, a += size, b += size)
+    {
+        for (uint r = 0; r < size; r++)
+        {
+            for (uint col = 0; col < size; col++)
+            {
+                sums[r][col] += (a[r] * b[col]);
+            }
+        }
+    }
+
+    for (uint r = 0; r < size; r++)
+    {
+        for (uint col = 0; col < size; col++)
+        {
+            c[(r * ldc) + col] += (alpha * sums[r][col]);
+        }
+    }
+
+    return;
+}
+
+static i32 dot_int8_scalar(const u8 *a, const i8 *b, const uint n)
+{
+    i32 sum = 0;
+
+    for (uint i = 0; i < n; i++)
+    {
+        sum += (i32(a[i]) * b[i]);
+    }
+
+    return sum;
+}
+
+static void dot_x4_int8_scalar(const u8 *a, const i8 *b0, const i8 *b1, const i8 *b2, const i8 *b3,
+                               const uint n, i32 *const dst)
+{
+    dst[0] = dot_int8_scalar(a, b0, n);
+    dst[1] = dot_int8_scalar(a, b1, n);
+    dst[2] = dot_int8_scalar(a, b2, n);
+    dst[3] = dot_int8_scalar(a, b3, n);
+
+    return;
+}
+
+static const int8_kernels_s INT8_KERNELS_SCALAR = {"scalar", dot_int8_scalar, dot_x4_int8_scalar};
+
+// The int8 kernel set that's been picked for use.
+static const int8_kernels_s *activeInt8Kernels = &INT8_KERNELS_SCALAR;
+
+// The scalar kernel set for T, and the kernel set that's been picked for use.
+template <typename T>
+struct kernel_registry_s
+{
+    static const dense_kernels_s<T> scalar;
+    static const dense_kernels_s<T> *active;
+};
+
+template <typename T>
+const dense_kernels_s<T> kernel_registry_s<T>::scalar = {"scalar", dot_scalar<T>, dot_x4_scalar<T>, axpy_scalar<T>, backprop_step_scalar<T>, scale_u8_scalar<T>,
+                                                                 scale_scalar<T>, relu_scalar<T>, relu_derivative_scalar<T>, quadratic_derivative_scalar<T>,
+                                                                 momentum_step_scalar<T>, adam_step_scalar<T>,
+                                                                 gemm_tile_scalar<T>, GEMM_TILE_SIZE_SCALAR, GEMM_TILE_SIZE_SCALAR};
+
+template <typename T>
+const dense_kernels_s<T> *kernel_registry_s<T>::active = &kernel_registry_s<T>::scalar;
+
+// Returns the kernel sets for T that the CPU supports, in order of increasing preference.
+template <typename T>
+static std::vector<const dense_kernels_s<T>*> supported_kernels(void)
+{
+    std::vector<const dense_kernels_s<T>*> kernels;
+
+    #if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+
+        if (kkernels_sse2<T>() && __builtin_cpu_supports("sse2"))
+        {
+            kernels.push_back(kkernels_sse2<T>());
+        }
+
+        if (kkernels_avx2<T>() && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        {
+            kernels.push_back(kkernels_avx2<T>());
+        }
+
+        if (kkernels_avx512<T>() && __builtin_cpu_supports("avx512f"))
+        {
+            kernels.push_back(kkernels_avx512<T>());
+        }
+    #endif
+
+    return kernels;
+}
+
+// Returns the int8 kernel sets that the CPU supports, in order of increasing preference.
+static std::vector<const int8_kernels_s*> supported_int8_kernels(void)
+{
+    std::vector<const int8_kernels_s*> kernels;
+
+    #if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+
+        if (kkernels_int8_avx2() && __builtin_cpu_supports("avx2"))
+        {
+            kernels.push_back(kkernels_int8_avx2());
+        }
+
+        if (kkernels_int8_avxvnni() && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("avxvnni"))
+        {
+            kernels.push_back(kkernels_int8_avxvnni());
+        }
+    #endif
+
+    return kernels;
+}
+
+void kkernels_initialize(void)
+{
+    const auto kernelsF32 = supported_kernels<float>();
+    const auto kernelsF64 = supported_kernels<double>();
+
+    kernel_registry_s<float>::active = (kernelsF32.empty()? &kernel_registry_s<float>::scalar : kernelsF32.back());
+    kernel_registry_s<double>::active = (kernelsF64.empty()? &kernel_registry_s<double>::scalar : kernelsF64.back());
+
+    const auto kernelsInt8 = supported_int8_kernels();
+    activeInt8Kernels = (kernelsInt8.empty()? &INT8_KERNELS_SCALAR : kernelsInt8.back());
+
+    return;
+}
+
+template <typename T>
+const dense_kernels_s<T>& kkernels(void)
+{
+    return *kernel_registry_s<T>::active;
+}
+
+template <typename T>
+const dense_kernels_s<T>& kkernels_scalar(void)
+{
+    return kernel_registry_s<T>::scalar;
+}
+
+const int8_kernels_s& kkernels_int8(void)
+{
+    return *activeInt8Kernels;
+}
+
+// Returns the largest difference between the two arrays' elements, relative to the
+// magnitude of the reference values.
+template <typename T>
+static double max_relative_error(const std::vector<T> &values, const std::vector<T> &reference)
+{
+    double maxError = 0;
+
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        const double error = (std::fabs(double(values.at(i)) - reference.at(i)) / std::max(1.0, std::fabs(double(reference.at(i)))));
+        maxError = std::max(maxError, error);
+    }
+
+    return maxError;
+}
+
+// Verifies the kernel sets for T against the scalar ones. The tolerance is the largest
+// relative error to accept.
+template <typename T>
+static bool verify_kernels(const double tolerance)
+{
+    const dense_kernels_s<T> &reference = kernel_registry_s<T>::scalar;
+
+    std::mt19937 randomNumberGenerator(1234);
+    std::uniform_real_distribution<T> randomDistribution(-1, 1);
+
+    // Lengths that exercise both the vectorized bodies and the leftover elements.
+    const uint lengths[] = {1, 3, 7, 8, 15, 16, 17, 31, 33, 64, 100, 784, 1025};
+    const uint maxLength = *std::max_element(std::begin(lengths), std::end(lengths));
+
+    std::vector<std::vector<T>> arrays(6);
+    for (auto &array: arrays)
+    {
+        array.resize(maxLength + 1);
+        std::generate(array.begin(), array.end(), [&]{ return randomDistribution(randomNumberGenerator); });
+    }
+
+    std::vector<u8> bytes(maxLength + 1);
+    std::generate(bytes.begin(), bytes.end(), [&]{ return u8(randomNumberGenerator()); });
+
+    bool allPassed = true;
+
+    for (const auto *const kernels: supported_kernels<T>())
+    {
+        double maxError = 0;
+
+        for (const uint n: lengths)
+        {
+            std::vector<T> result, expected;
+
+            // Dot product.
+            result.push_back(kernels->dot(arrays[0].data(), arrays[1].data(), n));
+            expected.push_back(reference.dot(arrays[0].data(), arrays[1].data(), n));
+
+            // Four dot products at once.
+            {
+                T dst[4], refDst[4];
+
+                kernels->dot_x4(arrays[0].data(), arrays[1].data(), arrays[2].data(), arrays[3].data(), arrays[4].data(), n, dst);
+                reference.dot_x4(arrays[0].data(), arrays[1].data(), arrays[2].data(), arrays[3].data(), arrays[4].data(), n, refDst);
+
+                result.insert(result.end(), std::begin(dst), std::end(dst));
+                expected.insert(expected.end(), std::begin(refDst), std::end(refDst));
+            }
+
+            // Axpy. Also checks that no elements past the nth get written to.
+            {
+                std::vector<T> y(arrays[5].begin(), (arrays[5].begin() + n + 1));
+                std::vector<T> refY = y;
+
+                kernels->axpy(T(0.37), arrays[0].data(), y.data(), n);
+                reference.axpy(T(0.37), arrays[0].data(), refY.data(), n);
+
+                result.insert(result.end(), y.begin(), y.end());
+                expected.insert(expected.end(), refY.begin(), refY.end());
+            }
+
+            // The fused backward step, which updates both arrays. Also checks that no elements past the nth get written to.
+            {
+                std::vector<T> w(arrays[5].begin(), (arrays[5].begin() + n + 1));
+                std::vector<T> y(arrays[1].begin(), (arrays[1].begin() + n + 1));
+                std::vector<T> refW = w;
+                std::vector<T> refY = y;
+
+                kernels->backprop_step(T(0.37), T(-0.05), arrays[0].data(), w.data(), y.data(), n);
+                reference.backprop_step(T(0.37), T(-0.05), arrays[0].data(), refW.data(), refY.data(), n);
+
+                result.insert(result.end(), w.begin(), w.end());
+                result.insert(result.end(), y.begin(), y.end());
+                expected.insert(expected.end(), refW.begin(), refW.end());
+                expected.insert(expected.end(), refY.begin(), refY.end());
+            }
+
+            // Byte conversion. Also checks that no elements past the nth get written to.
+            {
+                std::vector<T> y(arrays[5].begin(), (arrays[5].begin() + n + 1));
+                std::vector<T> refY = y;
+
+                kernels->scale_u8(bytes.data(), T(1/255.0), y.data(), n);
+                reference.scale_u8(bytes.data(), T(1/255.0), refY.data(), n);
+
+                result.insert(result.end(), y.begin(), y.end());
+                expected.insert(expected.end(), refY.begin(), refY.end());
+            }
+
+            // The elementwise activation kernels. Each of these also checks that no elements past the nth get written to.
+            {
+                const std::vector<std::function<void(const dense_kernels_s<T>&, T*)>> elementwiseOps =
+                    {[&](const dense_kernels_s<T> &k, T *y){ k.scale(T(-0.61), y, n); },
+                     [&](const dense_kernels_s<T> &k, T *y){ k.relu(y, T(0.01), n); },
+                     [&](const dense_kernels_s<T> &k, T *y){ k.relu_derivative(arrays[0].data(), T(0.01), y, n); },
+                     [&](const dense_kernels_s<T> &k, T *y){ k.quadratic_derivative(arrays[0].data(), T(0.4), T(-0.7), T(1.3), y, n); }};
+
+                for (const auto &op: elementwiseOps)
+                {
+                    std::vector<T> y(arrays[5].begin(), (arrays[5].begin() + n + 1));
+                    std::vector<T> refY = y;
+
+                    op(*kernels, y.data());
+                    op(reference, refY.data());
+
+                    result.insert(result.end(), y.begin(), y.end());
+                    expected.insert(expected.end(), refY.begin(), refY.end());
+                }
+            }
+
+            // The optimizer steps, which update both the weights and the optimizer's state. Also checks that no
+            // elements past the nth get written to.
+            {
+                const std::vector<std::function<void(const dense_kernels_s<T>&, T*, T*, T*)>> optimizerOps =
+                    {[&](const dense_kernels_s<T> &k, T *w, T *m, T*){ k.momentum_step(arrays[0].data(), T(-0.05), T(0.9), T(0.9), T(1), m, w, n); },
+                     [&](const dense_kernels_s<T> &k, T *w, T *m, T *v){ k.adam_step(arrays[0].data(), T(0.5), T(0.9), T(0.999), T(0.01), T(1e-4), m, v, w, n); }};
+
+                for (const auto &op: optimizerOps)
+                {
+                    // The second moments are squares, so keep them positive.
+                    std::vector<T> w(arrays[5].begin(), (arrays[5].begin() + n + 1));
+                    std::vector<T> m(arrays[1].begin(), (arrays[1].begin() + n + 1));
+                    std::vector<T> v(n + 1);
+                    std::transform(arrays[2].begin(), (arrays[2].begin() + n + 1), v.begin(), [](const T x){ return std::fabs(x); });
+                    std::vector<T> refW = w, refM = m, refV = v;
+
+                    op(*kernels, w.data(), m.data(), v.data());
+                    op(reference, refW.data(), refM.data(), refV.data());
+
+                    for (const auto *const values: {&w, &m, &v})
+                    {
+                        result.insert(result.end(), values->begin(), values->end());
+                    }
+
+                    for (const auto *const values: {&refW, &refM, &refV})
+                    {
+                        expected.insert(expected.end(), values->begin(), values->end());
+                    }
+                }
+            }
+
+            maxError = std::max(maxError, max_relative_error(result, expected));
+        }
+
+        const bool passed = (maxError < tolerance);
+        allPassed = (allPassed && passed);
+
+        printf("\t%s (%s): max. relative error %g (%s)\n",
+               kernels->name, ((sizeof(T) == sizeof(float))? "float" : "double"), maxError, (passed? "OK" : "FAIL"));
+    }
+
+    return allPassed;
+}
+
+// Verifies kgemm() on each kernel set for T, the scalar one included, against a plain triple loop; in each
+// combination of transposes, and for shapes that leave partial tiles at the edges and that span several
+// cache blocks. The tolerance is the largest relative error to accept.
+template <typename T>
+static bool verify_gemm(const double tolerance)
+{
+    std::mt19937 randomNumberGenerator(1234);
+    std::uniform_real_distribution<T> randomDistribution(-1, 1);
+    const auto random_values = [&](const size_t count)
+    {
+        std::vector<T> values(count);
+        std::generate(values.begin(), values.end(), [&]{ return randomDistribution(randomNumberGenerator); });
+
+        return values;
+    };
+
+    // m, n and k of op(A) (m x k) and op(B) (k x n).
+    const uint shapes[][3] = {{1, 1, 1}, {5, 7, 3}, {13, 37, 29}, {33, 70, 300}, {64, 130, 513}, {300, 17, 140}, {3, 600, 1100}};
+
+    std::vector<const dense_kernels_s<T>*> kernelSets = supported_kernels<T>();
+    kernelSets.insert(kernelSets.begin(), &kernel_registry_s<T>::scalar);
+
+    bool allPassed = true;
+
+    for (const auto *const kernels: kernelSets)
+    {
+        double maxError = 0;
+
+        for (const auto &shape: shapes)
+        {
+            const uint m = shape[0], n = shape[1], k = shape[2];
+
+            for (uint transposes = 0; transposes < 4; transposes++)
+            {
+                const bool transposeA = (transposes & 1);
+                const bool transposeB = (transposes & 2);
+
+                // The rows are padded past their length, so that we also check that C's padding isn't written to.
+                const uint lda = ((transposeA? m : k) + 3);
+                const uint ldb = ((transposeB? k : n) + 3);
+                const uint ldc = (n + 3);
+
+                const std::vector<T> a = random_values(size_t(transposeA? k : m) * lda);
+                const std::vector<T> b = random_values(size_t(transposeB? n : k) * ldb);
+                std::vector<T> c = random_values(size_t(m) * ldc);
+                std::vector<T> refC = c;
+
+                kgemm(*kernels, transposeA, transposeB, m, n, k, T(0.7), a.data(), lda, b.data(), ldb, c.data(), ldc);
+
+                for (uint i = 0; i < m; i++)
+                {
+                    for (uint j = 0; j < n; j++)
+                    {
+                        T sum = 0;
+
+                        for (uint p = 0; p < k; p++)
+                        {
+                            sum += ((transposeA? a[(p * lda) + i] : a[(i * lda) + p]) *
+                                    (transposeB? b[(j * ldb) + p] : b[(p * ldb) + j]));
+                        }
+
+                        refC[(i * ldc) + j] += (T(0.7) * sum);
+                    }
+                }
+
+                maxError = std::max(maxError, max_relative_error(c, refC));
+            }
+        }
+
+        const bool passed = (maxError < tolerance);
+        allPassed = (allPassed && passed);
+
+        printf("\t%s GEMM (%s): max. relative error %g (%s)\n",
+               kernels->name, ((sizeof(T) == sizeof(float))? "float" : "double"), maxError, (passed? "OK" : "FAIL"));
+    }
+
+    return allPassed;
+}
+
+// Verifies the int8 kernel sets against the scalar one. Being integer arithmetic, their
+// results should match exactly.
+static bool verify_int8_kernels(void)
+{
+    std::mt19937 randomNumberGenerator(1234);
+
+    const uint lengths[] = {1, 3, 31, 32, 33, 63, 64, 65, 100, 784, 1025};
+    const uint maxLength = *std::max_element(std::begin(lengths), std::end(lengths));
+
+    // The extremes of the value ranges, to catch any saturation.
+    std::vector<u8> activations(maxLength, 127);
+    std::vector<std::vector<i8>> weights(4, std::vector<i8>(maxLength, 127));
+    std::fill(weights[1].begin(), weights[1].end(), -127);
+
+    std::vector<u8> randomActivations(maxLength);
+    std::generate(randomActivations.begin(), randomActivations.end(), [&]{ return u8(randomNumberGenerator() % 128); });
+    for (uint w = 2; w < 4; w++)
+    {
+        std::generate(weights[w].begin(), weights[w].end(), [&]{ return i8(int(randomNumberGenerator() % 255) - 127); });
+    }
+
+    bool allPassed = true;
+
+    for (const auto *const kernels: supported_int8_kernels())
+    {
+        bool passed = true;
+
+        for (const uint n: lengths)
+        {
+            for (const auto *const a: {activations.data(), randomActivations.data()})
+            {
+                i32 dst[4], refDst[4];
+
+                kernels->dot_x4(a, weights[0].data(), weights[1].data(), weights[2].data(), weights[3].data(), n, dst);
+                INT8_KERNELS_SCALAR.dot_x4(a, weights[0].data(), weights[1].data(), weights[2].data(), weights[3].data(), n, refDst);
+
+                for (uint w = 0; w < 4; w++)
+                {
+                    passed = (passed &&
+                              (dst[w] == refDst[w]) &&
+                              (kernels->dot(a, weights[w].data(), n) == refDst[w]));
+                }
+            }
+        }
+
+        allPassed = (allPassed && passed);
+
+        printf("\t%s (int8): %s\n", kernels->name, (passed? "OK" : "FAIL"));
+    }
+
+    return allPassed;
+}
+
+bool kkernels_verify(void)
+{
+    const bool floatPassed = verify_kernels<float>(1e-4);
+    const bool doublePassed = verify_kernels<double>(1e-9);
+    const bool floatGemmPassed = verify_gemm<float>(1e-4);
+    const bool doubleGemmPassed = verify_gemm<double>(1e-9);
+    const bool int8Passed = verify_int8_kernels();
+
+    return (floatPassed && doublePassed && floatGemmPassed && doubleGemmPassed && int8Passed);
+}
+
+template const dense_kernels_s<float>& kkernels<float>(void);
+template const dense_kernels_s<double>& kkernels<double>(void);
+template const dense_kernels_s<float>& kkernels_scalar<float>(void);
+template const dense_kernels_s<double>& kkernels_scalar<double>(void);
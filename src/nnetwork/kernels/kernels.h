@@ -0,0 +1,136 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * Vectorized kernels for the inner loops of the dense layers' passes, with the
+ * implementation chosen at runtime to match the host CPU.
+ *
+ */
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "../../../src/common.h"
+
+// A set of implementations of the arithmetic that the neural network's passes spend
+// their time in, for scalars of type T. Each member points to the variant of the
+// operation that's written for a particular instruction set.
+template <typename T>
+struct dense_kernels_s
+{
+    // A human-readable name of the instruction set this kernel set targets; e.g. "AVX2".
+    const char *name;
+
+    // Returns the dot product of the given arrays of n elements.
+    T (*dot)(const T *a, const T *b, const uint n);
+
+    // Computes the dot products of the given array against four other arrays of n
+    // elements, returning them in dst[0..3]. Loads the shared array only once.
+    void (*dot_x4)(const T *a, const T *b0, const T *b1, const T *b2, const T *b3,
+                   const uint n, T *const dst);
+
+    // Adds alpha * x into y, for the n elements of the arrays.
+    void (*axpy)(const T alpha, const T *x, T *y, const uint n);
+
+    // Adds delta * w into y and then step * x into w, for the n elements of the arrays,
+    // in one pass over w; so y gets the elements of w from before the update. For the
+    // backward pass of a sample to update a row of weights as it propagates through it.
+    void (*backprop_step)(const T delta, const T step, const T *x, T *w, T *y, const uint n);
+
+    // Sets y to the n bytes of x converted to T and multiplied by scale; e.g. for
+    // normalizing 8-bit pixel values on their way into the input layer.
+    void (*scale_u8)(const u8 *x, const T scale, T *y, const uint n);
+
+    // Multiplies the n elements of x by alpha.
+    void (*scale)(const T alpha, T *x, const uint n);
+
+    // Multiplies each of the n elements of x that isn't positive by negativeSlope; i.e.
+    // applies the (leaky) rectified linear function to them in place.
+    void (*relu)(T *x, const T negativeSlope, const uint n);
+
+    // Multiplies each of the n elements of d by 1 if the corresponding element of y is
+    // positive, or else by negativeSlope; i.e. by the derivative of the (leaky) rectified
+    // linear function at y.
+    void (*relu_derivative)(const T *y, const T negativeSlope, T *d, const uint n);
+
+    // Multiplies each of the n elements of d by (a + b*y + c*y^2), where y is the
+    // corresponding element of y. The derivatives of the sigmoid-type activation
+    // functions can be expressed this way in terms of the functions' outputs.
+    void (*quadratic_derivative)(const T *y, const T a, const T b, const T c, T *d, const uint n);
+
+    // Takes a step of gradient descent with momentum on the n weights in w, given their
+    // gradients in g and their velocities in v, in one pass: each velocity becomes
+    // (momentum*v + stepScale*g), and each weight moves by (velocityWeight*v +
+    // gradientWeight*stepScale*g), with the new v. Classical momentum has weights of 1
+    // and 0; Nesterov's, of momentum and 1.
+    void (*momentum_step)(const T *g, const T stepScale, const T momentum, const T velocityWeight,
+                          const T gradientWeight, T *v, T *w, const uint n);
+
+    // Takes a step of Adam (Kingma & Ba 2015) on the n weights in w, given their gradients
+    // in g (each multiplied by gradScale) and their first and second moments in m and v,
+    // in one pass: each m becomes (beta1*m + (1 - beta1)*g), each v (beta2*v + (1 - beta2)*g^2),
+    // and each weight moves by -stepSize*m/(sqrt(v) + epsilon). The moments' bias correction
+    // is expected to have been folded into stepSize and epsilon.
+    void (*adam_step)(const T *g, const T gradScale, const T beta1, const T beta2, const T stepSize,
+                      const T epsilon, T *m, T *v, T *w, const uint n);
+
+    // The inner kernel of kgemm() (see gemm.h): multiplies a block of gemmTileRows rows
+    // of one matrix by a block of gemmTileCols columns of another, holding the resulting
+    // tile in registers throughout, and adds alpha times the tile into the matrix at c,
+    // whose rows are ldc elements apart. The blocks are given packed into k steps, each
+    // step holding a column of the first block (gemmTileRows elements) or a row of the
+    // second (gemmTileCols elements).
+    void (*gemm_tile)(const uint k, const T alpha, const T *a, const T *b, T *c, const uint ldc);
+    uint gemmTileRows;
+    uint gemmTileCols;
+};
+
+// The integer arithmetic of the int8 quantized net (see quantized_nnetwork.h). The
+// activations are unsigned bytes of at most 127 and the weights signed bytes of
+// -127..127, so that the pairwise sums of products that the AVX2 instructions form in
+// 16 bits can't saturate.
+struct int8_kernels_s
+{
+    // A human-readable name of the instruction set this kernel set targets.
+    const char *name;
+
+    // Returns the dot product of the given arrays of n elements.
+    i32 (*dot)(const u8 *a, const i8 *b, const uint n);
+
+    // Computes the dot products of the given array against four other arrays of n
+    // elements, returning them in dst[0..3]. Loads the shared array only once.
+    void (*dot_x4)(const u8 *a, const i8 *b0, const i8 *b1, const i8 *b2, const i8 *b3,
+                   const uint n, i32 *const dst);
+};
+
+// Detects the CPU's capabilities and picks the fastest kernel sets it supports. Should
+// be called once at startup, before any of the kernels are used; until then, the
+// scalar kernels are active.
+void kkernels_initialize(void);
+
+// Returns the kernel set picked by kkernels_initialize().
+template <typename T>
+const dense_kernels_s<T>& kkernels(void);
+
+// Returns the plain C++ kernel set, for reference.
+template <typename T>
+const dense_kernels_s<T>& kkernels_scalar(void);
+
+// Returns the int8 kernel set picked by kkernels_initialize().
+const int8_kernels_s& kkernels_int8(void);
+
+// Runs each kernel set the CPU supports on random data, and prints to the terminal how
+// far their results deviate from the scalar kernels'; likewise for kgemm() on each
+// kernel set, against a plain loop. Returns false if any of them deviates by more than
+// rounding errors would account for.
+bool kkernels_verify(void);
+
+// The vectorized kernel sets. These are only valid to use if the CPU supports the
+// corresponding instruction set; and return null on targets where the set isn't
+// implemented.
+template <typename T> const dense_kernels_s<T>* kkernels_sse2(void);
+template <typename T> const dense_kernels_s<T>* kkernels_avx2(void);
+template <typename T> const dense_kernels_s<T>* kkernels_avx512(void);
+const int8_kernels_s* kkernels_int8_avx2(void);
+const int8_kernels_s* kkernels_int8_avxvnni(void);
+
+#endif
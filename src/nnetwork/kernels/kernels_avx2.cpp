@@ -0,0 +1,533 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * AVX2 (with FMA) versions of the dense-layer kernels.
+ *
+ */
+
+#include "../../../src/nnetwork/kernels/kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+#include <cstring>
+#include <cmath>
+
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+// Wrappers for the AVX2 intrinsics of T, so that the kernels can be written once
+// for both float and double.
+template <typename T> struct avx2_s;
+
+template <>
+struct avx2_s<double>
+{
+    typedef __m256d vec_t;
+    static const uint width = 4;
+
+    AVX2_TARGET static vec_t zero(void) { return _mm256_setzero_pd(); }
+    AVX2_TARGET static vec_t set1(const double v) { return _mm256_set1_pd(v); }
+    AVX2_TARGET static vec_t load(const double *p) { return _mm256_loadu_pd(p); }
+    AVX2_TARGET static vec_t load_u8(const u8 *p) { u32 v; memcpy(&v, p, sizeof(v)); return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(v))); }
+    AVX2_TARGET static void store(double *p, const vec_t v) { _mm256_storeu_pd(p, v); }
+    AVX2_TARGET static vec_t add(const vec_t a, const vec_t b) { return _mm256_add_pd(a, b); }
+    AVX2_TARGET static vec_t mul(const vec_t a, const vec_t b) { return _mm256_mul_pd(a, b); }
+    AVX2_TARGET static vec_t div(const vec_t a, const vec_t b) { return _mm256_div_pd(a, b); }
+    AVX2_TARGET static vec_t sqrt(const vec_t a) { return _mm256_sqrt_pd(a); }
+    AVX2_TARGET static vec_t select_positive(const vec_t x, const vec_t a, const vec_t b) { return _mm256_blendv_pd(b, a, _mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_GT_OQ)); }
+    AVX2_TARGET static vec_t mul_add(const vec_t a, const vec_t b, const vec_t c) { return _mm256_fmadd_pd(a, b, c); }
+    AVX2_TARGET static double sum(const vec_t v)
+    {
+        const __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+        return (_mm_cvtsd_f64(pair) + _mm_cvtsd_f64(_mm_unpackhi_pd(pair, pair)));
+    }
+};
+
+template <>
+struct avx2_s<float>
+{
+    typedef __m256 vec_t;
+    static const uint width = 8;
+
+    AVX2_TARGET static vec_t zero(void) { return _mm256_setzero_ps(); }
+    AVX2_TARGET static vec_t set1(const float v) { return _mm256_set1_ps(v); }
+    AVX2_TARGET static vec_t load(const float *p) { return _mm256_loadu_ps(p); }
+    AVX2_TARGET static vec_t load_u8(const u8 *p) { return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p))); }
+    AVX2_TARGET static void store(float *p, const vec_t v) { _mm256_storeu_ps(p, v); }
+    AVX2_TARGET static vec_t add(const vec_t a, const vec_t b) { return _mm256_add_ps(a, b); }
+    AVX2_TARGET static vec_t mul(const vec_t a, const vec_t b) { return _mm256_mul_ps(a, b); }
+    AVX2_TARGET static vec_t div(const vec_t a, const vec_t b) { return _mm256_div_ps(a, b); }
+    AVX2_TARGET static vec_t sqrt(const vec_t a) { return _mm256_sqrt_ps(a); }
+    AVX2_TARGET static vec_t select_positive(const vec_t x, const vec_t a, const vec_t b) { return _mm256_blendv_ps(b, a, _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ)); }
+    AVX2_TARGET static vec_t mul_add(const vec_t a, const vec_t b, const vec_t c) { return _mm256_fmadd_ps(a, b, c); }
+    AVX2_TARGET static float sum(const vec_t v)
+    {
+        const __m128 quad = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        const __m128 pairs = _mm_add_ps(quad, _mm_movehl_ps(quad, quad));
+        return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+    }
+};
+
+template <typename T>
+AVX2_TARGET static T dot_avx2(const T *a, const T *b, const uint n)
+{
+    typedef avx2_s<T> V;
+    const uint w = V::width;
+
+    // Four independent accumulators, to hide the latency of the FMAs.
+    typename V::vec_t sum0 = V::zero();
+    typename V::vec_t sum1 = V::zero();
+    typename V::vec_t sum2 = V::zero();
+    typename V::vec_t sum3 = V::zero();
+
+    uint i = 0;
+    for (; (i + 4*w) <= n; i += 4*w)
+    {
+        sum0 = V::mul_add(V::load(a + i),       V::load(b + i),       sum0);
+        sum1 = V::mul_add(V::load(a + i + w),   V::load(b + i + w),   sum1);
+        sum2 = V::mul_add(V::load(a + i + 2*w), V::load(b + i + 2*w), sum2);
+        sum3 = V::mul_add(V::load(a + i + 3*w), V::load(b + i + 3*w), sum3);
+    }
+
+    for (; (i + w) <= n; i += w)
+    {
+        sum0 = V::mul_add(V::load(a + i), V::load(b + i), sum0);
+    }
+
+    T sum = V::sum(V::add(V::add(sum0, sum1), V::add(sum2, sum3)));
+
+    for (; i < n; i++)
+    {
+        sum += (a[i] * b[i]);
+    }
+
+    return sum;
+}
+
+template <typename T>
+AVX2_TARGET static void dot_x4_avx2(const T *a, const T *b0, const T *b1, const T *b2, const T *b3,
+                                    const uint n, T *const dst)
+{
+    typedef avx2_s<T> V;
+
+    typename V::vec_t sum0 = V::zero();
+    typename V::vec_t sum1 = V::zero();
+    typename V::vec_t sum2 = V::zero();
+    typename V::vec_t sum3 = V::zero();
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t va = V::load(a + i);
+
+        sum0 = V::mul_add(va, V::load(b0 + i), sum0);
+        sum1 = V::mul_add(va, V::load(b1 + i), sum1);
+        sum2 = V::mul_add(va, V::load(b2 + i), sum2);
+        sum3 = V::mul_add(va, V::load(b3 + i), sum3);
+    }
+
+    dst[0] = V::sum(sum0);
+    dst[1] = V::sum(sum1);
+    dst[2] = V::sum(sum2);
+    dst[3] = V::sum(sum3);
+
+    for (; i < n; i++)
+    {
+        dst[0] += (a[i] * b0[i]);
+        dst[1] += (a[i] * b1[i]);
+        dst[2] += (a[i] * b2[i]);
+        dst[3] += (a[i] * b3[i]);
+    }
+
+    return;
+}
+
+template <typename T>
+AVX2_TARGET static void axpy_avx2(const T alpha, const T *x, T *y, const uint n)
+{
+    typedef avx2_s<T> V;
+
+    const typename V::vec_t valpha = V::set1(alpha);
+
+    uint i = 0;
+    for (; (i + 2*V::width) <= n; i += 2*V::width)
+    {
+        V::store((y + i),            V::mul_add(valpha, V::load(x + i),            V::load(y + i)));
+        V::store((y + i + V::width), V::mul_add(valpha, V::load(x + i + V::width), V::load(y + i + V::width)));
+    }
+
+    for (; i < n; i++)
+    {
+        y[i] += (alpha * x[i]);
+    }
+
+    return;
+}
+
+template <typename T>
+AVX2_TARGET static void backprop_step_avx2(const T delta, const T step, const T *x, T *w, T *y, const uint n)
+{
+    typedef avx2_s<T> V;
+
+    const typename V::vec_t vdelta = V::set1(delta);
+    const typename V::vec_t vstep = V::set1(step);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t vw = V::load(w + i);
+
+        V::store((y + i), V::mul_add(vdelta, vw, V::load(y + i)));
+        V::store((w + i), V::mul_add(vstep, V::load(x + i), vw));
+    }
+
+    for (; i < n; i++)
+    {
+        y[i] += (delta * w[i]);
+        w[i] += (step * x[i]);
+    }
+
+    return;
+}
+
+template <typename T>
+AVX2_TARGET static void scale_u8_avx2(const u8 *x, const T scale, T *y, const uint n)
+{
+    typedef avx2_s<T> V;
+
+    const typename V::vec_t vscale = V::set1(scale);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        V::store((y + i), V::mul(vscale, V::load_u8(x + i)));
+    }
+
+    for (; i < n; i++)
+    {
+        y[i] = (scale * x[i]);
+    }
+
+    return;
+}
+
+template <typename T>
+AVX2_TARGET static void scale_avx2(const T alpha, T *x, const uint n)
+{
+    typedef avx2_s<T> V;
+
+    const typename V::vec_t valpha = V::set1(alpha);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        V::store((x + i), V::mul(valpha, V::load(x + i)));
+    }
+
+    for (; i < n; i++)
+    {
+        x[i] *= alpha;
+    }
+
+    return;
+}
+
+template <typename T>
+AVX2_TARGET static void relu_avx2(T *x, const T negativeSlope, const uint n)
+{
+    typedef avx2_s<T> V;
+
+    const typename V::vec_t vslope = V::set1(negativeSlope);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t vx = V::load(x + i);
+
+        V::store((x + i), V::select_positive(vx, vx, V::mul(vslope, vx)));
+    }
+
+    for (; i < n; i++)
+    {
+        x[i] = ((x[i] > 0)? x[i] : (negativeSlope * x[i]));
+    }
+
+    return;
+}
+
+template <typename T>
+AVX2_TARGET static void relu_derivative_avx2(const T *y, const T negativeSlope, T *d, const uint n)
+{
+    typedef avx2_s<T> V;
+
+    const typename V::vec_t vone = V::set1(1);
+    const typename V::vec_t vslope = V::set1(negativeSlope);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        V::store((d + i), V::mul(V::load(d + i), V::select_positive(V::load(y + i), vone, vslope)));
+    }
+
+    for (; i < n; i++)
+    {
+        d[i] *= ((y[i] > 0)? 1 : negativeSlope);
+    }
+
+    return;
+}
+
+template <typename T>
+AVX2_TARGET static void quadratic_derivative_avx2(const T *y, const T a, const T b, const T c, T *d, const uint n)
+{
+    typedef avx2_s<T> V;
+
+    const typename V::vec_t va = V::set1(a);
+    const typename V::vec_t vb = V::set1(b);
+    const typename V::vec_t vc = V::set1(c);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t vy = V::load(y + i);
+
+        V::store((d + i), V::mul(V::load(d + i), V::mul_add(vy, V::mul_add(vc, vy, vb), va)));
+    }
+
+    for (; i < n; i++)
+    {
+        d[i] *= (a + (y[i] * (b + (c * y[i]))));
+    }
+
+    return;
+}
+
+template <typename T>
+AVX2_TARGET static void momentum_step_avx2(const T *g, const T stepScale, const T momentum, const T velocityWeight,
+                                           const T gradientWeight, T *v, T *w, const uint n)
+{
+    typedef avx2_s<T> V;
+
+    const typename V::vec_t vscale = V::set1(stepScale);
+    const typename V::vec_t vmomentum = V::set1(momentum);
+    const typename V::vec_t vvelocityWeight = V::set1(velocityWeight);
+    const typename V::vec_t vgradientWeight = V::set1(gradientWeight);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t vstep = V::mul(vscale, V::load(g + i));
+        const typename V::vec_t vv = V::mul_add(vmomentum, V::load(v + i), vstep);
+
+        V::store((v + i), vv);
+        V::store((w + i), V::mul_add(vvelocityWeight, vv, V::mul_add(vgradientWeight, vstep, V::load(w + i))));
+    }
+
+    for (; i < n; i++)
+    {
+        const T step = (stepScale * g[i]);
+
+        v[i] = ((momentum * v[i]) + step);
+        w[i] += ((velocityWeight * v[i]) + (gradientWeight * step));
+    }
+
+    return;
+}
+
+template <typename T>
+AVX2_TARGET static void adam_step_avx2(const T *g, const T gradScale, const T beta1, const T beta2, const T stepSize,
+                                       const T epsilon, T *m, T *v, T *w, const uint n)
+{
+    typedef avx2_s<T> V;
+
+    const typename V::vec_t vscale = V::set1(gradScale);
+    const typename V::vec_t vbeta1 = V::set1(beta1);
+    const typename V::vec_t vbeta2 = V::set1(beta2);
+    const typename V::vec_t voneMinusBeta1 = V::set1(1 - beta1);
+    const typename V::vec_t voneMinusBeta2 = V::set1(1 - beta2);
+    const typename V::vec_t vnegStepSize = V::set1(-stepSize);
+    const typename V::vec_t vepsilon = V::set1(epsilon);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t vg = V::mul(vscale, V::load(g + i));
+        const typename V::vec_t vm = V::mul_add(vbeta1, V::load(m + i), V::mul(voneMinusBeta1, vg));
+        const typename V::vec_t vv = V::mul_add(vbeta2, V::load(v + i), V::mul(voneMinusBeta2, V::mul(vg, vg)));
+
+        V::store((m + i), vm);
+        V::store((v + i), vv);
+        V::store((w + i), V::mul_add(vnegStepSize, V::div(vm, V::add(V::sqrt(vv), vepsilon)), V::load(w + i)));
+    }
+
+    for (; i < n; i++)
+    {
+        const T gradient = (gradScale * g[i]);
+
+        m[i] = ((beta1 * m[i]) + ((1 - beta1) * gradient));
+        v[i] = ((beta2 * v[i]) + ((1 - beta2) * gradient * gradient));
+        w[i] -= ((stepSize * m[i]) / (std::sqrt(v[i]) + epsilon));
+    }
+
+    return;
+}
+
+// The number of rows in the GEMM tile. The tile is two registers wide, so that with 6 rows, 12 of the 16
+// registers hold the tile, and the rest the operands.
+static const uint GEMM_TILE_ROWS_AVX2 = 6;
+
+template <typename T>
+AVX2_TARGET static void gemm_tile_avx2(const uint k, const T alpha, const T *a, const T *b, T *c, const uint ldc)
+{
+    typedef avx2_s<T> V;
+    const uint w = V::width;
+    const uint rows = GEMM_TILE_ROWS_AVX2;
+
+    typename V::vec_t sums[rows][2];
+    for (uint r = 0; r < rows; r++)
+    {
+        sums[r][0] = V::zero();
+        sums[r][1] = V::zero();
+    }
+
+    // Each step loads a row of the second block, and multiplies it by each element of a column of the first.
+    for (uint p = 0; p < k; p++, a += rows, b += (2 * w))
+    {
+        const typename V::vec_t b0 = V::load(b);
+        const typename V::vec_t b1 = V::load(b + w);
+
+        #pragma GCC unroll 16
+        for (uint r = 0; r < rows; r++)
+        {
+            const typename V::vec_t ar = V::set1(a[r]);
+
+            sums[r][0] = V::mul_add(ar, b0, sums[r][0]);
+            sums[r][1] = V::mul_add(ar, b1, sums[r][1]);
+        }
+    }
+
+    const typename V::vec_t valpha = V::set1(alpha);
+    for (uint r = 0; r < rows; r++)
+    {
+        T *const row = (c + (r * ldc));
+
+        V::store(row,       V::mul_add(valpha, sums[r][0], V::load(row)));
+        V::store((row + w), V::mul_add(valpha, sums[r][1], V::load(row + w)));
+    }
+
+    return;
+}
+
+template <typename T>
+const dense_kernels_s<T>* kkernels_avx2(void)
+{
+    static const dense_kernels_s<T> kernels = {"AVX2", dot_avx2<T>, dot_x4_avx2<T>, axpy_avx2<T>, backprop_step_avx2<T>, scale_u8_avx2<T>,
+                                                scale_avx2<T>, relu_avx2<T>, relu_derivative_avx2<T>, quadratic_derivative_avx2<T>,
+                                                momentum_step_avx2<T>, adam_step_avx2<T>,
+                                                gemm_tile_avx2<T>, GEMM_TILE_ROWS_AVX2, (2 * avx2_s<T>::width)};
+
+    return &kernels;
+}
+
+// Returns the sum of the eight 32-bit integers in the given vector.
+AVX2_TARGET static i32 sum_epi32(const __m256i v)
+{
+    const __m128i quad = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    const __m128i pairs = _mm_add_epi32(quad, _mm_shuffle_epi32(quad, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtsi128_si32(_mm_add_epi32(pairs, _mm_shuffle_epi32(pairs, _MM_SHUFFLE(2, 3, 0, 1))));
+}
+
+// Adds the products of the 32 unsigned bytes in a and the 32 signed bytes in b into the
+// eight 32-bit sums in acc. The products are first summed pairwise into 16 bits, which
+// the ranges of the int8 net's activations and weights keep from saturating.
+AVX2_TARGET static __m256i mul_add_u8i8(const __m256i a, const __m256i b, const __m256i acc)
+{
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(a, b), _mm256_set1_epi16(1)));
+}
+
+AVX2_TARGET static i32 dot_int8_avx2(const u8 *a, const i8 *b, const uint n)
+{
+    __m256i sum0 = _mm256_setzero_si256();
+    __m256i sum1 = _mm256_setzero_si256();
+
+    uint i = 0;
+    for (; (i + 64) <= n; i += 64)
+    {
+        sum0 = mul_add_u8i8(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)), sum0);
+        sum1 = mul_add_u8i8(_mm256_loadu_si256((const __m256i*)(a + i + 32)), _mm256_loadu_si256((const __m256i*)(b + i + 32)), sum1);
+    }
+
+    for (; (i + 32) <= n; i += 32)
+    {
+        sum0 = mul_add_u8i8(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)), sum0);
+    }
+
+    i32 sum = sum_epi32(_mm256_add_epi32(sum0, sum1));
+
+    for (; i < n; i++)
+    {
+        sum += (i32(a[i]) * b[i]);
+    }
+
+    return sum;
+}
+
+AVX2_TARGET static void dot_x4_int8_avx2(const u8 *a, const i8 *b0, const i8 *b1, const i8 *b2, const i8 *b3,
+                                         const uint n, i32 *const dst)
+{
+    __m256i sum0 = _mm256_setzero_si256();
+    __m256i sum1 = _mm256_setzero_si256();
+    __m256i sum2 = _mm256_setzero_si256();
+    __m256i sum3 = _mm256_setzero_si256();
+
+    uint i = 0;
+    for (; (i + 32) <= n; i += 32)
+    {
+        const __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+
+        sum0 = mul_add_u8i8(va, _mm256_loadu_si256((const __m256i*)(b0 + i)), sum0);
+        sum1 = mul_add_u8i8(va, _mm256_loadu_si256((const __m256i*)(b1 + i)), sum1);
+        sum2 = mul_add_u8i8(va, _mm256_loadu_si256((const __m256i*)(b2 + i)), sum2);
+        sum3 = mul_add_u8i8(va, _mm256_loadu_si256((const __m256i*)(b3 + i)), sum3);
+    }
+
+    dst[0] = sum_epi32(sum0);
+    dst[1] = sum_epi32(sum1);
+    dst[2] = sum_epi32(sum2);
+    dst[3] = sum_epi32(sum3);
+
+    for (; i < n; i++)
+    {
+        dst[0] += (i32(a[i]) * b0[i]);
+        dst[1] += (i32(a[i]) * b1[i]);
+        dst[2] += (i32(a[i]) * b2[i]);
+        dst[3] += (i32(a[i]) * b3[i]);
+    }
+
+    return;
+}
+
+const int8_kernels_s* kkernels_int8_avx2(void)
+{
+    static const int8_kernels_s kernels = {"AVX2", dot_int8_avx2, dot_x4_int8_avx2};
+
+    return &kernels;
+}
+
+#else
+
+template <typename T>
+const dense_kernels_s<T>* kkernels_avx2(void)
+{
+    return NULL;
+}
+
+const int8_kernels_s* kkernels_int8_avx2(void)
+{
+    return NULL;
+}
+
+#endif
+
+template const dense_kernels_s<float>* kkernels_avx2<float>(void);
+template const dense_kernels_s<double>* kkernels_avx2<double>(void);
@@ -0,0 +1,492 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * AVX-512 versions of the dense-layer kernels.
+ *
+ */
+
+#include "../../../src/nnetwork/kernels/kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define AVX512_TARGET __attribute__((target("avx512f")))
+
+// Wrappers for the AVX-512 intrinsics of T, so that the kernels can be written once
+// for both float and double. The leftover elements at the end of an array are
+// handled with masked loads and stores rather than with scalar loops.
+template <typename T> struct avx512_s;
+
+template <>
+struct avx512_s<double>
+{
+    typedef __m512d vec_t;
+    typedef __mmask8 mask_t;
+    static const uint width = 8;
+
+    // Returns a mask that selects the first n (< width) lanes of a register.
+    AVX512_TARGET static mask_t leading_lanes(const uint n) { return mask_t((1u << n) - 1); }
+
+    AVX512_TARGET static vec_t zero(void) { return _mm512_setzero_pd(); }
+    AVX512_TARGET static vec_t set1(const double v) { return _mm512_set1_pd(v); }
+    AVX512_TARGET static vec_t load(const double *p) { return _mm512_loadu_pd(p); }
+    AVX512_TARGET static vec_t load(const mask_t m, const double *p) { return _mm512_maskz_loadu_pd(m, p); }
+    // Note: the zero-masking conversions and square roots are used because the plain ones trip the same spurious warning as in sum().
+    AVX512_TARGET static vec_t load_u8(const u8 *p) { return _mm512_maskz_cvtepi32_pd(mask_t(~0u), _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p))); }
+    AVX512_TARGET static void store(double *p, const vec_t v) { _mm512_storeu_pd(p, v); }
+    AVX512_TARGET static void store(const mask_t m, double *p, const vec_t v) { _mm512_mask_storeu_pd(p, m, v); }
+    AVX512_TARGET static vec_t add(const vec_t a, const vec_t b) { return _mm512_add_pd(a, b); }
+    AVX512_TARGET static vec_t mul(const vec_t a, const vec_t b) { return _mm512_mul_pd(a, b); }
+    AVX512_TARGET static vec_t div(const vec_t a, const vec_t b) { return _mm512_div_pd(a, b); }
+    AVX512_TARGET static vec_t sqrt(const vec_t a) { return _mm512_maskz_sqrt_pd(mask_t(~0u), a); }
+    AVX512_TARGET static vec_t select_positive(const vec_t x, const vec_t a, const vec_t b) { return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, _mm512_setzero_pd(), _CMP_GT_OQ), b, a); }
+    AVX512_TARGET static vec_t mul_add(const vec_t a, const vec_t b, const vec_t c) { return _mm512_fmadd_pd(a, b, c); }
+    AVX512_TARGET static double sum(const vec_t v)
+    {
+        // Note: _mm512_reduce_add_pd() would do, but its 256-bit extraction trips a spurious
+        // -Wuninitialized in some versions of GCC.
+        alignas(64) double lanes[width];
+        _mm512_store_pd(lanes, v);
+
+        return (((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7])));
+    }
+};
+
+template <>
+struct avx512_s<float>
+{
+    typedef __m512 vec_t;
+    typedef __mmask16 mask_t;
+    static const uint width = 16;
+
+    AVX512_TARGET static mask_t leading_lanes(const uint n) { return mask_t((1u << n) - 1); }
+
+    AVX512_TARGET static vec_t zero(void) { return _mm512_setzero_ps(); }
+    AVX512_TARGET static vec_t set1(const float v) { return _mm512_set1_ps(v); }
+    AVX512_TARGET static vec_t load(const float *p) { return _mm512_loadu_ps(p); }
+    AVX512_TARGET static vec_t load(const mask_t m, const float *p) { return _mm512_maskz_loadu_ps(m, p); }
+    AVX512_TARGET static vec_t load_u8(const u8 *p) { return _mm512_maskz_cvtepi32_ps(mask_t(~0u), _mm512_maskz_cvtepu8_epi32(mask_t(~0u), _mm_loadu_si128((const __m128i*)p))); }
+    AVX512_TARGET static void store(float *p, const vec_t v) { _mm512_storeu_ps(p, v); }
+    AVX512_TARGET static void store(const mask_t m, float *p, const vec_t v) { _mm512_mask_storeu_ps(p, m, v); }
+    AVX512_TARGET static vec_t add(const vec_t a, const vec_t b) { return _mm512_add_ps(a, b); }
+    AVX512_TARGET static vec_t mul(const vec_t a, const vec_t b) { return _mm512_mul_ps(a, b); }
+    AVX512_TARGET static vec_t div(const vec_t a, const vec_t b) { return _mm512_div_ps(a, b); }
+    AVX512_TARGET static vec_t sqrt(const vec_t a) { return _mm512_maskz_sqrt_ps(mask_t(~0u), a); }
+    AVX512_TARGET static vec_t select_positive(const vec_t x, const vec_t a, const vec_t b) { return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_GT_OQ), b, a); }
+    AVX512_TARGET static vec_t mul_add(const vec_t a, const vec_t b, const vec_t c) { return _mm512_fmadd_ps(a, b, c); }
+    AVX512_TARGET static float sum(const vec_t v)
+    {
+        alignas(64) float lanes[width];
+        _mm512_store_ps(lanes, v);
+
+        float sum = 0;
+        for (uint i = 0; i < width; i += 4)
+        {
+            sum += ((lanes[i] + lanes[i+1]) + (lanes[i+2] + lanes[i+3]));
+        }
+
+        return sum;
+    }
+};
+
+template <typename T>
+AVX512_TARGET static T dot_avx512(const T *a, const T *b, const uint n)
+{
+    typedef avx512_s<T> V;
+    const uint w = V::width;
+
+    typename V::vec_t sum0 = V::zero();
+    typename V::vec_t sum1 = V::zero();
+    typename V::vec_t sum2 = V::zero();
+    typename V::vec_t sum3 = V::zero();
+
+    uint i = 0;
+    for (; (i + 4*w) <= n; i += 4*w)
+    {
+        sum0 = V::mul_add(V::load(a + i),       V::load(b + i),       sum0);
+        sum1 = V::mul_add(V::load(a + i + w),   V::load(b + i + w),   sum1);
+        sum2 = V::mul_add(V::load(a + i + 2*w), V::load(b + i + 2*w), sum2);
+        sum3 = V::mul_add(V::load(a + i + 3*w), V::load(b + i + 3*w), sum3);
+    }
+
+    for (; (i + w) <= n; i += w)
+    {
+        sum0 = V::mul_add(V::load(a + i), V::load(b + i), sum0);
+    }
+
+    if (i < n)
+    {
+        const typename V::mask_t mask = V::leading_lanes(n - i);
+        sum1 = V::mul_add(V::load(mask, (a + i)), V::load(mask, (b + i)), sum1);
+    }
+
+    return V::sum(V::add(V::add(sum0, sum1), V::add(sum2, sum3)));
+}
+
+template <typename T>
+AVX512_TARGET static void dot_x4_avx512(const T *a, const T *b0, const T *b1, const T *b2, const T *b3,
+                                        const uint n, T *const dst)
+{
+    typedef avx512_s<T> V;
+
+    typename V::vec_t sum0 = V::zero();
+    typename V::vec_t sum1 = V::zero();
+    typename V::vec_t sum2 = V::zero();
+    typename V::vec_t sum3 = V::zero();
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t va = V::load(a + i);
+
+        sum0 = V::mul_add(va, V::load(b0 + i), sum0);
+        sum1 = V::mul_add(va, V::load(b1 + i), sum1);
+        sum2 = V::mul_add(va, V::load(b2 + i), sum2);
+        sum3 = V::mul_add(va, V::load(b3 + i), sum3);
+    }
+
+    if (i < n)
+    {
+        const typename V::mask_t mask = V::leading_lanes(n - i);
+        const typename V::vec_t va = V::load(mask, (a + i));
+
+        sum0 = V::mul_add(va, V::load(mask, (b0 + i)), sum0);
+        sum1 = V::mul_add(va, V::load(mask, (b1 + i)), sum1);
+        sum2 = V::mul_add(va, V::load(mask, (b2 + i)), sum2);
+        sum3 = V::mul_add(va, V::load(mask, (b3 + i)), sum3);
+    }
+
+    dst[0] = V::sum(sum0);
+    dst[1] = V::sum(sum1);
+    dst[2] = V::sum(sum2);
+    dst[3] = V::sum(sum3);
+
+    return;
+}
+
+template <typename T>
+AVX512_TARGET static void axpy_avx512(const T alpha, const T *x, T *y, const uint n)
+{
+    typedef avx512_s<T> V;
+
+    const typename V::vec_t valpha = V::set1(alpha);
+
+    uint i = 0;
+    for (; (i + 2*V::width) <= n; i += 2*V::width)
+    {
+        V::store((y + i),            V::mul_add(valpha, V::load(x + i),            V::load(y + i)));
+        V::store((y + i + V::width), V::mul_add(valpha, V::load(x + i + V::width), V::load(y + i + V::width)));
+    }
+
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        V::store((y + i), V::mul_add(valpha, V::load(x + i), V::load(y + i)));
+    }
+
+    if (i < n)
+    {
+        const typename V::mask_t mask = V::leading_lanes(n - i);
+
+        V::store(mask, (y + i), V::mul_add(valpha, V::load(mask, (x + i)), V::load(mask, (y + i))));
+    }
+
+    return;
+}
+
+template <typename T>
+AVX512_TARGET static void backprop_step_avx512(const T delta, const T step, const T *x, T *w, T *y, const uint n)
+{
+    typedef avx512_s<T> V;
+
+    const typename V::vec_t vdelta = V::set1(delta);
+    const typename V::vec_t vstep = V::set1(step);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t vw = V::load(w + i);
+
+        V::store((y + i), V::mul_add(vdelta, vw, V::load(y + i)));
+        V::store((w + i), V::mul_add(vstep, V::load(x + i), vw));
+    }
+
+    if (i < n)
+    {
+        const typename V::mask_t mask = V::leading_lanes(n - i);
+        const typename V::vec_t vw = V::load(mask, (w + i));
+
+        V::store(mask, (y + i), V::mul_add(vdelta, vw, V::load(mask, (y + i))));
+        V::store(mask, (w + i), V::mul_add(vstep, V::load(mask, (x + i)), vw));
+    }
+
+    return;
+}
+
+template <typename T>
+AVX512_TARGET static void scale_u8_avx512(const u8 *x, const T scale, T *y, const uint n)
+{
+    typedef avx512_s<T> V;
+
+    const typename V::vec_t vscale = V::set1(scale);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        V::store((y + i), V::mul(vscale, V::load_u8(x + i)));
+    }
+
+    // The byte loads aren't masked, so the leftover elements are done one by one.
+    for (; i < n; i++)
+    {
+        y[i] = (scale * x[i]);
+    }
+
+    return;
+}
+
+template <typename T>
+AVX512_TARGET static void scale_avx512(const T alpha, T *x, const uint n)
+{
+    typedef avx512_s<T> V;
+
+    const typename V::vec_t valpha = V::set1(alpha);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        V::store((x + i), V::mul(valpha, V::load(x + i)));
+    }
+
+    if (i < n)
+    {
+        const typename V::mask_t mask = V::leading_lanes(n - i);
+
+        V::store(mask, (x + i), V::mul(valpha, V::load(mask, (x + i))));
+    }
+
+    return;
+}
+
+template <typename T>
+AVX512_TARGET static void relu_avx512(T *x, const T negativeSlope, const uint n)
+{
+    typedef avx512_s<T> V;
+
+    const typename V::vec_t vslope = V::set1(negativeSlope);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t vx = V::load(x + i);
+
+        V::store((x + i), V::select_positive(vx, vx, V::mul(vslope, vx)));
+    }
+
+    if (i < n)
+    {
+        const typename V::mask_t mask = V::leading_lanes(n - i);
+        const typename V::vec_t vx = V::load(mask, (x + i));
+
+        V::store(mask, (x + i), V::select_positive(vx, vx, V::mul(vslope, vx)));
+    }
+
+    return;
+}
+
+template <typename T>
+AVX512_TARGET static void relu_derivative_avx512(const T *y, const T negativeSlope, T *d, const uint n)
+{
+    typedef avx512_s<T> V;
+
+    const typename V::vec_t vone = V::set1(1);
+    const typename V::vec_t vslope = V::set1(negativeSlope);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        V::store((d + i), V::mul(V::load(d + i), V::select_positive(V::load(y + i), vone, vslope)));
+    }
+
+    if (i < n)
+    {
+        const typename V::mask_t mask = V::leading_lanes(n - i);
+
+        V::store(mask, (d + i), V::mul(V::load(mask, (d + i)), V::select_positive(V::load(mask, (y + i)), vone, vslope)));
+    }
+
+    return;
+}
+
+template <typename T>
+AVX512_TARGET static void quadratic_derivative_avx512(const T *y, const T a, const T b, const T c, T *d, const uint n)
+{
+    typedef avx512_s<T> V;
+
+    const typename V::vec_t va = V::set1(a);
+    const typename V::vec_t vb = V::set1(b);
+    const typename V::vec_t vc = V::set1(c);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t vy = V::load(y + i);
+
+        V::store((d + i), V::mul(V::load(d + i), V::mul_add(vy, V::mul_add(vc, vy, vb), va)));
+    }
+
+    if (i < n)
+    {
+        const typename V::mask_t mask = V::leading_lanes(n - i);
+        const typename V::vec_t vy = V::load(mask, (y + i));
+
+        V::store(mask, (d + i), V::mul(V::load(mask, (d + i)), V::mul_add(vy, V::mul_add(vc, vy, vb), va)));
+    }
+
+    return;
+}
+
+template <typename T>
+AVX512_TARGET static void momentum_step_avx512(const T *g, const T stepScale, const T momentum, const T velocityWeight,
+                                               const T gradientWeight, T *v, T *w, const uint n)
+{
+    typedef avx512_s<T> V;
+
+    const typename V::vec_t vscale = V::set1(stepScale);
+    const typename V::vec_t vmomentum = V::set1(momentum);
+    const typename V::vec_t vvelocityWeight = V::set1(velocityWeight);
+    const typename V::vec_t vgradientWeight = V::set1(gradientWeight);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t vstep = V::mul(vscale, V::load(g + i));
+        const typename V::vec_t vv = V::mul_add(vmomentum, V::load(v + i), vstep);
+
+        V::store((v + i), vv);
+        V::store((w + i), V::mul_add(vvelocityWeight, vv, V::mul_add(vgradientWeight, vstep, V::load(w + i))));
+    }
+
+    if (i < n)
+    {
+        const typename V::mask_t mask = V::leading_lanes(n - i);
+        const typename V::vec_t vstep = V::mul(vscale, V::load(mask, (g + i)));
+        const typename V::vec_t vv = V::mul_add(vmomentum, V::load(mask, (v + i)), vstep);
+
+        V::store(mask, (v + i), vv);
+        V::store(mask, (w + i), V::mul_add(vvelocityWeight, vv, V::mul_add(vgradientWeight, vstep, V::load(mask, (w + i)))));
+    }
+
+    return;
+}
+
+template <typename T>
+AVX512_TARGET static void adam_step_avx512(const T *g, const T gradScale, const T beta1, const T beta2, const T stepSize,
+                                           const T epsilon, T *m, T *v, T *w, const uint n)
+{
+    typedef avx512_s<T> V;
+
+    const typename V::vec_t vscale = V::set1(gradScale);
+    const typename V::vec_t vbeta1 = V::set1(beta1);
+    const typename V::vec_t vbeta2 = V::set1(beta2);
+    const typename V::vec_t voneMinusBeta1 = V::set1(1 - beta1);
+    const typename V::vec_t voneMinusBeta2 = V::set1(1 - beta2);
+    const typename V::vec_t vnegStepSize = V::set1(-stepSize);
+    const typename V::vec_t vepsilon = V::set1(epsilon);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t vg = V::mul(vscale, V::load(g + i));
+        const typename V::vec_t vm = V::mul_add(vbeta1, V::load(m + i), V::mul(voneMinusBeta1, vg));
+        const typename V::vec_t vv = V::mul_add(vbeta2, V::load(v + i), V::mul(voneMinusBeta2, V::mul(vg, vg)));
+
+        V::store((m + i), vm);
+        V::store((v + i), vv);
+        V::store((w + i), V::mul_add(vnegStepSize, V::div(vm, V::add(V::sqrt(vv), vepsilon)), V::load(w + i)));
+    }
+
+    if (i < n)
+    {
+        const typename V::mask_t mask = V::leading_lanes(n - i);
+        const typename V::vec_t vg = V::mul(vscale, V::load(mask, (g + i)));
+        const typename V::vec_t vm = V::mul_add(vbeta1, V::load(mask, (m + i)), V::mul(voneMinusBeta1, vg));
+        const typename V::vec_t vv = V::mul_add(vbeta2, V::load(mask, (v + i)), V::mul(voneMinusBeta2, V::mul(vg, vg)));
+
+        V::store(mask, (m + i), vm);
+        V::store(mask, (v + i), vv);
+        V::store(mask, (w + i), V::mul_add(vnegStepSize, V::div(vm, V::add(V::sqrt(vv), vepsilon)), V::load(mask, (w + i))));
+    }
+
+    return;
+}
+
+// The number of rows in the GEMM tile. The tile is two registers wide, so that with 12 rows, 24 of the 32
+// registers hold the tile, and the rest the operands.
+static const uint GEMM_TILE_ROWS_AVX512 = 12;
+
+template <typename T>
+AVX512_TARGET static void gemm_tile_avx512(const uint k, const T alpha, const T *a, const T *b, T *c, const uint ldc)
+{
+    typedef avx512_s<T> V;
+    const uint w = V::width;
+    const uint rows = GEMM_TILE_ROWS_AVX512;
+
+    typename V::vec_t sums[rows][2];
+    for (uint r = 0; r < rows; r++)
+    {
+        sums[r][0] = V::zero();
+        sums[r][1] = V::zero();
+    }
+
+    // Each step loads a row of the second block, and multiplies it by each element of a column of the first.
+    for (uint p = 0; p < k; p++, a += rows, b += (2 * w))
+    {
+        const typename V::vec_t b0 = V::load(b);
+        const typename V::vec_t b1 = V::load(b + w);
+
+        #pragma GCC unroll 16
+        for (uint r = 0; r < rows; r++)
+        {
+            const typename V::vec_t ar = V::set1(a[r]);
+
+            sums[r][0] = V::mul_add(ar, b0, sums[r][0]);
+            sums[r][1] = V::mul_add(ar, b1, sums[r][1]);
+        }
+    }
+
+    const typename V::vec_t valpha = V::set1(alpha);
+    for (uint r = 0; r < rows; r++)
+    {
+        T *const row = (c + (r * ldc));
+
+        V::store(row,       V::mul_add(valpha, sums[r][0], V::load(row)));
+        V::store((row + w), V::mul_add(valpha, sums[r][1], V::load(row + w)));
+    }
+
+    return;
+}
+
+template <typename T>
+const dense_kernels_s<T>* kkernels_avx512(void)
+{
+    static const dense_kernels_s<T> kernels = {"AVX-512", dot_avx512<T>, dot_x4_avx512<T>, axpy_avx512<T>, backprop_step_avx512<T>, scale_u8_avx512<T>,
+                                                   scale_avx512<T>, relu_avx512<T>, relu_derivative_avx512<T>, quadratic_derivative_avx512<T>,
+                                                   momentum_step_avx512<T>, adam_step_avx512<T>,
+                                                   gemm_tile_avx512<T>, GEMM_TILE_ROWS_AVX512, (2 * avx512_s<T>::width)};
+
+    return &kernels;
+}
+
+#else
+
+template <typename T>
+const dense_kernels_s<T>* kkernels_avx512(void)
+{
+    return NULL;
+}
+
+#endif
+
+template const dense_kernels_s<float>* kkernels_avx512<float>(void);
+template const dense_kernels_s<double>* kkernels_avx512<double>(void);
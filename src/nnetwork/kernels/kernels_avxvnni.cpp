@@ -0,0 +1,107 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * AVX-VNNI versions of the int8 kernels.
+ *
+ */
+
+#include "../../../src/nnetwork/kernels/kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define AVXVNNI_TARGET __attribute__((target("avx2,avxvnni")))
+
+// Returns the sum of the eight 32-bit integers in the given vector.
+AVXVNNI_TARGET static i32 sum_epi32(const __m256i v)
+{
+    const __m128i quad = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    const __m128i pairs = _mm_add_epi32(quad, _mm_shuffle_epi32(quad, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtsi128_si32(_mm_add_epi32(pairs, _mm_shuffle_epi32(pairs, _MM_SHUFFLE(2, 3, 0, 1))));
+}
+
+// Adds the products of the 32 unsigned bytes in a and the 32 signed bytes in b into the
+// eight 32-bit sums in acc, in one instruction and without intermediate saturation.
+AVXVNNI_TARGET static __m256i mul_add_u8i8(const __m256i a, const __m256i b, const __m256i acc)
+{
+    return _mm256_dpbusd_avx_epi32(acc, a, b);
+}
+
+AVXVNNI_TARGET static i32 dot_int8_avxvnni(const u8 *a, const i8 *b, const uint n)
+{
+    __m256i sum0 = _mm256_setzero_si256();
+    __m256i sum1 = _mm256_setzero_si256();
+
+    uint i = 0;
+    for (; (i + 64) <= n; i += 64)
+    {
+        sum0 = mul_add_u8i8(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)), sum0);
+        sum1 = mul_add_u8i8(_mm256_loadu_si256((const __m256i*)(a + i + 32)), _mm256_loadu_si256((const __m256i*)(b + i + 32)), sum1);
+    }
+
+    for (; (i + 32) <= n; i += 32)
+    {
+        sum0 = mul_add_u8i8(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)), sum0);
+    }
+
+    i32 sum = sum_epi32(_mm256_add_epi32(sum0, sum1));
+
+    for (; i < n; i++)
+    {
+        sum += (i32(a[i]) * b[i]);
+    }
+
+    return sum;
+}
+
+AVXVNNI_TARGET static void dot_x4_int8_avxvnni(const u8 *a, const i8 *b0, const i8 *b1, const i8 *b2, const i8 *b3,
+                                               const uint n, i32 *const dst)
+{
+    __m256i sum0 = _mm256_setzero_si256();
+    __m256i sum1 = _mm256_setzero_si256();
+    __m256i sum2 = _mm256_setzero_si256();
+    __m256i sum3 = _mm256_setzero_si256();
+
+    uint i = 0;
+    for (; (i + 32) <= n; i += 32)
+    {
+        const __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+
+        sum0 = mul_add_u8i8(va, _mm256_loadu_si256((const __m256i*)(b0 + i)), sum0);
+        sum1 = mul_add_u8i8(va, _mm256_loadu_si256((const __m256i*)(b1 + i)), sum1);
+        sum2 = mul_add_u8i8(va, _mm256_loadu_si256((const __m256i*)(b2 + i)), sum2);
+        sum3 = mul_add_u8i8(va, _mm256_loadu_si256((const __m256i*)(b3 + i)), sum3);
+    }
+
+    dst[0] = sum_epi32(sum0);
+    dst[1] = sum_epi32(sum1);
+    dst[2] = sum_epi32(sum2);
+    dst[3] = sum_epi32(sum3);
+
+    for (; i < n; i++)
+    {
+        dst[0] += (i32(a[i]) * b0[i]);
+        dst[1] += (i32(a[i]) * b1[i]);
+        dst[2] += (i32(a[i]) * b2[i]);
+        dst[3] += (i32(a[i]) * b3[i]);
+    }
+
+    return;
+}
+
+const int8_kernels_s* kkernels_int8_avxvnni(void)
+{
+    static const int8_kernels_s kernels = {"AVX-VNNI", dot_int8_avxvnni, dot_x4_int8_avxvnni};
+
+    return &kernels;
+}
+
+#else
+
+const int8_kernels_s* kkernels_int8_avxvnni(void)
+{
+    return NULL;
+}
+
+#endif
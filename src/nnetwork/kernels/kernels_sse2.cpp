@@ -0,0 +1,443 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * SSE2 versions of the dense-layer kernels.
+ *
+ */
+
+#include "../../../src/nnetwork/kernels/kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+#include <cstring>
+#include <cmath>
+
+#define SSE2_TARGET __attribute__((target("sse2")))
+
+// Wrappers for the SSE2 intrinsics of T, so that the kernels can be written once
+// for both float and double.
+template <typename T> struct sse2_s;
+
+// Returns the given bytes zero-extended into the four 32-bit lanes of a register.
+SSE2_TARGET static __m128i sse2_widen_u8(const __m128i bytes)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    return _mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero);
+}
+
+template <>
+struct sse2_s<double>
+{
+    typedef __m128d vec_t;
+    static const uint width = 2;
+
+    SSE2_TARGET static vec_t zero(void) { return _mm_setzero_pd(); }
+    SSE2_TARGET static vec_t set1(const double v) { return _mm_set1_pd(v); }
+    SSE2_TARGET static vec_t load(const double *p) { return _mm_loadu_pd(p); }
+    SSE2_TARGET static vec_t load_u8(const u8 *p) { u16 v; memcpy(&v, p, sizeof(v)); return _mm_cvtepi32_pd(sse2_widen_u8(_mm_cvtsi32_si128(v))); }
+    SSE2_TARGET static void store(double *p, const vec_t v) { _mm_storeu_pd(p, v); }
+    SSE2_TARGET static vec_t add(const vec_t a, const vec_t b) { return _mm_add_pd(a, b); }
+    SSE2_TARGET static vec_t mul(const vec_t a, const vec_t b) { return _mm_mul_pd(a, b); }
+    SSE2_TARGET static vec_t div(const vec_t a, const vec_t b) { return _mm_div_pd(a, b); }
+    SSE2_TARGET static vec_t sqrt(const vec_t a) { return _mm_sqrt_pd(a); }
+    SSE2_TARGET static vec_t select_positive(const vec_t x, const vec_t a, const vec_t b)
+    {
+        const vec_t mask = _mm_cmpgt_pd(x, _mm_setzero_pd());
+        return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+    }
+    SSE2_TARGET static vec_t mul_add(const vec_t a, const vec_t b, const vec_t c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+    SSE2_TARGET static double sum(const vec_t v) { return (_mm_cvtsd_f64(v) + _mm_cvtsd_f64(_mm_unpackhi_pd(v, v))); }
+};
+
+template <>
+struct sse2_s<float>
+{
+    typedef __m128 vec_t;
+    static const uint width = 4;
+
+    SSE2_TARGET static vec_t zero(void) { return _mm_setzero_ps(); }
+    SSE2_TARGET static vec_t set1(const float v) { return _mm_set1_ps(v); }
+    SSE2_TARGET static vec_t load(const float *p) { return _mm_loadu_ps(p); }
+    SSE2_TARGET static vec_t load_u8(const u8 *p) { u32 v; memcpy(&v, p, sizeof(v)); return _mm_cvtepi32_ps(sse2_widen_u8(_mm_cvtsi32_si128(v))); }
+    SSE2_TARGET static void store(float *p, const vec_t v) { _mm_storeu_ps(p, v); }
+    SSE2_TARGET static vec_t add(const vec_t a, const vec_t b) { return _mm_add_ps(a, b); }
+    SSE2_TARGET static vec_t mul(const vec_t a, const vec_t b) { return _mm_mul_ps(a, b); }
+    SSE2_TARGET static vec_t div(const vec_t a, const vec_t b) { return _mm_div_ps(a, b); }
+    SSE2_TARGET static vec_t sqrt(const vec_t a) { return _mm_sqrt_ps(a); }
+    SSE2_TARGET static vec_t select_positive(const vec_t x, const vec_t a, const vec_t b)
+    {
+        const vec_t mask = _mm_cmpgt_ps(x, _mm_setzero_ps());
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+    SSE2_TARGET static vec_t mul_add(const vec_t a, const vec_t b, const vec_t c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    SSE2_TARGET static float sum(const vec_t v)
+    {
+        const __m128 pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+    }
+};
+
+template <typename T>
+SSE2_TARGET static T dot_sse2(const T *a, const T *b, const uint n)
+{
+    typedef sse2_s<T> V;
+
+    typename V::vec_t sum0 = V::zero();
+    typename V::vec_t sum1 = V::zero();
+
+    uint i = 0;
+    for (; (i + 2*V::width) <= n; i += 2*V::width)
+    {
+        sum0 = V::mul_add(V::load(a + i),            V::load(b + i),            sum0);
+        sum1 = V::mul_add(V::load(a + i + V::width), V::load(b + i + V::width), sum1);
+    }
+
+    T sum = V::sum(V::add(sum0, sum1));
+
+    for (; i < n; i++)
+    {
+        sum += (a[i] * b[i]);
+    }
+
+    return sum;
+}
+
+template <typename T>
+SSE2_TARGET static void dot_x4_sse2(const T *a, const T *b0, const T *b1, const T *b2, const T *b3,
+                                    const uint n, T *const dst)
+{
+    typedef sse2_s<T> V;
+
+    typename V::vec_t sum0 = V::zero();
+    typename V::vec_t sum1 = V::zero();
+    typename V::vec_t sum2 = V::zero();
+    typename V::vec_t sum3 = V::zero();
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t va = V::load(a + i);
+
+        sum0 = V::mul_add(va, V::load(b0 + i), sum0);
+        sum1 = V::mul_add(va, V::load(b1 + i), sum1);
+        sum2 = V::mul_add(va, V::load(b2 + i), sum2);
+        sum3 = V::mul_add(va, V::load(b3 + i), sum3);
+    }
+
+    dst[0] = V::sum(sum0);
+    dst[1] = V::sum(sum1);
+    dst[2] = V::sum(sum2);
+    dst[3] = V::sum(sum3);
+
+    for (; i < n; i++)
+    {
+        dst[0] += (a[i] * b0[i]);
+        dst[1] += (a[i] * b1[i]);
+        dst[2] += (a[i] * b2[i]);
+        dst[3] += (a[i] * b3[i]);
+    }
+
+    return;
+}
+
+template <typename T>
+SSE2_TARGET static void axpy_sse2(const T alpha, const T *x, T *y, const uint n)
+{
+    typedef sse2_s<T> V;
+
+    const typename V::vec_t valpha = V::set1(alpha);
+
+    uint i = 0;
+    for (; (i + 2*V::width) <= n; i += 2*V::width)
+    {
+        V::store((y + i),            V::mul_add(valpha, V::load(x + i),            V::load(y + i)));
+        V::store((y + i + V::width), V::mul_add(valpha, V::load(x + i + V::width), V::load(y + i + V::width)));
+    }
+
+    for (; i < n; i++)
+    {
+        y[i] += (alpha * x[i]);
+    }
+
+    return;
+}
+
+template <typename T>
+SSE2_TARGET static void backprop_step_sse2(const T delta, const T step, const T *x, T *w, T *y, const uint n)
+{
+    typedef sse2_s<T> V;
+
+    const typename V::vec_t vdelta = V::set1(delta);
+    const typename V::vec_t vstep = V::set1(step);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t vw = V::load(w + i);
+
+        V::store((y + i), V::mul_add(vdelta, vw, V::load(y + i)));
+        V::store((w + i), V::mul_add(vstep, V::load(x + i), vw));
+    }
+
+    for (; i < n; i++)
+    {
+        y[i] += (delta * w[i]);
+        w[i] += (step * x[i]);
+    }
+
+    return;
+}
+
+template <typename T>
+SSE2_TARGET static void scale_u8_sse2(const u8 *x, const T scale, T *y, const uint n)
+{
+    typedef sse2_s<T> V;
+
+    const typename V::vec_t vscale = V::set1(scale);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        V::store((y + i), V::mul(vscale, V::load_u8(x + i)));
+    }
+
+    for (; i < n; i++)
+    {
+        y[i] = (scale * x[i]);
+    }
+
+    return;
+}
+
+template <typename T>
+SSE2_TARGET static void scale_sse2(const T alpha, T *x, const uint n)
+{
+    typedef sse2_s<T> V;
+
+    const typename V::vec_t valpha = V::set1(alpha);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        V::store((x + i), V::mul(valpha, V::load(x + i)));
+    }
+
+    for (; i < n; i++)
+    {
+        x[i] *= alpha;
+    }
+
+    return;
+}
+
+template <typename T>
+SSE2_TARGET static void relu_sse2(T *x, const T negativeSlope, const uint n)
+{
+    typedef sse2_s<T> V;
+
+    const typename V::vec_t vslope = V::set1(negativeSlope);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t vx = V::load(x + i);
+
+        V::store((x + i), V::select_positive(vx, vx, V::mul(vslope, vx)));
+    }
+
+    for (; i < n; i++)
+    {
+        x[i] = ((x[i] > 0)? x[i] : (negativeSlope * x[i]));
+    }
+
+    return;
+}
+
+template <typename T>
+SSE2_TARGET static void relu_derivative_sse2(const T *y, const T negativeSlope, T *d, const uint n)
+{
+    typedef sse2_s<T> V;
+
+    const typename V::vec_t vone = V::set1(1);
+    const typename V::vec_t vslope = V::set1(negativeSlope);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        V::store((d + i), V::mul(V::load(d + i), V::select_positive(V::load(y + i), vone, vslope)));
+    }
+
+    for (; i < n; i++)
+    {
+        d[i] *= ((y[i] > 0)? 1 : negativeSlope);
+    }
+
+    return;
+}
+
+template <typename T>
+SSE2_TARGET static void quadratic_derivative_sse2(const T *y, const T a, const T b, const T c, T *d, const uint n)
+{
+    typedef sse2_s<T> V;
+
+    const typename V::vec_t va = V::set1(a);
+    const typename V::vec_t vb = V::set1(b);
+    const typename V::vec_t vc = V::set1(c);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t vy = V::load(y + i);
+
+        V::store((d + i), V::mul(V::load(d + i), V::mul_add(vy, V::mul_add(vc, vy, vb), va)));
+    }
+
+    for (; i < n; i++)
+    {
+        d[i] *= (a + (y[i] * (b + (c * y[i]))));
+    }
+
+    return;
+}
+
+template <typename T>
+SSE2_TARGET static void momentum_step_sse2(const T *g, const T stepScale, const T momentum, const T velocityWeight,
+                                           const T gradientWeight, T *v, T *w, const uint n)
+{
+    typedef sse2_s<T> V;
+
+    const typename V::vec_t vscale = V::set1(stepScale);
+    const typename V::vec_t vmomentum = V::set1(momentum);
+    const typename V::vec_t vvelocityWeight = V::set1(velocityWeight);
+    const typename V::vec_t vgradientWeight = V::set1(gradientWeight);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t vstep = V::mul(vscale, V::load(g + i));
+        const typename V::vec_t vv = V::mul_add(vmomentum, V::load(v + i), vstep);
+
+        V::store((v + i), vv);
+        V::store((w + i), V::mul_add(vvelocityWeight, vv, V::mul_add(vgradientWeight, vstep, V::load(w + i))));
+    }
+
+    for (; i < n; i++)
+    {
+        const T step = (stepScale * g[i]);
+
+        v[i] = ((momentum * v[i]) + step);
+        w[i] += ((velocityWeight * v[i]) + (gradientWeight * step));
+    }
+
+    return;
+}
+
+template <typename T>
+SSE2_TARGET static void adam_step_sse2(const T *g, const T gradScale, const T beta1, const T beta2, const T stepSize,
+                                       const T epsilon, T *m, T *v, T *w, const uint n)
+{
+    typedef sse2_s<T> V;
+
+    const typename V::vec_t vscale = V::set1(gradScale);
+    const typename V::vec_t vbeta1 = V::set1(beta1);
+    const typename V::vec_t vbeta2 = V::set1(beta2);
+    const typename V::vec_t voneMinusBeta1 = V::set1(1 - beta1);
+    const typename V::vec_t voneMinusBeta2 = V::set1(1 - beta2);
+    const typename V::vec_t vnegStepSize = V::set1(-stepSize);
+    const typename V::vec_t vepsilon = V::set1(epsilon);
+
+    uint i = 0;
+    for (; (i + V::width) <= n; i += V::width)
+    {
+        const typename V::vec_t vg = V::mul(vscale, V::load(g + i));
+        const typename V::vec_t vm = V::mul_add(vbeta1, V::load(m + i), V::mul(voneMinusBeta1, vg));
+        const typename V::vec_t vv = V::mul_add(vbeta2, V::load(v + i), V::mul(voneMinusBeta2, V::mul(vg, vg)));
+
+        V::store((m + i), vm);
+        V::store((v + i), vv);
+        V::store((w + i), V::mul_add(vnegStepSize, V::div(vm, V::add(V::sqrt(vv), vepsilon)), V::load(w + i)));
+    }
+
+    for (; i < n; i++)
+    {
+        const T gradient = (gradScale * g[i]);
+
+        m[i] = ((beta1 * m[i]) + ((1 - beta1) * gradient));
+        v[i] = ((beta2 * v[i]) + ((1 - beta2) * gradient * gradient));
+        w[i] -= ((stepSize * m[i]) / (std::sqrt(v[i]) + epsilon));
+    }
+
+    return;
+}
+
+// The number of rows in the GEMM tile. The tile is two registers wide, so that with 4 rows, 8 of the 16
+// registers hold the tile, and the rest the operands.
+static const uint GEMM_TILE_ROWS_SSE2 = 4;
+
+template <typename T>
+SSE2_TARGET static void gemm_tile_sse2(const uint k, const T alpha, const T *a, const T *b, T *c, const uint ldc)
+{
+    typedef sse2_s<T> V;
+    const uint w = V::width;
+    const uint rows = GEMM_TILE_ROWS_SSE2;
+
+    typename V::vec_t sums[rows][2];
+    for (uint r = 0; r < rows; r++)
+    {
+        sums[r][0] = V::zero();
+        sums[r][1] = V::zero();
+    }
+
+    // Each step loads a row of the second block, and multiplies it by each element of a column of the first.
+    for (uint p = 0; p < k; p++, a += rows, b += (2 * w))
+    {
+        const typename V::vec_t b0 = V::load(b);
+        const typename V::vec_t b1 = V::load(b + w);
+
+        #pragma GCC unroll 16
+        for (uint r = 0; r < rows; r++)
+        {
+            const typename V::vec_t ar = V::set1(a[r]);
+
+            sums[r][0] = V::mul_add(ar, b0, sums[r][0]);
+            sums[r][1] = V::mul_add(ar, b1, sums[r][1]);
+        }
+    }
+
+    const typename V::vec_t valpha = V::set1(alpha);
+    for (uint r = 0; r < rows; r++)
+    {
+        T *const row = (c + (r * ldc));
+
+        V::store(row,       V::mul_add(valpha, sums[r][0], V::load(row)));
+        V::store((row + w), V::mul_add(valpha, sums[r][1], V::load(row + w)));
+    }
+
+    return;
+}
+
+template <typename T>
+const dense_kernels_s<T>* kkernels_sse2(void)
+{
+    static const dense_kernels_s<T> kernels = {"SSE2", dot_sse2<T>, dot_x4_sse2<T>, axpy_sse2<T>, backprop_step_sse2<T>, scale_u8_sse2<T>,
+                                                scale_sse2<T>, relu_sse2<T>, relu_derivative_sse2<T>, quadratic_derivative_sse2<T>,
+                                                momentum_step_sse2<T>, adam_step_sse2<T>,
+                                                gemm_tile_sse2<T>, GEMM_TILE_ROWS_SSE2, (2 * sse2_s<T>::width)};
+
+    return &kernels;
+}
+
+#else
+
+template <typename T>
+const dense_kernels_s<T>* kkernels_sse2(void)
+{
+    return NULL;
+}
+
+#endif
+
+template const dense_kernels_s<float>* kkernels_sse2<float>(void);
+template const dense_kernels_s<double>* kkernels_sse2<double>(void);
@@ -7,110 +7,250 @@
 
 #include <functional>
 #include <algorithm>
+#include "../../src/nnetwork/kernels/kernels.h"
+#include "../../src/nnetwork/kernels/gemm.h"
 #include "../../src/nnetwork/nnetwork.h"
+#include "../../src/timer/phase_timer.h"
+#include "../../src/random/philox.h"
 #include "../../src/common.h"
 
-nnetwork_c::nnetwork_c()
+// Copies the nonzero elements of the given n values, and their indices, into the given arrays, which
+// must have room for n elements. Returns the number of nonzero elements.
+template <typename T>
+static uint compact_nonzero(const T *const values, const uint n, u32 *const nonzeroIndices, T *const nonzeroValues)
 {
-    unsigned randSeed = std::chrono::system_clock::now().time_since_epoch().count();
-    this->randomNumberGenerator.seed(randSeed);
+    uint numNonzero = 0;
+
+    // Write each element whether or not it's zero, and only advance past the nonzero ones; this way,
+    // there's no branch on the values to mispredict.
+    for (uint i = 0; i < n; i++)
+    {
+        nonzeroIndices[numNonzero] = i;
+        nonzeroValues[numNonzero] = values[i];
+        numNonzero += (values[i] != 0);
+    }
+
+    return numNonzero;
+}
+
+const char* koptimizer_name(const optimizer_e optimizer)
+{
+    switch (optimizer)
+    {
+        case optimizer_e::sgd:      return "sgd";
+        case optimizer_e::momentum: return "momentum";
+        case optimizer_e::nesterov: return "nesterov";
+        case optimizer_e::adam:     return "adam";
+        default: return "unknown";
+    }
+}
+
+template <typename T>
+nnetwork_c<T>::nnetwork_c()
+{
+    this->set_random_seed(std::chrono::system_clock::now().time_since_epoch().count());
+    this->set_num_threads(1);
 
     return;
 }
 
-nnetwork_c::~nnetwork_c()
+template <typename T>
+nnetwork_c<T>::~nnetwork_c()
 {
-    delete this->randomNormalDistribution;
     delete this->randomUniformDistribution;
 
     return;
 }
 
-void nnetwork_c::add_layer(const uint numNeurons, const activation_function_e functionType)
+template <typename T>
+void nnetwork_c<T>::add_layer(const uint numNeurons, const activation_function_e functionType)
 {
-    neuron_layer_s newLayer;
+    neuron_layer_s<T> newLayer;
 
     uint precedingLayerSize = 0;
     if (!this->layers.empty())
     {
-        precedingLayerSize = this->layers.back().neurons.size();
+        precedingLayerSize = this->layers.back().numNeurons;
     }
 
-    // Add the desired number of neurons, and initialize them to their default values, including with randomized weights.
-    newLayer.neurons.resize(numNeurons, neuron_s(precedingLayerSize, randomNumberGenerator, randomNormalDistribution));
+    newLayer.numNeurons = numNeurons;
+    newLayer.numInputs = precedingLayerSize;
+    newLayer.weightStride = k_aligned_count<T>(precedingLayerSize);
     newLayer.activationFunction = functionType;
+    newLayer.activation = &kactivation_kernels<T>(functionType);
+
+    newLayer.weights.resize(numNeurons * newLayer.weightStride, 0);
+    newLayer.biases.resize(numNeurons, 0);
+
+    // Give the weights random starting values, from a Gaussian with a mean of 0 and a standard deviation corresponding to the
+    // number of input connections to each neuron (as per He et al. 2015). Each neuron draws its weights from its own stream of
+    // random numbers, identified by the net's seed and the neuron's position in the net; so the neurons can be initialized
+    // in parallel, and the same seed gives the same weights regardless of the number of threads.
+    if (precedingLayerSize)
+    {
+        const uint layerIdx = this->layers.size();
+        const T weightScale = std::sqrt(T(2) / precedingLayerSize);
+
+        const uint numTasks = this->threadPool->num_threads();
+        const uint neuronsPerTask = ((numNeurons + numTasks - 1) / numTasks);
+
+        this->threadPool->run(numTasks, [&](const uint taskIdx)
+        {
+            const uint firstNeuron = std::min(numNeurons, (taskIdx * neuronsPerTask));
+            const uint lastNeuron = std::min(numNeurons, (firstNeuron + neuronsPerTask));
+
+            for (uint n = firstNeuron; n < lastNeuron; n++)
+            {
+                philox_rng_c randomNumbers(this->randomSeed, layerIdx, n);
+                T *const neuronWeights = newLayer.weights_of_neuron(n);
+
+                for (uint i = 0; i < precedingLayerSize; i++)
+                {
+                    neuronWeights[i] = (T(randomNumbers.next_normal()) * weightScale);
+                }
+            }
+        });
+    }
+
+    this->layers.push_back(std::move(newLayer));
+
+    this->context.outputs.emplace_back(numNeurons, 0);
+    this->deltas.emplace_back(numNeurons, 0);
+
+    return;
+}
+
+template <typename T>
+inference_context_s<T> nnetwork_c<T>::make_inference_context(void) const
+{
+    inference_context_s<T> newContext;
+
+    for (const auto &layer: this->layers)
+    {
+        newContext.outputs.emplace_back(layer.numNeurons, 0);
+    }
+
+    return newContext;
+}
+
+template <typename T>
+void nnetwork_c<T>::snapshot_into(nnetwork_c<T> &snapshot) const
+{
+    k_assert((&snapshot != this), "Expected to snapshot the net into another net.");
+
+    bool isSameTopology = (snapshot.layers.size() == this->layers.size());
+    snapshot.layers.resize(this->layers.size());
+
+    for (uint i = 0; i < this->layers.size(); i++)
+    {
+        const neuron_layer_s<T> &layer = this->layers.at(i);
+        neuron_layer_s<T> &copy = snapshot.layers.at(i);
 
-    this->layers.push_back(newLayer);
+        isSameTopology = (isSameTopology && (copy.numNeurons == layer.numNeurons));
+
+        copy.numNeurons = layer.numNeurons;
+        copy.numInputs = layer.numInputs;
+        copy.weightStride = layer.weightStride;
+        copy.activationFunction = layer.activationFunction;
+        copy.activation = layer.activation;
+
+        // The buffers keep their allocations when the sizes match, so this is just a copy of the parameters.
+        copy.weights = layer.weights;
+        copy.biases = layer.biases;
+    }
+
+    snapshot.activationThreshold = this->activationThreshold;
+
+    if (!isSameTopology)
+    {
+        snapshot.context = snapshot.make_inference_context();
+        snapshot.deltas.clear();
+        for (const auto &layer: snapshot.layers)
+        {
+            snapshot.deltas.emplace_back(layer.numNeurons, 0);
+        }
+        snapshot.batchWorkspaces.assign(snapshot.batchWorkspaces.size(), batch_workspace_s<T>());
+    }
 
     return;
 }
 
-void nnetwork_c::set_inputs(const std::vector<real> inputs)
+template <typename T>
+bool nnetwork_c<T>::is_valid_input(const inference_context_s<T> &context, const uint numInputs) const
 {
     if (this->layers.empty() ||
-        (inputs.size() != this->layers.front().neurons.size()))
+        (numInputs != this->layers.front().numNeurons))
     {
         NBENE(("Incompatible input layer for the given inputs."));
-        return;
+        return false;
     }
 
-    for (size_t i = 0; i < this->layers.front().neurons.size(); i++)
+    if (context.outputs.size() != this->layers.size())
     {
-        this->layers.front().neurons.at(i).output = inputs.at(i);
+        NBENE(("The inference context doesn't match the network's layers."));
+        return false;
     }
 
-    return;
+    return true;
 }
 
-void nnetwork_c::set_expected_output(const std::vector<real> expected)
+template <typename T>
+void nnetwork_c<T>::set_inputs(inference_context_s<T> &context, const array_view_s<T> inputs) const
 {
-    if (expected.size() != this->layers.back().neurons.size())
+    if (!this->is_valid_input(context, inputs.size()))
     {
-        NBENE(("Number of expected output elements does not match the number of output neurons."));
         return;
     }
 
-    this->expectedOutput = expected;
+    std::copy(inputs.begin(), inputs.end(), context.outputs.front().begin());
 
     return;
 }
 
-void nnetwork_c::apply_softmax_to_output()
+template <typename T>
+void nnetwork_c<T>::set_inputs(inference_context_s<T> &context, const array_view_s<u8> inputs) const
 {
-    // Find the highest output value among the output neurons, for stabilizing potential numerical issues with softmax.
-    real maxOutput = 0;
+    if (!this->is_valid_input(context, inputs.size()))
     {
-        std::vector<real> thing;
-
-        for (size_t i = 0; i < this->layers.back().neurons.size(); i++)
-        {
-            thing.push_back(this->output_of_neuron(i));
-        }
+        return;
+    }
 
-        auto min = std::minmax_element(thing.begin(), thing.end());
+    kkernels<T>().scale_u8(inputs.data(), T(byteInputScale), context.outputs.front().data(), inputs.size());
 
-        maxOutput = *(min.second);
-    }
+    return;
+}
 
-    // Calculate exponents for each output neuron.
-    real expSum = 0;
-    std::vector<real> expOutputs;
-    for (size_t i = 0; i < this->layers.back().neurons.size(); i++)
+template <typename T>
+void nnetwork_c<T>::set_expected_output(const array_view_s<T> expected)
+{
+    if (expected.size() != this->layers.back().numNeurons)
     {
-        expOutputs.push_back(exp(this->output_of_neuron(i) - maxOutput));
-        expSum += expOutputs.back();
+        NBENE(("Number of expected output elements does not match the number of output neurons."));
+        return;
     }
 
-    // Apply the softmax function to all output neurons.
-    for (size_t i = 0; i < this->layers.back().neurons.size(); i++)
+    this->expectedOutput.assign(expected.begin(), expected.end());
+
+    return;
+}
+
+template <typename T>
+void nnetwork_c<T>::set_expected_class(const uint expectedClass)
+{
+    if (expectedClass >= this->layers.back().numNeurons)
     {
-        this->layers.back().neurons.at(i).output = (expOutputs.at(i) / expSum);
+        NBENE(("The expected class is out of range of the output neurons."));
+        return;
     }
 
+    this->expectedOutput.assign(this->layers.back().numNeurons, 0);
+    this->expectedOutput.at(expectedClass) = 1;
+
     return;
 }
 
-bool nnetwork_c::announce_current_configuration(void) const
+template <typename T>
+bool nnetwork_c<T>::announce_current_configuration(void) const
 {
     printf("Net:");
 
@@ -118,7 +258,7 @@ bool nnetwork_c::announce_current_configuration(void) const
     {
         printf("\tTopology: ");
 
-        for (const auto layer: this->layers)
+        for (const auto &layer: this->layers)
         {
             switch (layer.activationFunction)
             {
@@ -131,7 +271,7 @@ bool nnetwork_c::announce_current_configuration(void) const
             default: printf("?"); break;
             }
 
-            printf("%d-", (int)layer.neurons.size());
+            printf("%d-", (int)layer.numNeurons);
         }
 
         printf("\b \n");
@@ -140,32 +280,87 @@ bool nnetwork_c::announce_current_configuration(void) const
     // Miscellaneous info.
     {
         printf("\tLearning rate: %f\n", this->learningRate);
+        printf("\tOptimizer: %s\n", koptimizer_name(this->optimizerType));
         printf("\tTraining epochs: %d\n", this->numTrainingEpochs);
+        printf("\tBatch size: %d\n", this->batchSize);
+        printf("\tThreads: %d%s\n", this->num_threads(), ((this->hogwild && (this->num_threads() > 1))? ((this->optimizerType == optimizer_e::sgd)? " (Hogwild)" : " (Hogwild ignored; SGD only)") : ""));
+        printf("\tPrecision: %s\n", ((sizeof(T) == sizeof(float))? "single" : "double"));
+        printf("\tKernels: %s\n", kkernels<T>().name);
+        printf("\tSeed: %llu\n", (unsigned long long)this->randomSeed);
     }
 
     return true;
 }
 
-uint nnetwork_c::num_training_epochs() const
+template <typename T>
+uint nnetwork_c<T>::num_training_epochs() const
 {
     return this->numTrainingEpochs;
 }
 
-uint nnetwork_c::num_layers() const
+template <typename T>
+uint nnetwork_c<T>::batch_size() const
+{
+    return this->batchSize;
+}
+
+template <typename T>
+void nnetwork_c<T>::set_optimizer(const optimizer_e newOptimizer)
+{
+    this->optimizerType = newOptimizer;
+
+    // Have the next training step start the optimizer's state afresh.
+    for (auto &layer: this->layers)
+    {
+        layer.weightMoments1 = aligned_buffer_c<T>();
+        layer.weightMoments2 = aligned_buffer_c<T>();
+        layer.biasMoments1 = aligned_buffer_c<T>();
+        layer.biasMoments2 = aligned_buffer_c<T>();
+    }
+
+    return;
+}
+
+template <typename T>
+void nnetwork_c<T>::set_num_threads(const uint numThreads)
+{
+    k_assert((numThreads > 0), "Expected at least one thread.");
+
+    this->threadPool.reset(new thread_pool_c(numThreads));
+    this->batchWorkspaces.resize(numThreads);
+
+    return;
+}
+
+template <typename T>
+uint nnetwork_c<T>::num_threads() const
+{
+    return this->threadPool->num_threads();
+}
+
+template <typename T>
+uint nnetwork_c<T>::num_layers() const
 {
     return this->layers.size();
 }
 
-uint nnetwork_c::strongest_output_neuron_idx(void)
+template <typename T>
+uint nnetwork_c<T>::strongest_output_neuron_idx(void) const
+{
+    return this->strongest_output_neuron_idx(this->context);
+}
+
+template <typename T>
+uint nnetwork_c<T>::strongest_output_neuron_idx(const inference_context_s<T> &context) const
 {
     // Find the node with the strongest activation.
     int strongestNeuronIdx = -1;
-    real strongestActivation = -1;
-    for (size_t i = 0; i < this->layers.back().neurons.size(); i++)
+    T strongestActivation = -1;
+    for (size_t i = 0; i < this->layers.back().numNeurons; i++)
     {
-        if (this->output_of_neuron(i) > strongestActivation)
+        if (this->output_of_neuron(context, i) > strongestActivation)
         {
-            strongestActivation = this->output_of_neuron(i);
+            strongestActivation = this->output_of_neuron(context, i);
             strongestNeuronIdx = i;
         }
     }
@@ -173,19 +368,48 @@ uint nnetwork_c::strongest_output_neuron_idx(void)
     return strongestNeuronIdx;
 }
 
-real nnetwork_c::xor_test(void)
+template <typename T>
+uint nnetwork_c<T>::strongest_output_neuron_idx_in_batch(const uint sampleIdx) const
 {
-    nnetwork_c xorNet;
+    uint localIdx = 0;
+    const T *const outputs = this->workspace_of_sample(sampleIdx, &localIdx).layers.back().outputs_of_sample(localIdx);
+
+    return (std::max_element(outputs, (outputs + this->layers.back().numNeurons)) - outputs);
+}
+
+template <typename T>
+bool nnetwork_c<T>::output_neuron_fires_in_batch(const uint sampleIdx, const uint outputNeuron) const
+{
+    uint localIdx = 0;
+    const T *const outputs = this->workspace_of_sample(sampleIdx, &localIdx).layers.back().outputs_of_sample(localIdx);
+
+    return bool(outputs[outputNeuron] > this->activationThreshold);
+}
+
+template <typename T>
+const batch_workspace_s<T>& nnetwork_c<T>::workspace_of_sample(const uint sampleIdx, uint *const localIdx) const
+{
+    k_assert((sampleIdx < this->numBatchSamples), "Attempted to access a sample out of the batch's bounds.");
+
+    *localIdx = (sampleIdx % this->samplesPerWorkspace);
+
+    return this->batchWorkspaces.at(sampleIdx / this->samplesPerWorkspace);
+}
+
+template <typename T>
+real nnetwork_c<T>::xor_test(void)
+{
+    nnetwork_c<T> xorNet;
     xorNet.add_layer(2, activation_function_e::none);
     xorNet.add_layer(4, activation_function_e::tanh_sigmoid);
     xorNet.add_layer(1, activation_function_e::tanh_sigmoid);
     xorNet.set_learning_rate(0.01);
     xorNet.set_num_training_epochs(50000);
 
-    std::vector<real> input;
+    std::vector<T> input;
     input.resize(2, 0);
 
-    std::vector<real> expectedOutput;
+    std::vector<T> expectedOutput;
     expectedOutput.resize(1, 0);
 
     uint loopsCorrect = 0;
@@ -238,222 +462,1273 @@ real nnetwork_c::xor_test(void)
     return ((loopsCorrect / (real)numLoops) * 100);
 }
 
-void nnetwork_c::propagate_forward()
+template <typename T>
+void nnetwork_c<T>::propagate_forward(inference_context_s<T> &context) const
 {
+    const dense_kernels_s<T> &kernels = kkernels<T>();
+
     // Loop for each layer (ignoring the input layer).
     for (size_t i = 1; i < this->layers.size(); i++)
     {
+        const auto &thisLayer = this->layers.at(i);
+        const T *const prevOutputs = context.outputs.at(i-1).data();
+        T *const thisOutputs = context.outputs.at(i).data();
+
         // Loop for each neuron in the layer.
-        for (size_t o = 0; o < this->layers.at(i).neurons.size(); o++)
+        for (uint o = 0; o < thisLayer.numNeurons; o++)
         {
-            real inputSum = this->layers.at(i).neurons.at(o).biasWeight;
-
-            // Loop for each weight in the neuron, summing up the inputs from the preceding layer. Note that q here
-            // corresponds both to the weight index of the current neuron and the index of the neuron in the preceding
-            // layer, since the number of weights is equal to the number of neurons in the preceding layer.
-            for (size_t q = 0; q < layers.at(i).neurons.at(o).inputWeights.size(); q++)
-            {
-                inputSum += (this->layers.at(i-1).neurons.at(q).output * this->layers.at(i).neurons.at(o).inputWeights.at(q));
-            }
-
-            // The output of this neuron is decided by passing its sum of inputs through an activation function.
-            this->layers.at(i).neurons.at(o).output = this->activation_function(inputSum, this->layers.at(i).activationFunction);
+            // Sum up the inputs from the preceding layer. Note that the weight index of the current neuron corresponds
+            // to the index of the neuron in the preceding layer, since the number of weights is equal to the number of
+            // neurons in the preceding layer.
+            thisOutputs[o] = (thisLayer.biases[o] + kernels.dot(prevOutputs, thisLayer.weights_of_neuron(o), thisLayer.numInputs));
         }
-    }
 
-    // For the softmax activation function on the output layer, we need to collect the output of all output neurons before applying
-    // the softmax function. That's why we do it here, after the forward propagation step has finished.
-    if (this->layers.back().activationFunction == activation_function_e::softmax)
-    {
-        this->apply_softmax_to_output();
+        // The output of each neuron is decided by passing its sum of inputs through an activation function. This is
+        // done for the whole layer at once, which also lets softmax see all of the layer's sums.
+        thisLayer.activation->forward(thisOutputs, thisLayer.numNeurons);
     }
 
     return;
 }
 
-void nnetwork_c::propagate_back()
+template <typename T>
+template <typename OutputsOf, typename DeltasOf>
+void nnetwork_c<T>::propagate_back_and_update_sample(const OutputsOf &outputs_of_layer, const DeltasOf &deltas_of_layer,
+                                                     const T *const expectedOutputs, const T gradScale)
 {
+    const dense_kernels_s<T> &kernels = kkernels<T>();
+
     // Calculate the error terms at the output neurons.
     {
-        auto &outputLayer = this->layers.back();
+        const auto &outputLayer = this->layers.back();
+        const T *const outputs = outputs_of_layer(this->layers.size() - 1);
+        T *const outputDeltas = deltas_of_layer(this->layers.size() - 1);
 
-        for (size_t i = 0; i < outputLayer.neurons.size(); i++)
+        for (uint i = 0; i < outputLayer.numNeurons; i++)
         {
-            outputLayer.neurons.at(i).delta =
-                    (this->activation_function_derivative(outputLayer.neurons.at(i).output, outputLayer.activationFunction) *
-                                                          (outputLayer.neurons.at(i).output - this->expectedOutput.at(i)));
+            outputDeltas[i] = (outputs[i] - expectedOutputs[i]);
         }
+
+        outputLayer.activation->derivative(outputs, outputDeltas, outputLayer.numNeurons);
     }
 
-    // Backpropagate the error terms from the output layer to the preceding layers. We ignore the first (input) layer, since we
-    // don't need to compute its error terms. We also ignore the last (output) layer, since its error term was calculated above.
-    for (size_t i = (this->layers.size() - 2); i >= 1; i--)
+    // Walk the layers from the output layer back, updating each one's weights based on its error terms, and along the
+    // way backpropagating the error terms to the preceding layer. We ignore the first (input) layer, since it has no
+    // incoming connections; and we don't need the error terms of the first hidden layer's inputs.
+    for (size_t i = (this->layers.size() - 1); i >= 1; i--)
     {
         auto &thisLayer = this->layers.at(i);
-        auto &nextLayer = this->layers.at(i+1);
+        const auto &prevLayer = this->layers.at(i-1);
+        const T *const prevOutputs = outputs_of_layer(i-1);
+        const T *const thisDeltas = deltas_of_layer(i);
+        T *const prevDeltas = deltas_of_layer(i-1);
+        const bool propagates = (i > 1);
+
+        // Sum up, for each neuron in the preceding layer, the error deltas of the neurons in this layer weighted by their
+        // connection to that neuron. Since the oth input weight of a neuron in this layer corresponds to the oth neuron in
+        // the preceding layer, we can accumulate the sums a whole row of this layer's weight matrix at a time; and since the
+        // row is then being read anyway, also update it in the same pass, once its old weights have gone into the sums.
+        // That way each weight is read and written once per sample, rather than read for the backpropagation and then
+        // read and written again for the update, which matters once the weights no longer fit in the caches.
+        if (propagates)
+        {
+            std::fill(prevDeltas, (prevDeltas + prevLayer.numNeurons), 0);
+        }
 
-        // Loop through all neurons in this layer.
-        for (size_t o = 0; o < thisLayer.neurons.size(); o++)
+        for (uint o = 0; o < thisLayer.numNeurons; o++)
         {
-            real deltaSum = 0;
+            T *const neuronWeights = thisLayer.weights_of_neuron(o);
+
+            // The other optimizers are given the gradients as the preceding layer's outputs (and 1 for the bias)
+            // scaled by the delta; cf. below. Their steps have kernels of their own, so the row is summed first,
+            // and is then still in the cache for the update.
+            if (this->optimizerType != optimizer_e::sgd)
+            {
+                if (propagates)
+                {
+                    kernels.axpy(thisDeltas[o], neuronWeights, prevDeltas, thisLayer.numInputs);
+                }
 
-            // Loop through all neurons in the following layer, summing up their error deltas weighted by their connection to this
-            // neuron. Note that the oth input weight of the neuron in the following layer corresponds to the oth neuron in the
-            // current layer.
-            for (size_t q = 0; q < nextLayer.neurons.size(); q++)
+                this->optimize_neuron(thisLayer, o, prevOutputs, 1, (gradScale * thisDeltas[o]));
+                continue;
+            }
+
+            const T step = (-learningRate * gradScale * thisDeltas[o]);
+
+            // The gradient of each weight is the output of the corresponding neuron in the preceding layer
+            // times this neuron's delta.
+            if (propagates)
+            {
+                kernels.backprop_step(thisDeltas[o], step, prevOutputs, neuronWeights, prevDeltas, thisLayer.numInputs);
+            }
+            else
             {
-                deltaSum += nextLayer.neurons.at(q).delta * nextLayer.neurons.at(q).inputWeights.at(o);
+                kernels.axpy(step, prevOutputs, neuronWeights, thisLayer.numInputs);
             }
 
-            // Assign the error function to this neuron.
-            thisLayer.neurons.at(o).delta = (activation_function_derivative(thisLayer.neurons.at(o).output, thisLayer.activationFunction) * deltaSum);
+            thisLayer.biases[o] += step;
+        }
+
+        // Scale the sums by the derivative of the preceding layer's activation function to get its neurons' error terms.
+        if (propagates)
+        {
+            prevLayer.activation->derivative(prevOutputs, prevDeltas, prevLayer.numNeurons);
         }
     }
 
     return;
 }
 
-real nnetwork_c::loss_function()
+template <typename T>
+void nnetwork_c<T>::propagate_back_and_update()
 {
-    if (layers.empty())
-    {
-        NBENE(("Attempted to fetch loss function for an empty network; not allowing this."));
-        return -1;
-    }
+    this->begin_optimizer_step();
 
-    real loss = 0;
-    for (size_t i = 0; i < layers.back().neurons.size(); i++)
-    {
-        loss += powf(this->output_of_neuron(i) - expectedOutput.at(i),2);
-    }
+    this->propagate_back_and_update_sample([this](const size_t layerIdx){ return this->context.outputs.at(layerIdx).data(); },
+                                           [this](const size_t layerIdx){ return this->deltas.at(layerIdx).data(); },
+                                           this->expectedOutput.data(), T(1));
 
-    return (loss / layers.back().neurons.size());
+    return;
 }
 
-std::vector<std::vector<real>> nnetwork_c::get_weights_in_layer(const uint layer)
+template <typename T>
+void nnetwork_c<T>::propagate_back_and_update_batch(batch_workspace_s<T> &workspace, const T gradScale)
 {
-    if (layer >= this->layers.size())
+    k_assert((workspace.numSamples == 1), "Expected a workspace of one sample.");
+
+    this->propagate_back_and_update_sample([&workspace](const size_t layerIdx){ return workspace.layers.at(layerIdx).outputs_of_sample(0); },
+                                           [&workspace](const size_t layerIdx){ return workspace.layers.at(layerIdx).deltas_of_sample(0); },
+                                           workspace.expected_outputs_of_sample(0), gradScale);
+
+    return;
+}
+
+template <typename T>
+bool nnetwork_c<T>::is_valid_batch(const training_batch_s<T> &batch) const
+{
+    if (this->layers.size() < 2)
     {
-        NBENE(("Attempted to access out of bounds; not allowing it."));
-        return {};
+        NBENE(("Attempted to train a network that has no layers past the input layer; not allowing this."));
+        return false;
     }
 
-    std::vector<std::vector<real>> weights;
-    for (const auto neuron: this->layers.at(layer).neurons)
+    if (!batch.numSamples)
     {
-        weights.push_back(neuron.inputWeights);
+        NBENE(("Expected a non-empty batch with an equal number of inputs and expected outputs."));
+        return false;
     }
 
-    return weights;
+    for (uint n = 0; n < batch.numSamples; n++)
+    {
+        const bool validOutput = (batch.expectedClasses? (batch.expectedClasses[n] < this->layers.back().numNeurons)
+                                                       : (batch.expectedOutputs[n].size() == this->layers.back().numNeurons));
+
+        const uint numInputs = (batch.byteInputs? batch.byteInputs[n].size() : batch.inputs[n].size());
+
+        if ((numInputs != this->layers.front().numNeurons) ||
+            !validOutput)
+        {
+            NBENE(("Incompatible input or output layer for the given batch."));
+            return false;
+        }
+    }
+
+    return true;
 }
 
-void nnetwork_c::update_weights()
+template <typename T>
+void nnetwork_c<T>::load_batch_workspace(batch_workspace_s<T> &workspace, const training_batch_s<T> &batch,
+                                         const uint firstSample, const uint numSamples) const
 {
-    // Loop through each layer, updating their weights based on the deltas calculated in the backpropagation
-    // step. Note that we skip the input layer, as it has no incoming connections.
-    for (size_t i = 1; i < this->layers.size(); i++)
+    // Make sure the batch matrices are large enough for this many samples. We only ever grow them, so that a
+    // run of equal-sized batches doesn't cause repeated reallocation.
+    if ((numSamples > workspace.capacity) ||
+        (workspace.layers.size() != this->layers.size()))
     {
-        auto &thisLayer = this->layers.at(i);
-        auto &prevLayer = this->layers.at(i-1);
+        workspace.capacity = std::max(workspace.capacity, numSamples);
+        workspace.layers.resize(this->layers.size());
 
-        for (size_t o = 0; o < thisLayer.neurons.size(); o++)
+        for (size_t i = 0; i < this->layers.size(); i++)
         {
-            for (size_t p = 0; p < thisLayer.neurons.at(o).inputWeights.size(); p++)
-            {
-                const real gradient = (prevLayer.neurons.at(p).output * thisLayer.neurons.at(o).delta);
+            auto &batchLayer = workspace.layers.at(i);
 
-                thisLayer.neurons.at(o).inputWeights.at(p) += -learningRate * gradient;
-            }
+            batchLayer.stride = k_aligned_count<T>(this->layers.at(i).numNeurons);
+            batchLayer.outputs.resize(workspace.capacity * batchLayer.stride, 0);
+            batchLayer.deltas.resize(workspace.capacity * batchLayer.stride, 0);
+        }
+
+        workspace.expectedOutputs.resize(workspace.capacity * workspace.layers.back().stride, 0);
+    }
+
+    workspace.numSamples = numSamples;
+
+    for (uint n = 0; n < numSamples; n++)
+    {
+        T *const inputs = workspace.layers.front().outputs_of_sample(n);
+        T *const expected = workspace.expected_outputs_of_sample(n);
 
-            thisLayer.neurons.at(o).biasWeight += (-learningRate * thisLayer.neurons.at(o).delta);
+        if (batch.byteInputs)
+        {
+            const auto &input = batch.byteInputs[firstSample + n];
+            kkernels<T>().scale_u8(input.data(), T(byteInputScale), inputs, input.size());
+        }
+        else
+        {
+            std::copy(batch.inputs[firstSample + n].begin(), batch.inputs[firstSample + n].end(), inputs);
+        }
+
+        if (batch.expectedClasses)
+        {
+            std::fill(expected, (expected + this->layers.back().numNeurons), 0);
+            expected[batch.expectedClasses[firstSample + n]] = 1;
+        }
+        else if (batch.expectedOutputs)
+        {
+            std::copy(batch.expectedOutputs[firstSample + n].begin(), batch.expectedOutputs[firstSample + n].end(), expected);
         }
     }
 
+    this->find_nonzero_inputs(workspace);
+
     return;
 }
 
-real nnetwork_c::train(const std::vector<real> input, const std::vector<real> expectedOutput)
+template <typename T>
+void nnetwork_c<T>::find_nonzero_inputs(batch_workspace_s<T> &workspace) const
 {
-    this->set_inputs(input);
-    this->set_expected_output(expectedOutput);
+    const uint numInputs = this->layers.front().numNeurons;
+    const uint inputStride = workspace.layers.front().stride;
+    const uint numSamples = workspace.numSamples;
 
-    this->propagate_forward();
-    this->propagate_back();
-    this->update_weights();
+    workspace.sparseInputs = false;
 
-    return this->loss_function();
-}
+    if ((this->layers.size() < 2) ||
+        (numSamples < sparseMinSamples))
+    {
+        return;
+    }
 
-std::vector<real> nnetwork_c::activation_vector(void)
-{
-    if (this->layers.empty())
+    if (workspace.inputIndices.size() < (workspace.capacity * inputStride))
     {
-        NBENE(("Cannot return an activation matrix for an empty network."));
-        return {};
+        workspace.inputIndices.resize(workspace.capacity * inputStride, 0);
+        workspace.inputValues.resize(workspace.capacity * inputStride, 0);
+        workspace.numNonzeroInputs.resize(workspace.capacity, 0);
+    }
+
+    if (workspace.inputColumns.size() != (numInputs * workspace.layers.at(1).stride))
+    {
+        workspace.inputColumns.resize(numInputs * workspace.layers.at(1).stride, 0);
     }
 
-    std::vector<real> activations;
-    activations.resize(this->layers.back().neurons.size(), 0);
+    workspace.isActiveInput.resize(numInputs);
 
-    // Find the node with the strongest activation.
-    int strongestNeuron = 0;
-    real strongestActivation = -1;
-    for (size_t i = 0; i < this->layers.back().neurons.size(); i++)
+    const double denseCost = (numSamples * numInputs);
+
+    uint numNonzero = 0;
+    uint numActive = 0;
+    std::fill(workspace.isActiveInput.begin(), workspace.isActiveInput.end(), 0);
+
+    for (uint n = 0; n < numSamples; n++)
     {
-        if (this->output_of_neuron(i) > strongestActivation)
+        u32 *const indices = (workspace.inputIndices.data() + (n * inputStride));
+        T *const values = (workspace.inputValues.data() + (n * inputStride));
+
+        workspace.numNonzeroInputs[n] = compact_nonzero(workspace.layers.front().outputs_of_sample(n), numInputs, indices, values);
+        numNonzero += workspace.numNonzeroInputs[n];
+
+        for (uint k = 0; k < workspace.numNonzeroInputs[n]; k++)
         {
-            strongestActivation = this->output_of_neuron(i);
-            strongestNeuron = i;
+            numActive += !workspace.isActiveInput[indices[k]];
+            workspace.isActiveInput[indices[k]] = 1;
+        }
+
+        // Stop listing once it's clear that the sparse path won't be taken: if the samples so far are too
+        // dense for it even without its transposes (so that dense inputs cost little more than one sample's
+        // listing); or if, with the samples so far, it already costs more than the dense path.
+        if (((sparseInputCost * numNonzero) > ((n + 1) * numInputs)) ||
+            (((sparseInputCost * numNonzero) + (sparseColumnCost * numActive)) >= denseCost))
+        {
+            return;
         }
     }
 
-    // If the strongest neuron produces an output above the activation threshold,
-    // consider that to be the active neuron.
-    if (this->output_neuron_fires(strongestNeuron))
+    workspace.activeInputs.clear();
+    for (uint i = 0; i < numInputs; i++)
     {
-        activations.at(strongestNeuron) = 1;
+        if (workspace.isActiveInput[i])
+        {
+            workspace.activeInputs.push_back(i);
+        }
     }
 
-    return activations;
+    workspace.sparseInputs = true;
+
+    return;
 }
 
-void nnetwork_c::propagate(const std::vector<real> input)
+template <typename T>
+void nnetwork_c<T>::propagate_forward_sparse_inputs(batch_workspace_s<T> &workspace) const
 {
-    this->set_inputs(input);
-    this->propagate_forward();
+    const dense_kernels_s<T> &kernels = kkernels<T>();
+    const auto &firstLayer = this->layers.at(1);
+    auto &firstBatch = workspace.layers.at(1);
+
+    // Transpose the weights of the active inputs into the workspace, so that each input's weights are
+    // contiguous. Going through the inputs in order, each cache line of the weight matrix gets read in
+    // one go.
+    for (const u32 inputIdx: workspace.activeInputs)
+    {
+        T *const column = workspace.input_column(inputIdx);
+
+        for (uint o = 0; o < firstLayer.numNeurons; o++)
+        {
+            column[o] = firstLayer.weights_of_neuron(o)[inputIdx];
+        }
+    }
+
+    // Each nonzero input then adds its weights, times its value, to all of the layer's sums at once.
+    for (uint n = 0; n < workspace.numSamples; n++)
+    {
+        const u32 *const indices = workspace.input_indices_of_sample(n);
+        const T *const values = workspace.input_values_of_sample(n);
+        T *const sums = firstBatch.outputs_of_sample(n);
+
+        std::copy(firstLayer.biases.begin(), firstLayer.biases.end(), sums);
+
+        for (uint k = 0; k < workspace.numNonzeroInputs[n]; k++)
+        {
+            kernels.axpy(values[k], workspace.input_column(indices[k]), sums, firstLayer.numNeurons);
+        }
+    }
 
     return;
 }
 
-real nnetwork_c::random_number(void)
+template <typename T>
+void nnetwork_c<T>::sum_sparse_input_gradients(batch_workspace_s<T> &workspace) const
 {
-    return this->randomUniformDistribution->operator()(this->randomNumberGenerator);
-}
+    const dense_kernels_s<T> &kernels = kkernels<T>();
+    const auto &firstLayer = this->layers.at(1);
+    const auto &firstBatch = workspace.layers.at(1);
 
-real nnetwork_c::activation_function(const real sum, const activation_function_e functionType) const
-{
-    switch (functionType)
+    for (const u32 inputIdx: workspace.activeInputs)
     {
-        case activation_function_e::log_sigmoid:   return this->af_logsigmoid(sum);
-        case activation_function_e::relu:          return this->af_relu(sum);
-        case activation_function_e::leaky_relu:    return this->af_leakyrelu(sum);
-        case activation_function_e::tanh_sigmoid:  return this->af_tanhsigmoid(sum);
-        case activation_function_e::mtanh_sigmoid: return this->af_modtanhsigmoid(sum);
-        case activation_function_e::softmax:       return sum; /// Temp hack. We'll calculate the softmax elsewhere, for now, so just return here.
-        default: NBENE(("Failed to find an activation function for id %d.", (int)functionType)); return -1;
+        std::fill(workspace.input_column(inputIdx), (workspace.input_column(inputIdx) + firstLayer.numNeurons), 0);
     }
+
+    // The gradients of an input's weights are the layer's deltas times the input's value; so, as in the
+    // forward pass, each nonzero input updates a whole column at once.
+    for (uint n = 0; n < workspace.numSamples; n++)
+    {
+        const u32 *const indices = workspace.input_indices_of_sample(n);
+        const T *const values = workspace.input_values_of_sample(n);
+        const T *const deltas = firstBatch.deltas_of_sample(n);
+
+        for (uint k = 0; k < workspace.numNonzeroInputs[n]; k++)
+        {
+            kernels.axpy(values[k], deltas, workspace.input_column(indices[k]), firstLayer.numNeurons);
+        }
+    }
+
+    return;
 }
 
-real nnetwork_c::activation_function_derivative(const real output, const activation_function_e functionType) const
+template <typename T>
+void nnetwork_c<T>::propagate_forward_batch(batch_workspace_s<T> &workspace) const
 {
-    switch (functionType)
+    const dense_kernels_s<T> &kernels = kkernels<T>();
+    const uint numSamples = workspace.numSamples;
+
+    for (size_t i = 1; i < this->layers.size(); i++)
     {
-        case activation_function_e::log_sigmoid:   return this->af_logsigmoid_deriv(output);
-        case activation_function_e::relu:          return this->af_relu_deriv(output);
-        case activation_function_e::leaky_relu:    return this->af_leakyrelu_deriv(output);
-        case activation_function_e::tanh_sigmoid:  return this->af_tanhsigmoid_deriv(output);
-        case activation_function_e::mtanh_sigmoid: return this->af_modtanhsigmoid_deriv(output);
-        case activation_function_e::softmax:       return 1; /// FIXME. Assumes, without knowing, that the softmax will be on the output layer only.
-        default: NBENE(("Failed to find an activation function for id %d.", (int)functionType)); return -1;
+        const auto &thisLayer = this->layers.at(i);
+        const auto &prevBatch = workspace.layers.at(i-1);
+        auto &thisBatch = workspace.layers.at(i);
+
+        if ((i == 1) && workspace.sparseInputs)
+        {
+            this->propagate_forward_sparse_inputs(workspace);
+        }
+        // Computes the product of the batch's input matrix and the transpose of this layer's weight matrix, on top
+        // of the biases.
+        else if (numSamples >= gemmMinSamples)
+        {
+            for (uint n = 0; n < numSamples; n++)
+            {
+                std::copy(thisLayer.biases.begin(), thisLayer.biases.end(), thisBatch.outputs_of_sample(n));
+            }
+
+            kgemm(kernels, false, true, numSamples, thisLayer.numNeurons, thisLayer.numInputs, T(1),
+                  prevBatch.outputs.data(), prevBatch.stride, thisLayer.weights.data(), thisLayer.weightStride,
+                  thisBatch.outputs.data(), thisBatch.stride);
+        }
+        // As above, but with the weights used in place: for each neuron, we run its weights against four samples
+        // at a time, so that each weight we load from memory gets used four times rather than once.
+        else
+        {
+            for (uint o = 0; o < thisLayer.numNeurons; o++)
+            {
+                const T *const neuronWeights = thisLayer.weights_of_neuron(o);
+
+                uint n = 0;
+                for (; (n + 4) <= numSamples; n += 4)
+                {
+                    T sums[4];
+                    kernels.dot_x4(neuronWeights,
+                                   prevBatch.outputs_of_sample(n),
+                                   prevBatch.outputs_of_sample(n + 1),
+                                   prevBatch.outputs_of_sample(n + 2),
+                                   prevBatch.outputs_of_sample(n + 3),
+                                   thisLayer.numInputs, sums);
+
+                    for (uint s = 0; s < 4; s++)
+                    {
+                        thisBatch.outputs_of_sample(n + s)[o] = (thisLayer.biases[o] + sums[s]);
+                    }
+                }
+
+                // Any samples left over.
+                for (; n < numSamples; n++)
+                {
+                    thisBatch.outputs_of_sample(n)[o] = (thisLayer.biases[o] + kernels.dot(neuronWeights, prevBatch.outputs_of_sample(n), thisLayer.numInputs));
+                }
+            }
+        }
+
+        for (uint n = 0; n < numSamples; n++)
+        {
+            thisLayer.activation->forward(thisBatch.outputs_of_sample(n), thisLayer.numNeurons);
+        }
     }
+
+    return;
 }
+
+template <typename T>
+void nnetwork_c<T>::propagate_back_batch(batch_workspace_s<T> &workspace)
+{
+    const dense_kernels_s<T> &kernels = kkernels<T>();
+    const uint numSamples = workspace.numSamples;
+
+    // Calculate the error terms at the output neurons.
+    {
+        const auto &outputLayer = this->layers.back();
+        auto &outputBatch = workspace.layers.back();
+
+        for (uint n = 0; n < numSamples; n++)
+        {
+            const T *const outputs = outputBatch.outputs_of_sample(n);
+            const T *const expected = workspace.expected_outputs_of_sample(n);
+            T *const deltas = outputBatch.deltas_of_sample(n);
+
+            for (uint i = 0; i < outputLayer.numNeurons; i++)
+            {
+                deltas[i] = (outputs[i] - expected[i]);
+            }
+
+            outputLayer.activation->derivative(outputs, deltas, outputLayer.numNeurons);
+        }
+    }
+
+    // Backpropagate the error terms, as in propagate_back_and_update(). This computes the product of the batch's delta matrix
+    // for the following layer and that layer's weight matrix.
+    for (size_t i = (this->layers.size() - 2); i >= 1; i--)
+    {
+        const auto &thisLayer = this->layers.at(i);
+        const auto &nextLayer = this->layers.at(i+1);
+        const auto &nextBatch = workspace.layers.at(i+1);
+        auto &thisBatch = workspace.layers.at(i);
+
+        for (uint n = 0; n < numSamples; n++)
+        {
+            std::fill(thisBatch.deltas_of_sample(n), (thisBatch.deltas_of_sample(n) + thisLayer.numNeurons), 0);
+        }
+
+        if (numSamples >= gemmBackMinSamples)
+        {
+            kgemm(kernels, false, false, numSamples, thisLayer.numNeurons, nextLayer.numNeurons, T(1),
+                  nextBatch.deltas.data(), nextBatch.stride, nextLayer.weights.data(), nextLayer.weightStride,
+                  thisBatch.deltas.data(), thisBatch.stride);
+        }
+        // As above, but with the weights used in place: each row of weights is loaded once and applied to all
+        // samples in the batch.
+        else
+        {
+            for (uint q = 0; q < nextLayer.numNeurons; q++)
+            {
+                const T *const nextWeights = nextLayer.weights_of_neuron(q);
+
+                for (uint n = 0; n < numSamples; n++)
+                {
+                    kernels.axpy(nextBatch.deltas_of_sample(n)[q], nextWeights, thisBatch.deltas_of_sample(n), thisLayer.numNeurons);
+                }
+            }
+        }
+
+        for (uint n = 0; n < numSamples; n++)
+        {
+            thisLayer.activation->derivative(thisBatch.outputs_of_sample(n), thisBatch.deltas_of_sample(n), thisLayer.numNeurons);
+        }
+    }
+
+    return;
+}
+
+template <typename T>
+void nnetwork_c<T>::update_weights_batch(batch_workspace_s<T> &workspace, const T gradScale)
+{
+    const dense_kernels_s<T> &kernels = kkernels<T>();
+    const uint numSamples = workspace.numSamples;
+    const T stepScale = (-this->learningRate * gradScale);
+
+    for (size_t i = 1; i < this->layers.size(); i++)
+    {
+        auto &thisLayer = this->layers.at(i);
+        auto &thisBatch = workspace.layers.at(i);
+        const auto &prevBatch = workspace.layers.at(i-1);
+
+        // Plain SGD can apply the gradients straight to the weights. The other optimizers need the whole of a
+        // neuron's gradient first, which we form in the workspace's gradient matrix.
+        if (this->optimizerType != optimizer_e::sgd)
+        {
+            this->sum_layer_gradients(workspace, i);
+
+            for (uint o = 0; o < thisLayer.numNeurons; o++)
+            {
+                const T *const neuronGradients = (thisBatch.weightGradients.data() + (o * thisLayer.weightStride));
+
+                this->optimize_neuron(thisLayer, o, neuronGradients, thisBatch.biasGradients[o], gradScale);
+            }
+
+            continue;
+        }
+
+        // With sparse inputs, the first layer's gradients are summed for the active inputs' weights only, into the
+        // workspace's input columns, and applied one input at a time, as they're laid out; as in
+        // propagate_forward_sparse_inputs(), this goes through each cache line of weights in one go.
+        if ((i == 1) && workspace.sparseInputs)
+        {
+            this->sum_sparse_input_gradients(workspace);
+
+            for (const u32 inputIdx: workspace.activeInputs)
+            {
+                const T *const gradients = workspace.input_column(inputIdx);
+
+                for (uint o = 0; o < thisLayer.numNeurons; o++)
+                {
+                    thisLayer.weights_of_neuron(o)[inputIdx] += (stepScale * gradients[o]);
+                }
+            }
+        }
+        // The gradients of a layer's weights form the product of the transpose of the layer's delta matrix and the
+        // preceding layer's output matrix, which we add into the weights as it's computed.
+        else if (numSamples >= gemmBackMinSamples)
+        {
+            kgemm(kernels, true, false, thisLayer.numNeurons, thisLayer.numInputs, numSamples, stepScale,
+                  thisBatch.deltas.data(), thisBatch.stride, prevBatch.outputs.data(), prevBatch.stride,
+                  thisLayer.weights.data(), thisLayer.weightStride);
+        }
+        // As above, but a row at a time: each sample's share of a neuron's gradients is applied to the neuron's
+        // weights while they're in cache.
+        else
+        {
+            for (uint o = 0; o < thisLayer.numNeurons; o++)
+            {
+                T *const neuronWeights = thisLayer.weights_of_neuron(o);
+
+                for (uint n = 0; n < numSamples; n++)
+                {
+                    kernels.axpy((stepScale * thisBatch.deltas_of_sample(n)[o]), prevBatch.outputs_of_sample(n), neuronWeights, thisLayer.numInputs);
+                }
+            }
+        }
+
+        for (uint o = 0; o < thisLayer.numNeurons; o++)
+        {
+            T biasGradient = 0;
+
+            for (uint n = 0; n < numSamples; n++)
+            {
+                biasGradient += thisBatch.deltas_of_sample(n)[o];
+            }
+
+            thisLayer.biases[o] += (stepScale * biasGradient);
+        }
+    }
+
+    return;
+}
+
+template <typename T>
+void nnetwork_c<T>::compute_gradients_batch(batch_workspace_s<T> &workspace)
+{
+    for (size_t i = 1; i < this->layers.size(); i++)
+    {
+        this->sum_layer_gradients(workspace, i);
+    }
+
+    return;
+}
+
+template <typename T>
+void nnetwork_c<T>::sum_layer_gradients(batch_workspace_s<T> &workspace, const uint layerIdx) const
+{
+    const dense_kernels_s<T> &kernels = kkernels<T>();
+    const auto &thisLayer = this->layers.at(layerIdx);
+    const auto &prevBatch = workspace.layers.at(layerIdx - 1);
+    auto &thisBatch = workspace.layers.at(layerIdx);
+
+    if (thisBatch.weightGradients.size() != thisLayer.weights.size())
+    {
+        thisBatch.weightGradients.resize(thisLayer.weights.size(), 0);
+        thisBatch.biasGradients.resize(thisLayer.numNeurons, 0);
+    }
+
+    thisBatch.weightGradients.fill(0);
+
+    // With sparse inputs, the first layer's gradients are summed for the active inputs' weights only, into the
+    // workspace's input columns, from which they're copied into place.
+    if ((layerIdx == 1) && workspace.sparseInputs)
+    {
+        this->sum_sparse_input_gradients(workspace);
+
+        for (const u32 inputIdx: workspace.activeInputs)
+        {
+            const T *const gradients = workspace.input_column(inputIdx);
+
+            for (uint o = 0; o < thisLayer.numNeurons; o++)
+            {
+                thisBatch.weightGradients[(o * thisLayer.weightStride) + inputIdx] = gradients[o];
+            }
+        }
+    }
+    // As in update_weights_batch().
+    else if (workspace.numSamples >= gemmBackMinSamples)
+    {
+        kgemm(kernels, true, false, thisLayer.numNeurons, thisLayer.numInputs, workspace.numSamples, T(1),
+              thisBatch.deltas.data(), thisBatch.stride, prevBatch.outputs.data(), prevBatch.stride,
+              thisBatch.weightGradients.data(), thisLayer.weightStride);
+    }
+    else
+    {
+        for (uint o = 0; o < thisLayer.numNeurons; o++)
+        {
+            T *const neuronGradients = (thisBatch.weightGradients.data() + (o * thisLayer.weightStride));
+
+            for (uint n = 0; n < workspace.numSamples; n++)
+            {
+                kernels.axpy(thisBatch.deltas_of_sample(n)[o], prevBatch.outputs_of_sample(n), neuronGradients, thisLayer.numInputs);
+            }
+        }
+    }
+
+    for (uint o = 0; o < thisLayer.numNeurons; o++)
+    {
+        T biasGradient = 0;
+
+        for (uint n = 0; n < workspace.numSamples; n++)
+        {
+            biasGradient += thisBatch.deltas_of_sample(n)[o];
+        }
+
+        thisBatch.biasGradients[o] = biasGradient;
+    }
+
+    return;
+}
+
+template <typename T>
+void nnetwork_c<T>::update_weights_from_gradients(const uint layerIdx, const uint firstNeuron, const uint numNeurons, const T gradScale)
+{
+    const dense_kernels_s<T> &kernels = kkernels<T>();
+    auto &thisLayer = this->layers.at(layerIdx);
+
+    const T stepScale = (-this->learningRate * gradScale);
+
+    for (uint o = firstNeuron; o < (firstNeuron + numNeurons); o++)
+    {
+        T *const neuronWeights = thisLayer.weights_of_neuron(o);
+
+        // Plain SGD can apply each workspace's gradients to the weights in turn. The other optimizers need the
+        // whole of the gradient first, which we sum into the first workspace's gradients.
+        if (this->optimizerType != optimizer_e::sgd)
+        {
+            T *neuronGradients = NULL;
+            T biasGradient = 0;
+
+            for (auto &workspace: this->batchWorkspaces)
+            {
+                if (!workspace.numSamples)
+                {
+                    continue;
+                }
+
+                auto &thisBatch = workspace.layers.at(layerIdx);
+                T *const workspaceGradients = (thisBatch.weightGradients.data() + (o * thisLayer.weightStride));
+
+                if (!neuronGradients)
+                {
+                    neuronGradients = workspaceGradients;
+                }
+                else
+                {
+                    kernels.axpy(1, workspaceGradients, neuronGradients, thisLayer.numInputs);
+                }
+
+                biasGradient += thisBatch.biasGradients[o];
+            }
+
+            if (neuronGradients)
+            {
+                this->optimize_neuron(thisLayer, o, neuronGradients, biasGradient, gradScale);
+            }
+
+            continue;
+        }
+
+        for (const auto &workspace: this->batchWorkspaces)
+        {
+            if (!workspace.numSamples)
+            {
+                continue;
+            }
+
+            const auto &thisBatch = workspace.layers.at(layerIdx);
+
+            kernels.axpy(stepScale, (thisBatch.weightGradients.data() + (o * thisLayer.weightStride)), neuronWeights, thisLayer.numInputs);
+            thisLayer.biases[o] += (stepScale * thisBatch.biasGradients[o]);
+        }
+    }
+
+    return;
+}
+
+template <typename T>
+void nnetwork_c<T>::begin_optimizer_step(void)
+{
+    if (this->optimizerType == optimizer_e::sgd)
+    {
+        return;
+    }
+
+    const bool needsSecondMoments = (this->optimizerType == optimizer_e::adam);
+
+    // (Re)allocate the optimizer's state if the layers have changed since it was last allocated; e.g. if the net has
+    // been loaded from a file.
+    for (size_t i = 1; i < this->layers.size(); i++)
+    {
+        auto &layer = this->layers.at(i);
+
+        if ((layer.weightMoments1.size() != layer.weights.size()) ||
+            (needsSecondMoments && (layer.weightMoments2.size() != layer.weights.size())))
+        {
+            layer.weightMoments1.resize(layer.weights.size(), 0);
+            layer.biasMoments1.resize(layer.numNeurons, 0);
+
+            if (needsSecondMoments)
+            {
+                layer.weightMoments2.resize(layer.weights.size(), 0);
+                layer.biasMoments2.resize(layer.numNeurons, 0);
+            }
+
+            this->numOptimizerSteps = 0;
+        }
+    }
+
+    this->numOptimizerSteps++;
+
+    // Adam's moments start out at zero, which biases them toward zero over the first steps. Rather than correct
+    // the moments themselves, we scale the step size and epsilon to the same effect (as per Kingma & Ba 2015).
+    if (this->optimizerType == optimizer_e::adam)
+    {
+        const double correction1 = (1 - std::pow(double(this->adamBeta1), double(this->numOptimizerSteps)));
+        const double correction2 = std::sqrt(1 - std::pow(double(this->adamBeta2), double(this->numOptimizerSteps)));
+
+        this->adamStepSize = T(this->learningRate * (correction2 / correction1));
+        this->adamStepEpsilon = T(this->adamEpsilon * correction2);
+    }
+
+    return;
+}
+
+template <typename T>
+void nnetwork_c<T>::optimize_neuron(neuron_layer_s<T> &layer, const uint neuronIdx, const T *const weightGradients,
+                                    const T biasGradient, const T gradScale)
+{
+    const dense_kernels_s<T> &kernels = kkernels<T>();
+
+    T *const weights = layer.weights_of_neuron(neuronIdx);
+    T *const moments1 = (layer.weightMoments1.data() + (neuronIdx * layer.weightStride));
+    T *const moments2 = (layer.weightMoments2.data() + (neuronIdx * layer.weightStride));
+
+    switch (this->optimizerType)
+    {
+        case optimizer_e::sgd:
+        {
+            const T stepScale = (-this->learningRate * gradScale);
+
+            kernels.axpy(stepScale, weightGradients, weights, layer.numInputs);
+            layer.biases[neuronIdx] += (stepScale * biasGradient);
+
+            break;
+        }
+        case optimizer_e::momentum:
+        case optimizer_e::nesterov:
+        {
+            const T stepScale = (-this->learningRate * gradScale);
+            const bool nesterov = (this->optimizerType == optimizer_e::nesterov);
+            const T velocityWeight = (nesterov? this->momentum : T(1));
+            const T gradientWeight = (nesterov? T(1) : T(0));
+
+            kernels.momentum_step(weightGradients, stepScale, this->momentum, velocityWeight, gradientWeight,
+                                  moments1, weights, layer.numInputs);
+            kernels.momentum_step(&biasGradient, stepScale, this->momentum, velocityWeight, gradientWeight,
+                                  &layer.biasMoments1[neuronIdx], &layer.biases[neuronIdx], 1);
+
+            break;
+        }
+        case optimizer_e::adam:
+        {
+            kernels.adam_step(weightGradients, gradScale, this->adamBeta1, this->adamBeta2, this->adamStepSize, this->adamStepEpsilon,
+                              moments1, moments2, weights, layer.numInputs);
+            kernels.adam_step(&biasGradient, gradScale, this->adamBeta1, this->adamBeta2, this->adamStepSize, this->adamStepEpsilon,
+                              &layer.biasMoments1[neuronIdx], &layer.biasMoments2[neuronIdx], &layer.biases[neuronIdx], 1);
+
+            break;
+        }
+        default: k_assert(0, "Unknown optimizer."); break;
+    }
+
+    return;
+}
+
+template <typename T>
+T nnetwork_c<T>::loss_function_batch(const batch_workspace_s<T> &workspace)
+{
+    const auto &outputBatch = workspace.layers.back();
+    const uint numOutputs = this->layers.back().numNeurons;
+
+    T loss = 0;
+    for (uint n = 0; n < workspace.numSamples; n++)
+    {
+        const T *const outputs = outputBatch.outputs_of_sample(n);
+        const T *const expected = workspace.expected_outputs_of_sample(n);
+
+        for (uint i = 0; i < numOutputs; i++)
+        {
+            loss += ((outputs[i] - expected[i]) * (outputs[i] - expected[i]));
+        }
+    }
+
+    return (loss / numOutputs);
+}
+
+template <typename T>
+T nnetwork_c<T>::loss_function()
+{
+    if (layers.empty())
+    {
+        NBENE(("Attempted to fetch loss function for an empty network; not allowing this."));
+        return -1;
+    }
+
+    T loss = 0;
+    for (size_t i = 0; i < layers.back().numNeurons; i++)
+    {
+        loss += std::pow(this->output_of_neuron(i) - expectedOutput.at(i),2);
+    }
+
+    return (loss / layers.back().numNeurons);
+}
+
+template <typename T>
+std::vector<std::vector<T>> nnetwork_c<T>::get_weights_in_layer(const uint layer)
+{
+    if (layer >= this->layers.size())
+    {
+        NBENE(("Attempted to access out of bounds; not allowing it."));
+        return {};
+    }
+
+    const auto &thisLayer = this->layers.at(layer);
+
+    std::vector<std::vector<T>> weights;
+    for (uint n = 0; n < thisLayer.numNeurons; n++)
+    {
+        const T *const neuronWeights = thisLayer.weights_of_neuron(n);
+
+        weights.emplace_back(neuronWeights, (neuronWeights + thisLayer.numInputs));
+    }
+
+    return weights;
+}
+
+template <typename T>
+T nnetwork_c<T>::train(const array_view_s<T> input, const array_view_s<T> expectedOutput)
+{
+    this->set_inputs(this->context, input);
+    this->set_expected_output(expectedOutput);
+
+    {
+        K_TIME_PHASE(timer_phase_e::forward);
+        this->propagate_forward(this->context);
+    }
+
+    {
+        K_TIME_PHASE(timer_phase_e::back);
+        this->propagate_back_and_update();
+    }
+
+    K_TIME_PHASE(timer_phase_e::loss);
+    return this->loss_function();
+}
+
+template <typename T>
+T nnetwork_c<T>::train(const array_view_s<T> input, const uint expectedClass)
+{
+    this->set_inputs(this->context, input);
+    this->set_expected_class(expectedClass);
+
+    {
+        K_TIME_PHASE(timer_phase_e::forward);
+        this->propagate_forward(this->context);
+    }
+
+    {
+        K_TIME_PHASE(timer_phase_e::back);
+        this->propagate_back_and_update();
+    }
+
+    K_TIME_PHASE(timer_phase_e::loss);
+    return this->loss_function();
+}
+
+template <typename T>
+T nnetwork_c<T>::train_batch(const std::vector<std::vector<T>> &inputs, const std::vector<std::vector<T>> &expectedOutputs)
+{
+    this->batchInputViews.assign(inputs.begin(), inputs.end());
+    this->batchExpectedOutputViews.assign(expectedOutputs.begin(), expectedOutputs.end());
+
+    return this->train_batch(this->batchInputViews, this->batchExpectedOutputViews);
+}
+
+template <typename T>
+T nnetwork_c<T>::train_batch(const std::vector<array_view_s<T>> &inputs, const std::vector<array_view_s<T>> &expectedOutputs)
+{
+    if (inputs.size() != expectedOutputs.size())
+    {
+        NBENE(("Expected a non-empty batch with an equal number of inputs and expected outputs."));
+        return -1;
+    }
+
+    training_batch_s<T> batch;
+    batch.inputs = inputs.data();
+    batch.expectedOutputs = expectedOutputs.data();
+    batch.numSamples = inputs.size();
+
+    return this->train_on_batch(batch);
+}
+
+template <typename T>
+T nnetwork_c<T>::train_batch(const std::vector<array_view_s<T>> &inputs, const std::vector<uint> &expectedClasses)
+{
+    if (inputs.size() != expectedClasses.size())
+    {
+        NBENE(("Expected a non-empty batch with an equal number of inputs and expected outputs."));
+        return -1;
+    }
+
+    training_batch_s<T> batch;
+    batch.inputs = inputs.data();
+    batch.expectedClasses = expectedClasses.data();
+    batch.numSamples = inputs.size();
+
+    return this->train_on_batch(batch);
+}
+
+template <typename T>
+T nnetwork_c<T>::train_batch(const std::vector<array_view_s<u8>> &inputs, const std::vector<uint> &expectedClasses)
+{
+    if (inputs.size() != expectedClasses.size())
+    {
+        NBENE(("Expected a non-empty batch with an equal number of inputs and expected outputs."));
+        return -1;
+    }
+
+    training_batch_s<T> batch;
+    batch.byteInputs = inputs.data();
+    batch.expectedClasses = expectedClasses.data();
+    batch.numSamples = inputs.size();
+
+    return this->train_on_batch(batch);
+}
+
+template <typename T>
+T nnetwork_c<T>::train_on_batch(const training_batch_s<T> &batch)
+{
+    if (!this->is_valid_batch(batch))
+    {
+        return -1;
+    }
+
+    // Split the batch into contiguous shares, one per thread.
+    const uint numSamples = batch.numSamples;
+    const uint numWorkers = std::min(uint(this->batchWorkspaces.size()), numSamples);
+
+    this->numBatchSamples = numSamples;
+    this->samplesPerWorkspace = ((numSamples + numWorkers - 1) / numWorkers);
+
+    // Each weight moves by the average of its gradients over the batch.
+    const T gradScale = (T(1) / numSamples);
+
+    this->begin_optimizer_step();
+
+    // With a single worker, there's nothing to synchronize, so it can update the weights directly. Hogwild's
+    // workers do so too, but only under plain SGD: the other optimizers' steps are normalized by their state,
+    // which each worker would then advance on its own for a share of the gradient, taking a full step per worker.
+    const bool updateDirectly = ((this->hogwild && (this->optimizerType == optimizer_e::sgd)) || (numWorkers == 1));
+
+    this->threadPool->run(this->batchWorkspaces.size(), [&](const uint w)
+    {
+        auto &workspace = this->batchWorkspaces.at(w);
+        const uint firstSample = std::min(numSamples, (w * this->samplesPerWorkspace));
+        const uint numWorkerSamples = std::min(this->samplesPerWorkspace, (numSamples - firstSample));
+
+        workspace.numSamples = numWorkerSamples;
+        workspace.lossSum = 0;
+
+        if (!numWorkerSamples)
+        {
+            return;
+        }
+
+        {
+            K_TIME_PHASE(timer_phase_e::load_batch);
+            this->load_batch_workspace(workspace, batch, firstSample, numWorkerSamples);
+        }
+
+        {
+            K_TIME_PHASE(timer_phase_e::forward);
+            this->propagate_forward_batch(workspace);
+        }
+
+        // A single sample that's to update the weights directly can do so in the same pass as its backpropagation, as
+        // in train(), which saves going through the weights twice. This is the path of training a sample at a time.
+        const bool fusedUpdate = (updateDirectly && (numWorkerSamples == 1));
+
+        {
+            K_TIME_PHASE(timer_phase_e::back);
+
+            if (fusedUpdate)
+            {
+                this->propagate_back_and_update_batch(workspace, gradScale);
+            }
+            else
+            {
+                this->propagate_back_batch(workspace);
+            }
+        }
+
+        {
+            K_TIME_PHASE(timer_phase_e::loss);
+            workspace.lossSum = this->loss_function_batch(workspace);
+        }
+
+        if (!fusedUpdate)
+        {
+            K_TIME_PHASE(timer_phase_e::update);
+
+            if (updateDirectly)
+            {
+                this->update_weights_batch(workspace, gradScale);
+            }
+            else
+            {
+                this->compute_gradients_batch(workspace);
+            }
+        }
+    });
+
+    // Combine the workers' gradients and apply them to the weights. Each thread takes a range of each layer's
+    // neurons, so that no two threads write to the same weights.
+    if (!updateDirectly)
+    {
+        K_TIME_PHASE(timer_phase_e::reduce);
+
+        const uint numThreads = this->threadPool->num_threads();
+
+        for (uint i = 1; i < this->layers.size(); i++)
+        {
+            const uint numNeurons = this->layers.at(i).numNeurons;
+            const uint neuronsPerThread = ((numNeurons + numThreads - 1) / numThreads);
+
+            this->threadPool->run(numThreads, [&](const uint t)
+            {
+                const uint firstNeuron = std::min(numNeurons, (t * neuronsPerThread));
+
+                this->update_weights_from_gradients(i, firstNeuron, std::min(neuronsPerThread, (numNeurons - firstNeuron)), gradScale);
+            });
+        }
+    }
+
+    T lossSum = 0;
+    for (const auto &workspace: this->batchWorkspaces)
+    {
+        lossSum += workspace.lossSum;
+    }
+
+    return (lossSum / numSamples);
+}
+
+template <typename T>
+const std::vector<T>& nnetwork_c<T>::activation_vector(void)
+{
+    if (this->layers.empty())
+    {
+        NBENE(("Cannot return an activation matrix for an empty network."));
+        this->activations.clear();
+        return this->activations;
+    }
+
+    this->activations.assign(this->layers.back().numNeurons, 0);
+
+    // Find the node with the strongest activation.
+    int strongestNeuron = 0;
+    T strongestActivation = -1;
+    for (size_t i = 0; i < this->layers.back().numNeurons; i++)
+    {
+        if (this->output_of_neuron(i) > strongestActivation)
+        {
+            strongestActivation = this->output_of_neuron(i);
+            strongestNeuron = i;
+        }
+    }
+
+    // If the strongest neuron produces an output above the activation threshold,
+    // consider that to be the active neuron.
+    if (this->output_neuron_fires(strongestNeuron))
+    {
+        this->activations.at(strongestNeuron) = 1;
+    }
+
+    return this->activations;
+}
+
+template <typename T>
+void nnetwork_c<T>::propagate(const array_view_s<T> input)
+{
+    this->propagate(this->context, input);
+
+    return;
+}
+
+template <typename T>
+void nnetwork_c<T>::propagate(inference_context_s<T> &context, const array_view_s<T> input) const
+{
+    this->set_inputs(context, input);
+    this->propagate_forward(context);
+
+    return;
+}
+
+template <typename T>
+uint nnetwork_c<T>::predict(inference_context_s<T> &context, const array_view_s<T> input) const
+{
+    this->propagate(context, input);
+
+    return this->strongest_output_neuron_idx(context);
+}
+
+template <typename T>
+void nnetwork_c<T>::propagate(const array_view_s<u8> input)
+{
+    this->propagate(this->context, input);
+
+    return;
+}
+
+template <typename T>
+void nnetwork_c<T>::propagate(inference_context_s<T> &context, const array_view_s<u8> input) const
+{
+    this->set_inputs(context, input);
+    this->propagate_forward(context);
+
+    return;
+}
+
+template <typename T>
+uint nnetwork_c<T>::predict(inference_context_s<T> &context, const array_view_s<u8> input) const
+{
+    this->propagate(context, input);
+
+    return this->strongest_output_neuron_idx(context);
+}
+
+template <typename T>
+void nnetwork_c<T>::propagate_batch(batch_workspace_s<T> &workspace, const std::vector<array_view_s<u8>> &inputs) const
+{
+    workspace.numSamples = 0;
+
+    if (this->layers.empty() ||
+        inputs.empty())
+    {
+        NBENE(("Expected a non-empty batch and a non-empty network."));
+        return;
+    }
+
+    for (const auto &input: inputs)
+    {
+        if (input.size() != this->layers.front().numNeurons)
+        {
+            NBENE(("Incompatible input layer for the given batch."));
+            return;
+        }
+    }
+
+    training_batch_s<T> batch;
+    batch.byteInputs = inputs.data();
+    batch.numSamples = inputs.size();
+
+    this->load_batch_workspace(workspace, batch, 0, batch.numSamples);
+    this->propagate_forward_batch(workspace);
+
+    return;
+}
+
+template <typename T>
+T nnetwork_c<T>::output_of_neuron(const batch_workspace_s<T> &workspace, const uint sampleIdx, const uint outputNeuron) const
+{
+    k_assert((sampleIdx < workspace.numSamples), "Attempted to access a sample out of the batch's bounds.");
+
+    return workspace.layers.back().outputs_of_sample(sampleIdx)[outputNeuron];
+}
+
+template <typename T>
+uint nnetwork_c<T>::strongest_output_neuron_idx(const batch_workspace_s<T> &workspace, const uint sampleIdx) const
+{
+    k_assert((sampleIdx < workspace.numSamples), "Attempted to access a sample out of the batch's bounds.");
+
+    const T *const outputs = workspace.layers.back().outputs_of_sample(sampleIdx);
+
+    return (std::max_element(outputs, (outputs + this->layers.back().numNeurons)) - outputs);
+}
+
+template <typename T>
+void nnetwork_c<T>::set_random_seed(const u64 seed)
+{
+    this->randomSeed = seed;
+
+    std::seed_seq seedSequence = {u32(seed), u32(seed >> 32)};
+    this->randomNumberGenerator.seed(seedSequence);
+
+    return;
+}
+
+template <typename T>
+real nnetwork_c<T>::random_number(void)
+{
+    return this->randomUniformDistribution->operator()(this->randomNumberGenerator);
+}
+
+template class nnetwork_c<float>;
+template class nnetwork_c<double>;
@@ -9,73 +9,186 @@
 #define NEURAL_NETWORK_H
 
 #include <vector>
+#include <cmath>
 #include <random>
 #include <chrono>
+#include <memory>
 #include "../../src/train_on/mnist/mnist_data.h"
+#include "../../src/memory/aligned_buffer.h"
+#include "../../src/memory/array_view.h"
+#include "../../src/nnetwork/kernels/activation_kernels.h"
+#include "../../src/thread/thread_pool.h"
+#include "../../src/file/mapped_file.h"
 #include "../../src/common.h"
 
-// Types of functions we can apply to the sum of the inputs to a neuron to produce its output value.
-enum class activation_function_e
-{
-    none = 0,
-    relu,
-    leaky_relu,
-    log_sigmoid,
-    tanh_sigmoid,
-    mtanh_sigmoid,
-    softmax
-};
+// Note: The structures and the network below are templated on the scalar type (float or double) that the
+// net stores its weights and computes its values in. They're explicitly instantiated for float and double in
+// nnetwork.cpp.
 
-// The basic element of the neural network; takes a sum of inputs from nodes in the previous layer, and applies a function to that
-// sum to produce an output (which may feed into further neurons in the net).
-struct neuron_s
+// The rules by which training moves the weights along their gradients.
+enum class optimizer_e
 {
-    // The weights of all inputs to this neuron. Will equal the number of neurons in the
-    // previous layer.
-    std::vector<real> inputWeights;
-
-    // Weight of the bias connection to this node.
-    real biasWeight;
-
-    // The activation value that this neuron sends forward.
-    real output;
-
-    // The error delta.
-    real delta;
-
-    // Initializes the values of the neuron. Specifically, a number of weights is created to match the number of neurons in the
-    // preceding layer, i.e. the number of neurons connecting to this neuron. The weights are given random starting values using
-    // the provided random number generator.
-    neuron_s(const int precedingLayerSize, std::mt19937 randomNumberGenerator, std::normal_distribution<real> *const randomDistribution)
-    {
-        output = 0;
-        biasWeight = 0;
-        delta = 0;
-
-        for (int i = 0; i < precedingLayerSize; i++)
-        {
-            real randomWeight = randomDistribution->operator()(randomNumberGenerator);
-
-            // Adjust the weight to a range corresponding to the number of output connections to this neuron (as per He et al. 2015).
-            randomWeight *= sqrt(2.0 / precedingLayerSize);
-
-            inputWeights.push_back(randomWeight);
-        }
-    }
+    sgd = 0,    // Plain stochastic gradient descent.
+    momentum,   // Gradient descent with classical momentum.
+    nesterov,   // Gradient descent with Nesterov momentum.
+    adam,       // Adam (Kingma & Ba 2015).
+
+    count
 };
 
-// Forms the large-scale structure of the neural network by collecting together n number of neurons that share a purpose.
+// Returns the name of the given optimizer, as given on the command line; e.g. "adam".
+const char* koptimizer_name(const optimizer_e optimizer);
+
+// Forms the large-scale structure of the neural network by collecting together n number of neurons that share a purpose. Each
+// neuron takes a sum of inputs from the neurons in the previous layer, and applies a function to that sum to produce an output
+// (which may feed into further neurons in the net).
+//
+// The neurons' parameters are stored layer-wise in contiguous arrays rather than per neuron, so that the passes over the layer
+// can stream through memory. The layer holds no per-pass state (e.g. the neurons' outputs), so that several threads can run
+// passes through it at once; that state is held by inference_context_s and the like.
+template <typename T>
 struct neuron_layer_s
 {
-    // A list of the neurons in this layer.
-    std::vector<neuron_s> neurons;
+    // The number of neurons in this layer.
+    uint numNeurons = 0;
+
+    // The number of inputs to each neuron in this layer; i.e. the number of neurons in the preceding layer.
+    uint numInputs = 0;
+
+    // The distance, in elements, between the starts of consecutive rows in the weight matrix. Padded up from
+    // the number of inputs so that each row begins on an aligned address.
+    uint weightStride = 0;
+
+    // The input weights of all neurons in this layer, as a row-major matrix of numNeurons rows, with row n
+    // holding the weights of the nth neuron's connections to the neurons in the preceding layer. Any padding
+    // at the end of a row is kept at zero.
+    aligned_buffer_c<T> weights;
+
+    // Weight of the bias connection to each neuron.
+    aligned_buffer_c<T> biases;
+
+    // The optimizer's state for each weight and bias, laid out like the weights and biases, so that an update can stream
+    // through both together: the velocities for momentum; or, for Adam, the first moments, and the second moments in the
+    // latter pair. Allocated by the first training step that needs them; not saved with the net.
+    aligned_buffer_c<T> weightMoments1;
+    aligned_buffer_c<T> weightMoments2;
+    aligned_buffer_c<T> biasMoments1;
+    aligned_buffer_c<T> biasMoments2;
 
     // The function to apply to the input values of the layer's neurons to produce their output.
     activation_function_e activationFunction = activation_function_e::none;
+
+    // The kernels of the above activation function.
+    const activation_kernels_s<T> *activation = NULL;
+
+    T* weights_of_neuron(const uint neuronIdx) { return (weights.data() + (neuronIdx * weightStride)); }
+    const T* weights_of_neuron(const uint neuronIdx) const { return (weights.data() + (neuronIdx * weightStride)); }
+};
+
+// Holds the state of one forward pass through a net, i.e. the output value of each of its neurons. Kept separate from the
+// net, so that any number of threads can run inputs through the same net at once, each with its own context. Create with
+// nnetwork_c::make_inference_context().
+template <typename T>
+struct inference_context_s
+{
+    // The activation value that each neuron sends forward. Element n holds the outputs of the nth layer's neurons.
+    std::vector<aligned_buffer_c<T>> outputs;
+};
+
+// Holds the outputs and error deltas of one layer's neurons over a batch of samples, for batched training.
+template <typename T>
+struct neuron_layer_batch_s
+{
+    // The distance, in elements, between the starts of consecutive samples' rows in the matrices below. Padded
+    // up from the number of neurons in the layer so that each row begins on an aligned address.
+    uint stride = 0;
+
+    // Row-major matrices with one row per sample in the batch; the nth element of a row belongs to the
+    // layer's nth neuron.
+    aligned_buffer_c<T> outputs;
+    aligned_buffer_c<T> deltas;
+
+    // The gradients of the layer's weights and biases summed over the samples in the batch. Laid out like
+    // the layer's weights and biases. Only allocated when needed, i.e. when the gradients of several
+    // workers' batches need to be combined before being applied to the weights.
+    aligned_buffer_c<T> weightGradients;
+    aligned_buffer_c<T> biasGradients;
+
+    T* outputs_of_sample(const uint sampleIdx) { return (outputs.data() + (sampleIdx * stride)); }
+    const T* outputs_of_sample(const uint sampleIdx) const { return (outputs.data() + (sampleIdx * stride)); }
+
+    T* deltas_of_sample(const uint sampleIdx) { return (deltas.data() + (sampleIdx * stride)); }
+    const T* deltas_of_sample(const uint sampleIdx) const { return (deltas.data() + (sampleIdx * stride)); }
+};
+
+// The state that one thread needs for training the net on its share of a batch of samples.
+template <typename T>
+struct batch_workspace_s
+{
+    // The state of each layer over this workspace's samples. Element n corresponds to the nth layer in
+    // the network.
+    std::vector<neuron_layer_batch_s<T>> layers;
+
+    // The expected outputs for this workspace's samples, one row per sample, laid out like the output
+    // layer's batch outputs.
+    aligned_buffer_c<T> expectedOutputs;
+
+    // For the first layer's sparse path (see nnetwork_c::sparseInputCost), which is taken if sparseInputs
+    // is true: each sample's nonzero inputs, as their values and their indices in the input layer, with
+    // sample n's starting at element n times the input layer's stride, and numbering numNonzeroInputs[n];
+    // and the indices of the inputs that are nonzero in any of the samples, with a flag for each input to
+    // tell whether it's among them.
+    aligned_buffer_c<u32> inputIndices;
+    aligned_buffer_c<T> inputValues;
+    std::vector<uint> numNonzeroInputs;
+    std::vector<u32> activeInputs;
+    std::vector<u8> isActiveInput;
+    bool sparseInputs = false;
+
+    // For the sparse path, a matrix with a row for each input, and the first layer's stride; row i holds,
+    // for active input i, either the ith column of the layer's weight matrix or the gradients of that
+    // column's weights. Rows of inactive inputs go unused.
+    aligned_buffer_c<T> inputColumns;
+
+    // The number of samples currently in this workspace, and the number of samples its matrices have
+    // room for.
+    uint numSamples = 0;
+    uint capacity = 0;
+
+    // This workspace's share of the batch's summed loss function.
+    T lossSum = 0;
+
+    T* expected_outputs_of_sample(const uint sampleIdx) { return (expectedOutputs.data() + (sampleIdx * layers.back().stride)); }
+    const T* expected_outputs_of_sample(const uint sampleIdx) const { return (expectedOutputs.data() + (sampleIdx * layers.back().stride)); }
+
+    const u32* input_indices_of_sample(const uint sampleIdx) const { return (inputIndices.data() + (sampleIdx * layers.front().stride)); }
+    const T* input_values_of_sample(const uint sampleIdx) const { return (inputValues.data() + (sampleIdx * layers.front().stride)); }
+
+    T* input_column(const uint inputIdx) { return (inputColumns.data() + (inputIdx * layers.at(1).stride)); }
+    const T* input_column(const uint inputIdx) const { return (inputColumns.data() + (inputIdx * layers.at(1).stride)); }
 };
 
+// A batch of training samples, as passed from the train_batch() overloads to the batch passes. The inputs are given
+// either as values of T or as bytes, and the expected outputs either as output vectors or as class indices; whichever
+// isn't used is NULL.
+template <typename T>
+struct training_batch_s
+{
+    const array_view_s<T> *inputs = NULL;
+    const array_view_s<u8> *byteInputs = NULL;
+    const array_view_s<T> *expectedOutputs = NULL;
+    const uint *expectedClasses = NULL;
+    uint numSamples = 0;
+};
+
+template <typename T> struct nnetwork_bench_s;
+
+template <typename T>
 class nnetwork_c
 {
+    // Lets the benchmarks (src/bench/) time the stages of training separately.
+    friend struct nnetwork_bench_s<T>;
+
 public:
     nnetwork_c();
     ~nnetwork_c();
@@ -83,10 +196,65 @@ public:
     // Feeds the given input through the neural network and adjusts the weights of the network given any possible mismatch between the
     // expected output and the output generated by the network. Returns the loss function, i.e. an estimate of how 'wrong' the current
     // output of the network is, compared to the expected output.
-    real train(const std::vector<real> input, const std::vector<real> expectedOutput);
+    T train(const array_view_s<T> input, const array_view_s<T> expectedOutput);
+
+    // As train(), but with the expected output given as the index of the output neuron that should fire, with all others
+    // expected to output zero.
+    T train(const array_view_s<T> input, const uint expectedClass);
+
+    // Feeds the given batch of inputs through the neural network, and adjusts the network's weights once, by the average of the
+    // adjustments that each input would call for given the corresponding expected output. The batch is processed as matrix-matrix
+    // operations over all of its samples at once, rather than one sample at a time. Returns the loss function averaged over the
+    // batch. Afterwards, the outputs the net produced for the batch (before the weights were adjusted) can be queried with the
+    // *_in_batch() functions.
+    //
+    // If the net has been given more than one thread, the batch is split evenly across the threads, each of which runs the
+    // forward and backward passes on its share. By default, the threads' gradients are then summed and applied together, so
+    // that the result matches that of a single thread (up to rounding). In Hogwild mode, each thread instead applies its own
+    // share's adjustments to the weights as soon as it has them, without synchronizing with the other threads (as per Niu et
+    // al. 2011); this avoids the reduction step, at the cost of the threads reading weights that others are writing. Hogwild
+    // mode only applies to plain SGD; with the other optimizers, the gradients are always summed first.
+    T train_batch(const std::vector<std::vector<T>> &inputs, const std::vector<std::vector<T>> &expectedOutputs);
+    T train_batch(const std::vector<array_view_s<T>> &inputs, const std::vector<array_view_s<T>> &expectedOutputs);
+
+    // As train_batch(), but with each sample's expected output given as the index of the output neuron that should fire.
+    // Together with views into the dataset, this lets a batch be trained on without copying its samples.
+    T train_batch(const std::vector<array_view_s<T>> &inputs, const std::vector<uint> &expectedClasses);
+
+    // As above, but with inputs given as bytes, which are scaled from 0..255 to 0..1 as they're loaded into the input
+    // layer. Lets the caller keep its dataset in its compact 8-bit form rather than as an array of T.
+    T train_batch(const std::vector<array_view_s<u8>> &inputs, const std::vector<uint> &expectedClasses);
 
     // Sends the given input through the neural network. The net's output can then be read from the output neurons.
-    void propagate(const std::vector<real> input);
+    void propagate(const array_view_s<T> input);
+
+    // Returns a context for passing inputs through the net with the const functions below. Any number of contexts can
+    // be in use at once (e.g. one per thread), as long as the net isn't being trained or modified at the same time. A
+    // context is valid until layers are added to the net.
+    inference_context_s<T> make_inference_context(void) const;
+
+    // Sends the given input through the neural network, storing the outputs of its neurons in the given context.
+    void propagate(inference_context_s<T> &context, const array_view_s<T> input) const;
+
+    // Sends the given input through the neural network, and returns the index in the output layer of the neuron that
+    // responded the strongest.
+    uint predict(inference_context_s<T> &context, const array_view_s<T> input) const;
+
+    // As the above, but with byte inputs, which are scaled from 0..255 to 0..1 as they're loaded into the input layer.
+    void propagate(const array_view_s<u8> input);
+    void propagate(inference_context_s<T> &context, const array_view_s<u8> input) const;
+    uint predict(inference_context_s<T> &context, const array_view_s<u8> input) const;
+
+    // Sends the given batch of byte inputs through the neural network in one batched forward pass, as in train_batch() but
+    // without adjusting the weights. The outputs are stored in the given workspace, which grows as needed; it can be
+    // default-constructed, and is best reused across calls. As with inference contexts, any number of workspaces can be in
+    // use at once, as long as the net isn't being trained or modified at the same time.
+    void propagate_batch(batch_workspace_s<T> &workspace, const std::vector<array_view_s<u8>> &inputs) const;
+
+    // Returns the output value of the given output neuron, or the index of the strongest output neuron, for the given
+    // sample of the batch most recently passed through the given workspace with propagate_batch().
+    T output_of_neuron(const batch_workspace_s<T> &workspace, const uint sampleIdx, const uint outputNeuron) const;
+    uint strongest_output_neuron_idx(const batch_workspace_s<T> &workspace, const uint sampleIdx) const;
 
     // Creates a neuron layer of the given number of neurons, and adds it to the neural network. Note that the first layer added via
     // this function will be treated as the input layer, and the last layer added will be treated as the output layer.
@@ -95,113 +263,286 @@ public:
     // Returns a random(-ish) number in the range 0..1.
     real random_number(void);
 
+    // Seeds the random numbers that the net draws from: those that initialize the weights of the layers added from
+    // here on, and those returned by random_number(). Nets given the same seed (and the same layers, in the same
+    // order) start out with the same weights. By default, the seed is taken from the system clock.
+    void set_random_seed(const u64 seed);
+
+    u64 random_seed(void) const { return randomSeed; }
+
     // Returns the output value of the given neuron of the output layer.
-    real output_of_neuron(const uint outputNeuron) { return real(layers.back().neurons.at(outputNeuron).output); }
+    T output_of_neuron(const uint outputNeuron) const { return this->output_of_neuron(this->context, outputNeuron); }
+    T output_of_neuron(const inference_context_s<T> &context, const uint outputNeuron) const { return T(context.outputs.back()[outputNeuron]); }
 
     // Returns true if the given output neuron's output value exceeds the activation threshold.
-    bool output_neuron_fires(const uint outputNeuron) { return bool(output_of_neuron(outputNeuron) > activationThreshold); }
+    bool output_neuron_fires(const uint outputNeuron) const { return this->output_neuron_fires(this->context, outputNeuron); }
+    bool output_neuron_fires(const inference_context_s<T> &context, const uint outputNeuron) const { return bool(output_of_neuron(context, outputNeuron) > activationThreshold); }
 
     // Returns the index in the output layer of the strongest neuron.
-    uint strongest_output_neuron_idx(void);
+    uint strongest_output_neuron_idx(void) const;
+    uint strongest_output_neuron_idx(const inference_context_s<T> &context) const;
+
+    // Returns the index in the output layer of the neuron that responded the strongest to the given sample of the most recent
+    // training batch.
+    uint strongest_output_neuron_idx_in_batch(const uint sampleIdx) const;
+
+    // Returns true if the given output neuron's output value for the given sample of the most recent training batch exceeds the
+    // activation threshold.
+    bool output_neuron_fires_in_batch(const uint sampleIdx, const uint outputNeuron) const;
 
-    // Returns a vector where the highest activation for a class is marked by 1 and others as 0.
-    std::vector<real> activation_vector(void);
+    // Returns a vector where the highest activation for a class is marked by 1 and others as 0. The vector is the net's
+    // own, and is overwritten by the next call.
+    const std::vector<T>& activation_vector(void);
 
     // For each neuron in the given layer, returns a vector of its input weights.
-    std::vector<std::vector<real>> get_weights_in_layer(const uint layer);
+    std::vector<std::vector<T>> get_weights_in_layer(const uint layer);
 
     // Run a diagnostic test on the neural network. In this test, the net attempts to learn XOR.
     // The percentage (0-100) of correct trials will be returned. Ideally, the result would be 100%
     // every time.
     static real xor_test(void);
 
+    // Writes the net's topology, the activation function of each layer, and its weights and biases into the given
+    // file. The weights and biases are stored in blocks aligned the same way as in memory, so that load() can use them
+    // in place. Returns false on failure.
+    bool save(const char *const filename) const;
+
+    // Replaces the net's layers with those in the given file, as written by save(). The file is memory-mapped
+    // copy-on-write and the layers' weights refer into the mapping, so nothing needs to be parsed or copied; training
+    // the net afterwards modifies only the process's private copy of the pages it touches. Returns false, leaving the
+    // net unchanged, if the file doesn't hold a valid net of this scalar type.
+    bool load(const char *const filename);
+
+    // Copies the net's layers, i.e. their topology, weights and biases (but not the optimizer's state), into the given
+    // net in place of its own; e.g. so that inputs can be run through the copy while this net carries on training. The
+    // given net's buffers are reused when their sizes match, so that snapshots taken repeatedly cost only the copying.
+    void snapshot_into(nnetwork_c<T> &snapshot) const;
+
     // Prints to the terminal the net's current configuration, e.g. layer layout etc.
     bool announce_current_configuration() const;
 
-    void set_learning_rate(const real rate) { learningRate = rate; }
+    void set_learning_rate(const T rate) { learningRate = rate; }
+
+    // Sets the rule by which training moves the weights; see optimizer_e. The optimizer's state starts out afresh.
+    void set_optimizer(const optimizer_e newOptimizer);
+
+    optimizer_e optimizer(void) const { return this->optimizerType; }
 
     void set_num_training_epochs(const uint epochs) { numTrainingEpochs = epochs; }
 
-    void set_activation_threshold(const real thresh) { activationThreshold = thresh; }
+    void set_batch_size(const uint size) { batchSize = size; }
+
+    // Sets the number of threads to spread the training batches across.
+    void set_num_threads(const uint numThreads);
+
+    void set_hogwild(const bool enabled) { hogwild = enabled; }
+
+    void set_activation_threshold(const T thresh) { activationThreshold = thresh; }
 
     uint num_training_epochs(void) const;
 
+    uint batch_size(void) const;
+
+    uint num_threads(void) const;
+
+    uint num_neurons_in_layer(const uint layerIdx) const { return this->layers.at(layerIdx).numNeurons; }
+
+    // Gives read access to the given layer's parameters; e.g. for converting the net into another form.
+    const neuron_layer_s<T>& layer(const uint layerIdx) const { return this->layers.at(layerIdx); }
+
+    // The threads that the net spreads its training across. Can be used for parallel work on the net between
+    // training calls, e.g. for running inference with one context per thread.
+    thread_pool_c& thread_pool(void) { return *threadPool; }
+
     uint num_layers(void) const;
 
 private:
-    // Send the given input through the neural network to produce output.
-    void propagate_forward();
+    // Send the input in the given context through the neural network to produce output.
+    void propagate_forward(inference_context_s<T> &context) const;
 
     // In training, calculate the error between the produced output (from forward-propagation) and the output that was expected. Propagate
-    // that error from the output neuron(s) to the neurons in preceding layers.
-    void propagate_back();
+    // that error from the output neuron(s) to the neurons in preceding layers, and based on the error terms, update the input weights to
+    // each neuron; the two in a single pass over each layer's weights. Each weight's step is scaled by gradScale. The sample's outputs
+    // and error terms in each layer are given by the functions outputs_of_layer() and deltas_of_layer() of the layer's index, so that
+    // the sample can be the net's own (cf. train()) or the only one in a batch workspace (cf. train_on_batch()).
+    template <typename OutputsOf, typename DeltasOf>
+    void propagate_back_and_update_sample(const OutputsOf &outputs_of_layer, const DeltasOf &deltas_of_layer,
+                                          const T *const expectedOutputs, const T gradScale);
 
-    // Based on the error terms calculated during backpropagation, update the input weights to each neuron.
-    void update_weights();
+    // As propagate_back_and_update_sample(), for the net's own sample, as set up by train().
+    void propagate_back_and_update();
 
-    // Express the difference between the neural network's output and the expected output.
-    real loss_function();
+    // As propagate_back_and_update_sample(), for the only sample in the given workspace.
+    void propagate_back_and_update_batch(batch_workspace_s<T> &workspace, const T gradScale);
 
-    // Takes an array of values and assigns those values to the network's input neurons. Note that the size of this array must
-    // match the number of input neurons in the network.
-    void set_inputs(const std::vector<real> inputs);
+    // Express the difference between the neural network's output and the expected output.
+    T loss_function();
+
+    // Batched versions of the above, operating on the samples in the given workspace. Here the backward pass and the
+    // weight update are kept apart, since the update needs the error terms of all the samples. The weight update takes each
+    // weight's gradient to be gradScale times the sum of its gradients over the samples.
+    void propagate_forward_batch(batch_workspace_s<T> &workspace) const;
+    void propagate_back_batch(batch_workspace_s<T> &workspace);
+    void update_weights_batch(batch_workspace_s<T> &workspace, const T gradScale);
+    T loss_function_batch(const batch_workspace_s<T> &workspace);
+
+    // Sums the gradients of the weights over the samples in the given workspace into the workspace's gradient
+    // matrices; for when the weights are to be updated later, by update_weights_from_gradients().
+    void compute_gradients_batch(batch_workspace_s<T> &workspace);
+
+    // For the first layer's sparse path: lists the given workspace's nonzero inputs, and decides whether the
+    // path pays off for them.
+    void find_nonzero_inputs(batch_workspace_s<T> &workspace) const;
+
+    // For the first layer's sparse path: computes the first layer's sums for the samples in the given workspace
+    // from the weights of their nonzero inputs only; and sums the gradients of those weights over the samples,
+    // into the workspace's input columns.
+    void propagate_forward_sparse_inputs(batch_workspace_s<T> &workspace) const;
+    void sum_sparse_input_gradients(batch_workspace_s<T> &workspace) const;
+
+    // Sums the gradients of the given layer's weights and biases over the samples in the given workspace into the
+    // workspace's gradient matrices for the layer.
+    void sum_layer_gradients(batch_workspace_s<T> &workspace, const uint layerIdx) const;
+
+    // Moves the weights of the given range of neurons in the given layer by the sum of the workspaces' gradients,
+    // times gradScale.
+    void update_weights_from_gradients(const uint layerIdx, const uint firstNeuron, const uint numNeurons, const T gradScale);
+
+    // Readies the optimizer for a training step: allocates its state if need be, and advances its step count. To be
+    // called once before each update of the weights.
+    void begin_optimizer_step(void);
+
+    // Moves the given neuron's weights and bias as the optimizer sees fit, given their gradients, each multiplied by
+    // gradScale.
+    void optimize_neuron(neuron_layer_s<T> &layer, const uint neuronIdx, const T *const weightGradients,
+                         const T biasGradient, const T gradScale);
+
+    // Copies the given range of inputs and expected outputs into the given workspace, growing its matrices first
+    // if needed. If the batch has no expected outputs, only the inputs are copied.
+    void load_batch_workspace(batch_workspace_s<T> &workspace, const training_batch_s<T> &batch,
+                              const uint firstSample, const uint numSamples) const;
+
+    // Returns true if the given batch of inputs and expected outputs is compatible with the net.
+    bool is_valid_batch(const training_batch_s<T> &batch) const;
+
+    // The implementation of the train_batch() overloads.
+    T train_on_batch(const training_batch_s<T> &batch);
+
+    // Returns the workspace holding the given sample of the most recent training batch, and sets localIdx to the
+    // sample's index within that workspace.
+    const batch_workspace_s<T>& workspace_of_sample(const uint sampleIdx, uint *const localIdx) const;
+
+    // Takes an array of values and assigns those values to the network's input neurons in the given context. Note that the
+    // size of this array must match the number of input neurons in the network.
+    void set_inputs(inference_context_s<T> &context, const array_view_s<T> inputs) const;
+    void set_inputs(inference_context_s<T> &context, const array_view_s<u8> inputs) const;
+
+    // Returns true if the given number of input values matches the input layer, and the given context the net.
+    bool is_valid_input(const inference_context_s<T> &context, const uint numInputs) const;
 
     // Tell the net which output values it should expect to be produced when the next set of inputs is passed along. Used
     // for training.
-    void set_expected_output(const std::vector<real> expected);
+    void set_expected_output(const array_view_s<T> expected);
+
+    // As set_expected_output(), but for a one-hot output where the given output neuron is expected to fire.
+    void set_expected_class(const uint expectedClass);
+
+    // The factor by which byte inputs are scaled on their way into the input layer, to map 0..255 to 0..1.
+    static constexpr double byteInputScale = (1 / 255.0);
+
+    // The first layer's sparse path visits the weights of the nonzero inputs only, one input at a time rather
+    // than one neuron at a time, which means transposing those inputs' columns of weights into the workspace,
+    // and their gradients back out of it. It's taken for a workspace's samples if it's estimated to cost less
+    // than the dense path, with the dense path costing 1 per input per sample; and the sparse path costing
+    // sparseInputCost per nonzero input, plus sparseColumnCost per column that needs transposing. (Measured
+    // on a 784-128-10 net with AVX-512, erring on the side of the dense path.) With fewer than sparseMinSamples
+    // samples, the transposes rarely pay off, and the path isn't considered, to save listing the nonzero inputs.
+    // In practice, the path is taken for batches of 32 or more samples that are up to about a third nonzero,
+    // like MNIST's digits (about a fifth); and for smaller batches, only if they're sparser than that.
+    static constexpr double sparseInputCost = 2;
+    static constexpr double sparseColumnCost = 20;
+    static constexpr uint sparseMinSamples = 16;
+
+    // The batched passes multiply the workspace's matrices by the weights with kgemm(), which packs its operands
+    // into cache-sized blocks and works through them in tiles of several samples at a time. With only a few samples,
+    // the packing (of the whole weight matrix, in the forward and backward passes) costs more than it saves, and
+    // most of each tile is padding; so with fewer samples than these, the weights are instead run against the
+    // samples in place, a row at a time. The forward pass's row loop is the cheapest to beat, since it already
+    // reuses each row across four samples.
+    static constexpr uint gemmMinSamples = 32;
+    static constexpr uint gemmBackMinSamples = 8;
 
-    // Applies the softmax output function to the output neurons' sums.
-    void apply_softmax_to_output();
+    // The size of steps the network takes in adjusting its weights. Smaller weights
+    // mean slower learning, while larger weights mean less precise learning. Typical
+    // values: 0.01 to 0.0001, depending on the dataset.
+    T learningRate = 0.01;
 
-    // Decides on the type of activation function to call, and returns the output from that activation function given the provided sum.
-    inline real activation_function(const real sum, const activation_function_e functionType) const;
+    // The rule by which training moves the weights.
+    optimizer_e optimizerType = optimizer_e::sgd;
 
-    // Calls a derivative function that corresponds to the neuron's activation function, and returns the output of that derivate.
-    inline real activation_function_derivative(const real output, const activation_function_e functionType) const;
+    // The fraction of a weight's velocity that carries over from one step to the next, with momentum.
+    T momentum = 0.9;
 
-    // Activation functions.
-    //
-    // Logistic sigmoid.
-    inline real af_logsigmoid(const real x)           const { return (1 / (1 + exp(-x)));                               }
-    inline real af_logsigmoid_deriv(const real x)     const { return (x * (1 - x));                                     }
-    //
-    // Rectified linear unit.
-    inline real af_relu(const real x)                 const { return ((x > 0)? x : 0);                                  }
-    inline real af_relu_deriv(const real x)           const { return ((x > 0)? 1 : 0);                                  }
-    //
-    // Leaky rectified linear unit.
-    inline real af_leakyrelu(const real x)            const { return ((x > 0)? x : (0.01 * x));                         }
-    inline real af_leakyrelu_deriv(const real x)      const { return ((x > 0)? 1 : 0.01);                               }
-    //
-    // Hyperbolic tangent sigmoid.
-    inline real af_tanhsigmoid(const real x)          const { return tanh(x);                                           }
-    inline real af_tanhsigmoid_deriv(const real x)    const { return (1 - (x * x));                                     }
-    //
-    // Modified hyperbolic tangent sigmoid (LeCun et al. 1998).
-    inline real af_modtanhsigmoid(const real x)       const { return (1.7159 * tanh(0.6667 * x));                       }
-    inline real af_modtanhsigmoid_deriv(const real x) const { return ((0.6667 / 1.7159) * (1.7159 - x) * (1.7159 + x)); }
+    // The decay rates of Adam's first and second moments, and the term that keeps its step sizes finite.
+    T adamBeta1 = 0.9;
+    T adamBeta2 = 0.999;
+    T adamEpsilon = 1e-8;
 
-    // The size of steps the network takes in adjusting its weights. Smaller weights
-    // mean slower learning, while larger weights mean less precise learning. Typical
-    // values: 0.01 to 0.0001, depending on the dataset.
-    real learningRate = 0.01;
+    // The number of optimizer steps taken since the optimizer's state was last reset; and, for the current step,
+    // Adam's step size and epsilon, with the moments' bias correction folded in.
+    u64 numOptimizerSteps = 0;
+    T adamStepSize = 0;
+    T adamStepEpsilon = 0;
 
     // How many epochs to run when training the net.
     uint numTrainingEpochs = 10;
 
+    // How many samples to train the net on at a time; i.e. how many samples' worth of adjustments
+    // to average into each update of the weights.
+    uint batchSize = 1;
+
     // If an output neuron's output value is above this number, we consider the neuron to fire.
-    real activationThreshold = 0.5;
+    T activationThreshold = 0.5;
+
+    std::vector<neuron_layer_s<T>> layers;
 
-    std::vector<neuron_layer_s> layers;
+    // The net's own inference context; used by the functions that don't take one, and by train().
+    inference_context_s<T> context;
+
+    // The error delta of each neuron, for train(). Element n holds the deltas of the nth layer's neurons.
+    std::vector<aligned_buffer_c<T>> deltas;
 
     // The value for each output neuron in the network that we expect the network to produce when next
     // executed on input data.
-    std::vector<real> expectedOutput;
+    std::vector<T> expectedOutput;
 
-    std::mt19937 randomNumberGenerator;
+    // Views of the samples given to train_batch() as vectors, and the vector returned by activation_vector(); kept
+    // from call to call, so that their memory gets reused.
+    std::vector<array_view_s<T>> batchInputViews;
+    std::vector<array_view_s<T>> batchExpectedOutputViews;
+    std::vector<T> activations;
+
+    // One workspace per training thread; each holds the thread's share of the current training batch.
+    std::vector<batch_workspace_s<T>> batchWorkspaces;
+
+    // The number of samples in the current training batch, and the number of those assigned to each
+    // workspace (except possibly the last, which gets what's left over).
+    uint numBatchSamples = 0;
+    uint samplesPerWorkspace = 0;
+
+    // The threads that training batches are spread across.
+    std::unique_ptr<thread_pool_c> threadPool;
 
-    // This distribution is used to feed random weights into the network (Gaussian with a mean of 0 and a standard deviation of 1).
-    std::normal_distribution<real> *const randomNormalDistribution = new std::normal_distribution<real>(0, 1);
+    // Whether threads apply their adjustments to the weights without synchronizing with each other.
+    bool hogwild = false;
+
+    // The file the net was loaded from, if any. The layers' weights and biases refer into its mapping.
+    std::unique_ptr<mapped_file_c> mappedModel;
+
+    // The seed of the random numbers the net uses; see set_random_seed().
+    u64 randomSeed = 0;
+
+    std::mt19937 randomNumberGenerator;
 
     std::uniform_real_distribution<real> *const randomUniformDistribution = new std::uniform_real_distribution<real>(0, 1);
 };
@@ -0,0 +1,248 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * Saving and loading the neural network's layers.
+ *
+ */
+
+#include <cstring>
+#include "../../src/nnetwork/nnetwork.h"
+#include "../../src/file/file.h"
+#include "../../src/common.h"
+
+// The layout of a saved net (all values in the host's byte order):
+//
+//   - a header (model_file_header_s), padded to K_BUFFER_ALIGNMENT bytes;
+//   - one model_file_layer_s per layer, padded as a whole to K_BUFFER_ALIGNMENT bytes;
+//   - for each layer, its weight matrix followed by its biases, each in a block that starts on a
+//     K_BUFFER_ALIGNMENT boundary. The weight matrix includes the padding at the end of each row,
+//     so that it can be used as-is.
+//
+// Since mmap() returns page-aligned memory, a block that's aligned in the file is also aligned in
+// the mapping.
+
+static const char MODEL_FILE_MAGIC[8] = {'L', 'I', 'M', 'P', 'Y', 'N', 'E', 'T'};
+static const u32 MODEL_FILE_VERSION = 1;
+
+struct model_file_header_s
+{
+    char magic[8];
+    u32 version;
+
+    // The size in bytes of the scalars the weights are stored as; 4 for float, 8 for double.
+    u32 scalarSize;
+
+    u32 numLayers;
+    u32 reserved;
+};
+
+struct model_file_layer_s
+{
+    u32 numNeurons;
+    u32 numInputs;
+    u32 weightStride;
+    u32 activationFunction;
+
+    // Byte offsets from the start of the file.
+    u64 weightsOffset;
+    u64 biasesOffset;
+};
+
+// Returns the given byte offset rounded up to the next K_BUFFER_ALIGNMENT boundary.
+static u64 aligned_offset(const u64 offset)
+{
+    return (((offset + K_BUFFER_ALIGNMENT - 1) / K_BUFFER_ALIGNMENT) * K_BUFFER_ALIGNMENT);
+}
+
+template <typename T>
+bool nnetwork_c<T>::save(const char *const filename) const
+{
+    if (this->layers.empty())
+    {
+        NBENE(("Attempted to save an empty network; not allowing this."));
+        return false;
+    }
+
+    model_file_header_s header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MODEL_FILE_MAGIC, sizeof(header.magic));
+    header.version = MODEL_FILE_VERSION;
+    header.scalarSize = sizeof(T);
+    header.numLayers = this->layers.size();
+
+    // Lay out the data blocks.
+    std::vector<model_file_layer_s> layerInfo(this->layers.size());
+    {
+        u64 offset = aligned_offset(aligned_offset(sizeof(header)) + (layerInfo.size() * sizeof(model_file_layer_s)));
+
+        for (size_t i = 0; i < this->layers.size(); i++)
+        {
+            const auto &layer = this->layers.at(i);
+            auto &info = layerInfo.at(i);
+
+            memset(&info, 0, sizeof(info));
+            info.numNeurons = layer.numNeurons;
+            info.numInputs = layer.numInputs;
+            info.weightStride = layer.weightStride;
+            info.activationFunction = u32(layer.activationFunction);
+
+            info.weightsOffset = offset;
+            offset = aligned_offset(offset + (layer.weights.size() * sizeof(T)));
+
+            info.biasesOffset = offset;
+            offset = aligned_offset(offset + (layer.biases.size() * sizeof(T)));
+        }
+    }
+
+    file_handle_t fh = 0;
+    if (!kfile_try_open_file(filename, "wb", &fh))
+    {
+        NBENE(("Failed to open '%s' for writing.", filename));
+        return false;
+    }
+
+    u64 position = 0;
+    bool writeOk = true;
+
+    // Writes the given bytes at the given offset, padding with zeroes from the current position.
+    const auto write_at = [&](const u64 offset, const void *const src, const size_t numBytes)
+    {
+        k_assert((offset >= position), "Overlapping blocks in the model file.");
+
+        writeOk = (writeOk &&
+                   kfile_try_fill(0, (offset - position), fh) &&
+                   (!numBytes || kfile_try_write_byte_array((const unsigned char*)src, numBytes, fh)));
+
+        position = (offset + numBytes);
+    };
+
+    write_at(0, &header, sizeof(header));
+    write_at(aligned_offset(sizeof(header)), layerInfo.data(), (layerInfo.size() * sizeof(model_file_layer_s)));
+
+    for (size_t i = 0; i < this->layers.size(); i++)
+    {
+        const auto &layer = this->layers.at(i);
+
+        write_at(layerInfo.at(i).weightsOffset, layer.weights.data(), (layer.weights.size() * sizeof(T)));
+        write_at(layerInfo.at(i).biasesOffset, layer.biases.data(), (layer.biases.size() * sizeof(T)));
+    }
+
+    write_at(aligned_offset(position), NULL, 0);
+
+    if (!kfile_try_close_file(fh) ||
+        !writeOk)
+    {
+        NBENE(("Failed to write '%s'.", filename));
+        return false;
+    }
+
+    return true;
+}
+
+template <typename T>
+bool nnetwork_c<T>::load(const char *const filename)
+{
+    std::unique_ptr<mapped_file_c> file(new mapped_file_c);
+    if (!file->open(filename, true))
+    {
+        return false;
+    }
+
+    u8 *const contents = file->mutable_data();
+    const size_t fileSize = file->size();
+
+    // Validate the header.
+    model_file_header_s header;
+    {
+        if (fileSize < sizeof(header))
+        {
+            NBENE(("'%s' is too small to be a saved net.", filename));
+            return false;
+        }
+
+        memcpy(&header, contents, sizeof(header));
+
+        if (memcmp(header.magic, MODEL_FILE_MAGIC, sizeof(header.magic)) != 0)
+        {
+            NBENE(("'%s' isn't a saved net.", filename));
+            return false;
+        }
+
+        if (header.version != MODEL_FILE_VERSION)
+        {
+            NBENE(("'%s' is of an unsupported version (%u).", filename, header.version));
+            return false;
+        }
+
+        if (header.scalarSize != sizeof(T))
+        {
+            NBENE(("'%s' holds a net in %s precision, but this net is in %s precision.", filename,
+                   ((header.scalarSize == sizeof(float))? "single" : "double"),
+                   ((sizeof(T) == sizeof(float))? "single" : "double")));
+            return false;
+        }
+
+        if (!header.numLayers ||
+            ((aligned_offset(sizeof(header)) + (u64(header.numLayers) * sizeof(model_file_layer_s))) > fileSize))
+        {
+            NBENE(("'%s' has a malformed layer table.", filename));
+            return false;
+        }
+    }
+
+    // Build the layers on top of the mapping, validating each as we go.
+    std::vector<neuron_layer_s<T>> newLayers(header.numLayers);
+    for (u32 i = 0; i < header.numLayers; i++)
+    {
+        model_file_layer_s info;
+        memcpy(&info, (contents + aligned_offset(sizeof(header)) + (i * sizeof(info))), sizeof(info));
+
+        const u64 numWeights = (u64(info.numNeurons) * info.weightStride);
+        const u32 expectedInputs = (i? newLayers.at(i-1).numNeurons : 0);
+
+        const bool isValid = (info.numNeurons &&
+                              (info.numInputs == expectedInputs) &&
+                              (info.weightStride == k_aligned_count<T>(info.numInputs)) &&
+                              (info.activationFunction <= u32(activation_function_e::softmax)) &&
+                              !(info.weightsOffset % K_BUFFER_ALIGNMENT) &&
+                              !(info.biasesOffset % K_BUFFER_ALIGNMENT) &&
+                              ((info.weightsOffset + (numWeights * sizeof(T))) <= fileSize) &&
+                              ((info.biasesOffset + (info.numNeurons * sizeof(T))) <= fileSize));
+
+        if (!isValid)
+        {
+            NBENE(("'%s' has a malformed description of layer #%u.", filename, (i + 1)));
+            return false;
+        }
+
+        auto &layer = newLayers.at(i);
+
+        layer.numNeurons = info.numNeurons;
+        layer.numInputs = info.numInputs;
+        layer.weightStride = info.weightStride;
+        layer.activationFunction = activation_function_e(info.activationFunction);
+        layer.activation = &kactivation_kernels<T>(layer.activationFunction);
+
+        layer.weights.wrap((T*)(contents + info.weightsOffset), numWeights);
+        layer.biases.wrap((T*)(contents + info.biasesOffset), info.numNeurons);
+    }
+
+    // Swap in the new layers, and rebuild the state that depends on their sizes.
+    this->layers.swap(newLayers);
+    this->mappedModel.swap(file);
+
+    this->context = this->make_inference_context();
+    this->deltas.clear();
+    for (const auto &layer: this->layers)
+    {
+        this->deltas.emplace_back(layer.numNeurons, 0);
+    }
+    this->batchWorkspaces.assign(this->batchWorkspaces.size(), batch_workspace_s<T>());
+
+    return true;
+}
+
+template bool nnetwork_c<float>::save(const char *const) const;
+template bool nnetwork_c<double>::save(const char *const) const;
+template bool nnetwork_c<float>::load(const char *const);
+template bool nnetwork_c<double>::load(const char *const);
@@ -0,0 +1,257 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * An int8 version of a trained neural network, for faster inference.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "../../src/nnetwork/quantized_nnetwork.h"
+#include "../../src/nnetwork/kernels/kernels.h"
+#include "../../src/nnetwork/nnetwork.h"
+
+// The largest quantized activation. Kept to 7 bits; see int8_kernels_s.
+static const i32 MAX_QUANTIZED_OUTPUT = 127;
+
+// The largest magnitude of a quantized weight. Symmetric, so that -128 never occurs.
+static const i32 MAX_QUANTIZED_WEIGHT = 127;
+
+// Quantizes the n values in src into dst, with the given scale and zero point.
+static void quantize_outputs(const float *src, const float scale, const i32 zeroPoint, u8 *dst, const uint n)
+{
+    const float inverseScale = (1 / scale);
+
+    // Rounds by truncating after adding 0.5; which for a negative sum would round the wrong
+    // way, but those get clamped to zero anyway.
+    const float offset = (zeroPoint + 0.5f);
+
+    for (uint i = 0; i < n; i++)
+    {
+        const i32 quantized = i32((src[i] * inverseScale) + offset);
+
+        dst[i] = u8(std::min(MAX_QUANTIZED_OUTPUT, std::max(0, quantized)));
+    }
+
+    return;
+}
+
+template <typename T>
+bool quantized_nnetwork_c::quantize(const nnetwork_c<T> &net, const std::vector<array_view_s<u8>> &calibrationInputs)
+{
+    if (net.num_layers() < 2)
+    {
+        NBENE(("Attempted to quantize a network that has no layers past the input layer; not allowing this."));
+        return false;
+    }
+
+    if (calibrationInputs.empty())
+    {
+        NBENE(("Expected a non-empty set of calibration inputs for quantization."));
+        return false;
+    }
+
+    // Find the range of each layer's outputs over the calibration inputs. The range always
+    // includes zero, so that zero is exactly representable.
+    std::vector<float> minOutputs(net.num_layers(), 0);
+    std::vector<float> maxOutputs(net.num_layers(), 0);
+    {
+        inference_context_s<T> context = net.make_inference_context();
+
+        for (const auto &input: calibrationInputs)
+        {
+            if (input.size() != net.layer(0).numNeurons)
+            {
+                NBENE(("Incompatible input layer for the given calibration inputs."));
+                return false;
+            }
+
+            net.propagate(context, input);
+
+            for (uint i = 0; i < net.num_layers(); i++)
+            {
+                const auto &outputs = context.outputs.at(i);
+                const auto range = std::minmax_element(outputs.begin(), outputs.end());
+
+                minOutputs.at(i) = std::min(minOutputs.at(i), float(*range.first));
+                maxOutputs.at(i) = std::max(maxOutputs.at(i), float(*range.second));
+            }
+        }
+    }
+
+    std::vector<quantized_layer_s> newLayers(net.num_layers());
+    for (uint i = 0; i < net.num_layers(); i++)
+    {
+        const neuron_layer_s<T> &srcLayer = net.layer(i);
+        quantized_layer_s &layer = newLayers.at(i);
+
+        layer.numNeurons = srcLayer.numNeurons;
+        layer.numInputs = srcLayer.numInputs;
+        layer.weightStride = k_aligned_count<i8>(srcLayer.numInputs);
+        layer.activationFunction = srcLayer.activationFunction;
+        layer.activation = &kactivation_kernels<float>(srcLayer.activationFunction);
+
+        const float outputRange = (maxOutputs.at(i) - minOutputs.at(i));
+        layer.outputScale = ((outputRange > 0)? (outputRange / MAX_QUANTIZED_OUTPUT) : 1);
+        layer.outputZeroPoint = i32(std::lrint(-minOutputs.at(i) / layer.outputScale));
+
+        layer.weights.resize(layer.numNeurons * layer.weightStride, 0);
+        layer.weightScales.resize(layer.numNeurons, 1);
+        layer.weightSums.resize(layer.numNeurons, 0);
+        layer.biases.resize(layer.numNeurons, 0);
+
+        // Quantize each neuron's weights symmetrically, with a scale that maps its largest
+        // weight to the edge of the range.
+        for (uint n = 0; n < layer.numNeurons; n++)
+        {
+            const T *const srcWeights = srcLayer.weights_of_neuron(n);
+            i8 *const weights = (layer.weights.data() + (n * layer.weightStride));
+
+            T maxWeight = 0;
+            for (uint w = 0; w < layer.numInputs; w++)
+            {
+                maxWeight = std::max(maxWeight, T(std::fabs(srcWeights[w])));
+            }
+
+            const float scale = ((maxWeight > 0)? (float(maxWeight) / MAX_QUANTIZED_WEIGHT) : 1);
+
+            for (uint w = 0; w < layer.numInputs; w++)
+            {
+                const i32 quantized = i32(std::lrint(srcWeights[w] / scale));
+
+                weights[w] = i8(std::min(MAX_QUANTIZED_WEIGHT, std::max(-MAX_QUANTIZED_WEIGHT, quantized)));
+                layer.weightSums.at(n) += weights[w];
+            }
+
+            layer.weightScales.at(n) = scale;
+            layer.biases.at(n) = float(srcLayer.biases[n]);
+        }
+    }
+
+    // The float net scales its byte inputs to 0..1; fold that into a lookup from the input
+    // bytes straight to the input layer's quantized values.
+    for (uint b = 0; b < 256; b++)
+    {
+        const float input = (b / 255.0f);
+        quantize_outputs(&input, newLayers.front().outputScale, newLayers.front().outputZeroPoint, &this->inputLookup[b], 1);
+    }
+
+    this->layers.swap(newLayers);
+
+    return true;
+}
+
+quantized_inference_context_s quantized_nnetwork_c::make_inference_context(void) const
+{
+    quantized_inference_context_s newContext;
+    uint maxNumNeurons = 0;
+
+    for (const auto &layer: this->layers)
+    {
+        newContext.quantizedOutputs.emplace_back(layer.numNeurons, 0);
+        maxNumNeurons = std::max(maxNumNeurons, layer.numNeurons);
+    }
+
+    newContext.outputs.resize(maxNumNeurons, 0);
+
+    return newContext;
+}
+
+void quantized_nnetwork_c::propagate(quantized_inference_context_s &context, const array_view_s<u8> input) const
+{
+    if (this->layers.empty() ||
+        (input.size() != this->layers.front().numNeurons) ||
+        (context.quantizedOutputs.size() != this->layers.size()))
+    {
+        NBENE(("Incompatible input layer or inference context for the given input."));
+        return;
+    }
+
+    const int8_kernels_s &kernels = kkernels_int8();
+
+    u8 *const inputs = context.quantizedOutputs.front().data();
+    for (uint i = 0; i < input.size(); i++)
+    {
+        inputs[i] = this->inputLookup[input[i]];
+    }
+
+    for (size_t i = 1; i < this->layers.size(); i++)
+    {
+        const quantized_layer_s &prevLayer = this->layers.at(i-1);
+        const quantized_layer_s &thisLayer = this->layers.at(i);
+        const u8 *const prevOutputs = context.quantizedOutputs.at(i-1).data();
+        float *const thisOutputs = context.outputs.data();
+
+        // Converts the integer dot product of the given neuron back into the scale of the float
+        // net, removing the contribution of the inputs' zero point on the way.
+        const auto neuron_sum = [&](const uint n, const i32 dot)
+        {
+            const i32 centered = (dot - (prevLayer.outputZeroPoint * thisLayer.weightSums[n]));
+
+            return (thisLayer.biases[n] + ((thisLayer.weightScales[n] * prevLayer.outputScale) * centered));
+        };
+
+        uint n = 0;
+        for (; (n + 4) <= thisLayer.numNeurons; n += 4)
+        {
+            i32 dots[4];
+            kernels.dot_x4(prevOutputs,
+                           thisLayer.weights_of_neuron(n),
+                           thisLayer.weights_of_neuron(n + 1),
+                           thisLayer.weights_of_neuron(n + 2),
+                           thisLayer.weights_of_neuron(n + 3),
+                           thisLayer.numInputs, dots);
+
+            for (uint d = 0; d < 4; d++)
+            {
+                thisOutputs[n + d] = neuron_sum((n + d), dots[d]);
+            }
+        }
+
+        // Any neurons left over.
+        for (; n < thisLayer.numNeurons; n++)
+        {
+            thisOutputs[n] = neuron_sum(n, kernels.dot(prevOutputs, thisLayer.weights_of_neuron(n), thisLayer.numInputs));
+        }
+
+        thisLayer.activation->forward(thisOutputs, thisLayer.numNeurons);
+
+        // Quantize the outputs for the next layer; the output layer's are left in float.
+        if ((i + 1) < this->layers.size())
+        {
+            quantize_outputs(thisOutputs, thisLayer.outputScale, thisLayer.outputZeroPoint,
+                             context.quantizedOutputs.at(i).data(), thisLayer.numNeurons);
+        }
+    }
+
+    return;
+}
+
+uint quantized_nnetwork_c::predict(quantized_inference_context_s &context, const array_view_s<u8> input) const
+{
+    this->propagate(context, input);
+
+    return this->strongest_output_neuron_idx(context);
+}
+
+uint quantized_nnetwork_c::strongest_output_neuron_idx(const quantized_inference_context_s &context) const
+{
+    const float *const outputs = context.outputs.data();
+
+    return (std::max_element(outputs, (outputs + this->layers.back().numNeurons)) - outputs);
+}
+
+size_t quantized_nnetwork_c::weight_bytes(void) const
+{
+    size_t numBytes = 0;
+
+    for (const auto &layer: this->layers)
+    {
+        numBytes += (layer.weights.size() * sizeof(i8));
+    }
+
+    return numBytes;
+}
+
+template bool quantized_nnetwork_c::quantize(const nnetwork_c<float>&, const std::vector<array_view_s<u8>>&);
+template bool quantized_nnetwork_c::quantize(const nnetwork_c<double>&, const std::vector<array_view_s<u8>>&);
@@ -0,0 +1,115 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * An int8 version of a trained neural network, for faster inference.
+ *
+ */
+
+#ifndef QUANTIZED_NNETWORK_H
+#define QUANTIZED_NNETWORK_H
+
+#include <vector>
+#include "../../src/memory/aligned_buffer.h"
+#include "../../src/memory/array_view.h"
+#include "../../src/nnetwork/kernels/activation_kernels.h"
+#include "../../src/common.h"
+
+template <typename T> class nnetwork_c;
+
+// A layer of the quantized net. The weights are stored as signed bytes, with a scale per
+// neuron (i.e. per row of the weight matrix) that maps them back to the original weights.
+// The layer's outputs are quantized into unsigned bytes for the next layer with a scale and
+// zero point shared by the whole layer, chosen from the range of outputs that the original
+// net produced on a set of calibration inputs:
+//
+//   weight = (weightScales[n] * quantizedWeight)
+//   output = (outputScale * (quantizedOutput - outputZeroPoint))
+//
+// The neurons' sums and activation functions are computed in float, from the integer dot
+// product of the quantized inputs and weights.
+struct quantized_layer_s
+{
+    uint numNeurons = 0;
+    uint numInputs = 0;
+
+    // The distance, in elements, between the starts of consecutive rows in the weight
+    // matrix. Padded up from the number of inputs so that each row begins on an aligned
+    // address.
+    uint weightStride = 0;
+
+    // The weight matrix, as in neuron_layer_s; quantized to -127..127.
+    aligned_buffer_c<i8> weights;
+
+    // The scale of each neuron's quantized weights.
+    std::vector<float> weightScales;
+
+    // The sum of each neuron's quantized weights; for subtracting out the zero point of the
+    // inputs from the dot product.
+    std::vector<i32> weightSums;
+
+    std::vector<float> biases;
+
+    // The scale and zero point of the layer's quantized outputs, which range from 0 to 127.
+    float outputScale = 1;
+    i32 outputZeroPoint = 0;
+
+    activation_function_e activationFunction = activation_function_e::none;
+    const activation_kernels_s<float> *activation = NULL;
+
+    const i8* weights_of_neuron(const uint neuronIdx) const { return (weights.data() + (neuronIdx * weightStride)); }
+};
+
+// Holds the state of one forward pass through a quantized net. Create with
+// quantized_nnetwork_c::make_inference_context().
+struct quantized_inference_context_s
+{
+    // The quantized outputs of each layer but the last. Element n holds the outputs of the
+    // nth layer's neurons.
+    std::vector<aligned_buffer_c<u8>> quantizedOutputs;
+
+    // The outputs of the most recently computed layer, in float; after a pass, those of
+    // the output layer.
+    aligned_buffer_c<float> outputs;
+};
+
+// A trained net converted for inference in 8-bit integer arithmetic; see quantize(). Takes
+// byte inputs, as the float net's u8 overloads do. Holds a quarter to an eighth of the
+// weight memory of the float net, and computes its dot products with the int8 kernels.
+class quantized_nnetwork_c
+{
+public:
+    // Replaces this net with a quantized copy of the given trained net. The range of each
+    // layer's outputs is calibrated by running the given inputs through the original net,
+    // so they should be representative of the data the net will see. Returns false on
+    // failure.
+    template <typename T>
+    bool quantize(const nnetwork_c<T> &net, const std::vector<array_view_s<u8>> &calibrationInputs);
+
+    // Returns a context for passing inputs through the net. As with the float net, any
+    // number of contexts can be in use at once.
+    quantized_inference_context_s make_inference_context(void) const;
+
+    // Sends the given input through the net, storing the outputs in the given context.
+    void propagate(quantized_inference_context_s &context, const array_view_s<u8> input) const;
+
+    // Sends the given input through the net, and returns the index in the output layer of
+    // the neuron that responded the strongest.
+    uint predict(quantized_inference_context_s &context, const array_view_s<u8> input) const;
+
+    float output_of_neuron(const quantized_inference_context_s &context, const uint outputNeuron) const { return context.outputs[outputNeuron]; }
+
+    uint strongest_output_neuron_idx(const quantized_inference_context_s &context) const;
+
+    // Returns the number of bytes that the net's weights take up.
+    size_t weight_bytes(void) const;
+
+    uint num_layers(void) const { return layers.size(); }
+
+private:
+    std::vector<quantized_layer_s> layers;
+
+    // Maps each possible input byte to its quantized value for the input layer.
+    u8 inputLookup[256];
+};
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * A counter-based random number generator (Philox4x32-10).
+ *
+ */
+
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <cmath>
+#include "../../src/common.h"
+
+// Generates random numbers with Philox4x32-10 (Salmon et al. 2011), which produces each
+// block of four 32-bit numbers as a function of a 64-bit key and a 128-bit counter, with
+// no state carried over from one block to the next. A generator can thus be created for
+// any point of any stream at no cost: e.g. one per neuron, keyed by the seed and with the
+// neuron's coordinates in the counter, so that the neurons can be initialized in any
+// order or in parallel and still come out the same for the same seed.
+class philox_rng_c
+{
+public:
+    // Creates a generator for the stream identified by the given key and stream index; the
+    // stream index takes up the upper 96 bits of the counter, and the lower 32 count the
+    // blocks generated within the stream.
+    philox_rng_c(const u64 key, const u32 stream0, const u32 stream1 = 0, const u32 stream2 = 0)
+    {
+        this->key[0] = u32(key);
+        this->key[1] = u32(key >> 32);
+
+        this->counter[0] = 0;
+        this->counter[1] = stream0;
+        this->counter[2] = stream1;
+        this->counter[3] = stream2;
+
+        return;
+    }
+
+    // Returns a uniformly distributed 32-bit integer.
+    u32 next_u32(void)
+    {
+        if (this->numUnused == 0)
+        {
+            this->generate_block();
+        }
+
+        return this->block[4 - this->numUnused--];
+    }
+
+    // Returns a uniformly distributed number in the range (0, 1].
+    double next_uniform(void)
+    {
+        return ((this->next_u32() + 1.0) / 4294967296.0);
+    }
+
+    // Returns a number from the standard normal distribution (mean 0, standard deviation 1),
+    // by the Box-Muller transform.
+    double next_normal(void)
+    {
+        if (this->hasSpareNormal)
+        {
+            this->hasSpareNormal = false;
+            return this->spareNormal;
+        }
+
+        const double radius = std::sqrt(-2 * std::log(this->next_uniform()));
+        const double angle = (6.283185307179586 * this->next_uniform());
+
+        this->spareNormal = (radius * std::sin(angle));
+        this->hasSpareNormal = true;
+
+        return (radius * std::cos(angle));
+    }
+
+private:
+    // Fills the block with the output of the current counter, and advances the counter.
+    void generate_block(void)
+    {
+        const u32 M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+        const u32 W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+
+        u32 c[4] = {this->counter[0], this->counter[1], this->counter[2], this->counter[3]};
+        u32 k[2] = {this->key[0], this->key[1]};
+
+        for (uint round = 0; round < 10; round++)
+        {
+            const u64 product0 = (u64(M0) * c[0]);
+            const u64 product1 = (u64(M1) * c[2]);
+
+            const u32 next[4] = {(u32(product1 >> 32) ^ c[1] ^ k[0]), u32(product1),
+                                 (u32(product0 >> 32) ^ c[3] ^ k[1]), u32(product0)};
+
+            c[0] = next[0]; c[1] = next[1]; c[2] = next[2]; c[3] = next[3];
+
+            k[0] += W0;
+            k[1] += W1;
+        }
+
+        this->block[0] = c[0]; this->block[1] = c[1]; this->block[2] = c[2]; this->block[3] = c[3];
+        this->numUnused = 4;
+
+        this->counter[0]++;
+
+        return;
+    }
+
+    u32 key[2];
+    u32 counter[4];
+
+    // The most recently generated block, of which the last numUnused elements have yet to be
+    // handed out.
+    u32 block[4];
+    uint numUnused = 0;
+
+    // The Box-Muller transform produces normals in pairs; the second is kept for the next call.
+    double spareNormal = 0;
+    bool hasSpareNormal = false;
+};
+
+#endif
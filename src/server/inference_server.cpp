@@ -0,0 +1,493 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * Serves a trained net's predictions to other processes, batching concurrent requests together.
+ *
+ */
+
+#include <condition_variable>
+#include <algorithm>
+#include <iterator>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <cstring>
+#include <cstdio>
+#include "../../src/server/inference_server.h"
+#include "../../src/nnetwork/nnetwork.h"
+
+#ifdef _WIN32
+
+template <typename T>
+bool kserver_run(const nnetwork_c<T>&, const char *const, const uint, const uint)
+{
+    NBENE(("The inference server isn't supported on this platform."));
+    return false;
+}
+
+void kserver_claim_stdout(void)
+{
+    return;
+}
+
+#else
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cerrno>
+
+// The file descriptor that the replies to a stdin/stdout client are written to; the original
+// stdout, if it's been claimed by kserver_claim_stdout().
+static int stdoutReplyFd = STDOUT_FILENO;
+
+// Reads exactly the given number of bytes from the given file descriptor. Returns false if the
+// stream ended or failed before then.
+static bool read_bytes(const int fd, void *const dst, size_t numBytes)
+{
+    u8 *p = (u8*)dst;
+
+    while (numBytes)
+    {
+        const ssize_t numRead = ::read(fd, p, numBytes);
+
+        if ((numRead < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+
+        if (numRead <= 0)
+        {
+            return false;
+        }
+
+        p += numRead;
+        numBytes -= numRead;
+    }
+
+    return true;
+}
+
+// Writes all of the given bytes into the given file descriptor. Returns false on failure.
+static bool write_bytes(const int fd, const void *const src, size_t numBytes)
+{
+    const u8 *p = (const u8*)src;
+
+    while (numBytes)
+    {
+        const ssize_t numWritten = ::write(fd, p, numBytes);
+
+        if ((numWritten < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+
+        if (numWritten <= 0)
+        {
+            return false;
+        }
+
+        p += numWritten;
+        numBytes -= numWritten;
+    }
+
+    return true;
+}
+
+// A client of the server: a socket connection, or stdin and stdout.
+struct server_client_s
+{
+    int inFd = -1;
+    int outFd = -1;
+
+    // Whether the file descriptors belong to the client (i.e. it's a socket), and are to be closed
+    // once the client is done with.
+    bool ownsFds = false;
+
+    // Held while writing to the client, so that the client's replies don't interleave.
+    std::mutex writeMutex;
+
+    ~server_client_s()
+    {
+        if (this->ownsFds)
+        {
+            ::close(this->inFd);
+        }
+
+        return;
+    }
+};
+
+// A client's request, waiting to be batched.
+struct server_request_s
+{
+    std::shared_ptr<server_client_s> client;
+    u32 id = 0;
+    std::vector<u8> input;
+    std::chrono::steady_clock::time_point arrivalTime;
+};
+
+// Gathers the requests coming in from any number of clients into batches for the net. Each
+// client is read by its own thread, which queues the client's requests; the batching loop takes
+// them off the queue a batch at a time, and replies to each request once its batch has been
+// through the net. The replies refer to their clients by shared pointer, so a client that
+// disconnects while its requests are in flight stays around until they've been answered.
+template <typename T>
+class inference_server_c
+{
+public:
+    inference_server_c(const nnetwork_c<T> &net, const uint maxBatchSize, const uint maxWaitMs);
+
+    // Starts a thread that reads the given client's requests into the queue until the client
+    // disconnects.
+    std::thread serve_client(std::shared_ptr<server_client_s> client);
+
+    // Takes the queued requests a batch at a time, runs them through the net and sends out the
+    // replies. Returns once no more requests can arrive; i.e. once close_input() has been called,
+    // all of the clients have disconnected, and the queue is empty.
+    void run_batches(void);
+
+    // Tells the batching loop that no more clients will be served.
+    void close_input(void);
+
+    u64 num_requests_served(void) const { return numRequestsServed; }
+    u64 num_batches_served(void) const { return numBatchesServed; }
+
+private:
+    // The loop of a client's reader thread.
+    void read_requests(std::shared_ptr<server_client_s> client);
+
+    // Runs the given requests through the net as a batch, and replies to them.
+    void run_batch(const std::vector<server_request_s> &batch);
+
+    const nnetwork_c<T> &net;
+    const uint maxBatchSize;
+    const std::chrono::milliseconds maxWait;
+
+    const uint numInputs;
+    const uint numOutputs;
+
+    std::mutex mutex;
+    std::condition_variable queueChanged;
+
+    // Guarded by the mutex.
+    std::deque<server_request_s> queue;
+    std::vector<std::vector<u8>> spareInputs;
+    uint numActiveClients = 0;
+    bool inputClosed = false;
+
+    // Used by the batching loop only.
+    batch_workspace_s<T> workspace;
+    std::vector<array_view_s<u8>> batchInputs;
+    std::vector<u8> reply;
+    u64 numRequestsServed = 0;
+    u64 numBatchesServed = 0;
+};
+
+template <typename T>
+inference_server_c<T>::inference_server_c(const nnetwork_c<T> &net, const uint maxBatchSize, const uint maxWaitMs) :
+    net(net),
+    maxBatchSize(std::max(1u, maxBatchSize)),
+    maxWait(maxWaitMs),
+    numInputs(net.num_neurons_in_layer(0)),
+    numOutputs(net.num_neurons_in_layer(net.num_layers() - 1))
+{
+    this->reply.resize((2 * sizeof(u32)) + (this->numOutputs * sizeof(float)));
+
+    return;
+}
+
+template <typename T>
+std::thread inference_server_c<T>::serve_client(std::shared_ptr<server_client_s> client)
+{
+    // Counted here rather than by the thread, so that the batching loop can't see the client as
+    // having finished before its thread has started.
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->numActiveClients++;
+    }
+
+    return std::thread(&inference_server_c<T>::read_requests, this, client);
+}
+
+template <typename T>
+void inference_server_c<T>::close_input(void)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    this->inputClosed = true;
+    this->queueChanged.notify_all();
+
+    return;
+}
+
+template <typename T>
+void inference_server_c<T>::read_requests(std::shared_ptr<server_client_s> client)
+{
+    const u32 hello[2] = {this->numInputs, this->numOutputs};
+    bool clientOk = false;
+    {
+        std::lock_guard<std::mutex> lock(client->writeMutex);
+        clientOk = write_bytes(client->outFd, hello, sizeof(hello));
+    }
+
+    while (clientOk)
+    {
+        // Reuse the input buffer of an answered request, if there's one, rather than allocate a new one for each request.
+        server_request_s request;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+
+            if (!this->spareInputs.empty())
+            {
+                request.input = std::move(this->spareInputs.back());
+                this->spareInputs.pop_back();
+            }
+        }
+
+        request.input.resize(this->numInputs);
+
+        if (!read_bytes(client->inFd, &request.id, sizeof(request.id)) ||
+            !read_bytes(client->inFd, request.input.data(), request.input.size()))
+        {
+            break;
+        }
+
+        request.client = client;
+        request.arrivalTime = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->queue.push_back(std::move(request));
+        this->queueChanged.notify_all();
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->numActiveClients--;
+    this->queueChanged.notify_all();
+
+    return;
+}
+
+template <typename T>
+void inference_server_c<T>::run_batches(void)
+{
+    std::vector<server_request_s> batch;
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    const auto no_more_requests = [&]{ return (this->inputClosed && !this->numActiveClients); };
+
+    while (true)
+    {
+        this->queueChanged.wait(lock, [&]{ return (!this->queue.empty() || no_more_requests()); });
+
+        if (this->queue.empty())
+        {
+            break;
+        }
+
+        // Give the batch until the oldest request has waited for the maximum time to fill up.
+        const auto deadline = (this->queue.front().arrivalTime + this->maxWait);
+        this->queueChanged.wait_until(lock, deadline, [&]{ return ((this->queue.size() >= this->maxBatchSize) || no_more_requests()); });
+
+        const size_t batchSize = std::min(this->queue.size(), size_t(this->maxBatchSize));
+        batch.assign(std::make_move_iterator(this->queue.begin()), std::make_move_iterator(this->queue.begin() + batchSize));
+        this->queue.erase(this->queue.begin(), (this->queue.begin() + batchSize));
+
+        // Let the clients keep queuing requests while this batch is in the net.
+        lock.unlock();
+        this->run_batch(batch);
+        lock.lock();
+
+        for (auto &request: batch)
+        {
+            this->spareInputs.push_back(std::move(request.input));
+        }
+
+        batch.clear();
+    }
+
+    return;
+}
+
+template <typename T>
+void inference_server_c<T>::run_batch(const std::vector<server_request_s> &batch)
+{
+    this->batchInputs.resize(batch.size());
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        this->batchInputs.at(i) = batch.at(i).input;
+    }
+
+    this->net.propagate_batch(this->workspace, this->batchInputs);
+
+    for (uint i = 0; i < batch.size(); i++)
+    {
+        const server_request_s &request = batch.at(i);
+
+        const u32 predictedClass = this->net.strongest_output_neuron_idx(this->workspace, i);
+        memcpy(this->reply.data(), &request.id, sizeof(u32));
+        memcpy((this->reply.data() + sizeof(u32)), &predictedClass, sizeof(u32));
+
+        for (uint o = 0; o < this->numOutputs; o++)
+        {
+            const float score = this->net.output_of_neuron(this->workspace, i, o);
+            memcpy((this->reply.data() + (2 * sizeof(u32)) + (o * sizeof(float))), &score, sizeof(float));
+        }
+
+        // A client that has disconnected doesn't get its replies, but there's nothing else to do about it.
+        std::lock_guard<std::mutex> lock(request.client->writeMutex);
+        write_bytes(request.client->outFd, this->reply.data(), this->reply.size());
+    }
+
+    this->numRequestsServed += batch.size();
+    this->numBatchesServed++;
+
+    return;
+}
+
+// Opens a Unix domain socket at the given path for listening. Returns its file descriptor, or -1
+// on failure.
+static int open_listening_socket(const char *const path)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        NBENE(("The socket path '%s' is too long.", path));
+        return -1;
+    }
+
+    strcpy(address.sun_path, path);
+
+    // Replace the socket of any previous run, but nothing else that happens to be at the path.
+    struct stat fileInfo;
+    if (stat(path, &fileInfo) == 0)
+    {
+        if (!S_ISSOCK(fileInfo.st_mode))
+        {
+            NBENE(("'%s' already exists, and isn't a socket.", path));
+            return -1;
+        }
+
+        unlink(path);
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        NBENE(("Failed to create a socket."));
+        return -1;
+    }
+
+    if ((bind(fd, (const sockaddr*)&address, sizeof(address)) != 0) ||
+        (listen(fd, SOMAXCONN) != 0))
+    {
+        ::close(fd);
+        NBENE(("Failed to listen on '%s'.", path));
+        return -1;
+    }
+
+    return fd;
+}
+
+template <typename T>
+bool kserver_run(const nnetwork_c<T> &net, const char *const address, const uint maxBatchSize, const uint maxWaitMs)
+{
+    if (net.num_layers() < 2)
+    {
+        NBENE(("Attempted to serve a network that has no layers past the input layer; not allowing this."));
+        return false;
+    }
+
+    // Clients that disconnect mid-reply shouldn't bring down the server.
+    signal(SIGPIPE, SIG_IGN);
+
+    inference_server_c<T> server(net, maxBatchSize, maxWaitMs);
+
+    if (strcmp(address, "-") == 0)
+    {
+        std::shared_ptr<server_client_s> client(new server_client_s);
+        client->inFd = STDIN_FILENO;
+        client->outFd = stdoutReplyFd;
+
+        printf("Serving on stdin/stdout (batches of up to %u, waiting up to %u ms)...\n", maxBatchSize, maxWaitMs);
+        fflush(stdout);
+
+        std::thread reader = server.serve_client(client);
+        server.close_input();
+        server.run_batches();
+        reader.join();
+    }
+    else
+    {
+        const int listenFd = open_listening_socket(address);
+        if (listenFd < 0)
+        {
+            return false;
+        }
+
+        printf("Serving on '%s' (batches of up to %u, waiting up to %u ms)...\n", address, maxBatchSize, maxWaitMs);
+        fflush(stdout);
+
+        std::thread acceptor([&]
+        {
+            while (true)
+            {
+                const int clientFd = accept(listenFd, NULL, NULL);
+
+                if (clientFd < 0)
+                {
+                    if ((errno == EINTR) || (errno == ECONNABORTED))
+                    {
+                        continue;
+                    }
+
+                    NBENE(("Failed to accept a connection on '%s'; no longer accepting any.", address));
+                    break;
+                }
+
+                std::shared_ptr<server_client_s> client(new server_client_s);
+                client->inFd = clientFd;
+                client->outFd = clientFd;
+                client->ownsFds = true;
+
+                server.serve_client(client).detach();
+            }
+
+            server.close_input();
+        });
+
+        server.run_batches();
+        acceptor.join();
+
+        ::close(listenFd);
+        unlink(address);
+    }
+
+    printf("Served %llu requests in %llu batches.\n",
+           (unsigned long long)server.num_requests_served(), (unsigned long long)server.num_batches_served());
+
+    return true;
+}
+
+void kserver_claim_stdout(void)
+{
+    fflush(stdout);
+
+    stdoutReplyFd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    return;
+}
+
+#endif
+
+template bool kserver_run(const nnetwork_c<float>&, const char *const, const uint, const uint);
+template bool kserver_run(const nnetwork_c<double>&, const char *const, const uint, const uint);
@@ -0,0 +1,40 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * Serves a trained net's predictions to other processes, batching concurrent requests together.
+ *
+ */
+
+#ifndef INFERENCE_SERVER_H
+#define INFERENCE_SERVER_H
+
+#include "../../src/common.h"
+
+template <typename T> class nnetwork_c;
+
+// The protocol, with all values in the host's byte order:
+//
+//   - on connecting, the server sends the client two u32s: the number of inputs the net takes
+//     (i.e. the size of its input layer), and the number of outputs it gives;
+//   - a request is a u32 id of the client's choosing, followed by one byte (0..255) per input;
+//   - for each request, the server replies with the request's id as a u32, the index of the
+//     strongest output neuron as a u32, and then the value of each output neuron as a float.
+//
+// A client may send any number of requests without waiting for the replies. Replies to a given
+// client's requests are sent in the order the requests were received.
+
+// Listens for clients on the Unix domain socket at the given path; or, if the path is "-", serves
+// a single client on stdin and stdout. Requests that arrive close together are gathered into a
+// batch of up to maxBatchSize requests, waiting at most maxWaitMs milliseconds from the first
+// request's arrival for the batch to fill, and each batch is then run through the net in one
+// batched forward pass. In socket mode, serves until the process is terminated; in stdin/stdout
+// mode, until stdin is closed. Returns false on failure.
+template <typename T>
+bool kserver_run(const nnetwork_c<T> &net, const char *const address, const uint maxBatchSize, const uint maxWaitMs);
+
+// Claims stdout for the server's replies, redirecting the program's other output (prints, error
+// messages) to stderr. To be called before anything is printed, if the server is going to be run
+// on stdin and stdout.
+void kserver_claim_stdout(void);
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * A lock-free queue between one producer thread and one consumer thread.
+ *
+ */
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <vector>
+#include "../../src/memory/aligned_buffer.h"
+#include "../../src/common.h"
+
+// A fixed-capacity ring of T's, into which one thread pushes and out of which another pops,
+// without locks: each side only writes its own index, and reads the other's with acquire
+// semantics to see the elements it published. Neither side ever blocks; a push into a full
+// queue or a pop from an empty one just returns false, and it's up to the caller to decide
+// how to wait.
+template <typename T>
+class spsc_queue_c
+{
+public:
+    // The queue holds up to the given number of elements at a time.
+    spsc_queue_c(const uint capacity) :
+        elements(capacity + 1)
+    {
+        this->head.store(0, std::memory_order_relaxed);
+        this->tail.store(0, std::memory_order_relaxed);
+
+        return;
+    }
+
+    // Appends the given element to the queue. Returns false if the queue is full. To be
+    // called only by the producer thread.
+    bool try_push(const T &element)
+    {
+        const size_t tailIdx = this->tail.load(std::memory_order_relaxed);
+        const size_t nextTailIdx = ((tailIdx + 1) % this->elements.size());
+
+        if (nextTailIdx == this->head.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        this->elements[tailIdx] = element;
+        this->tail.store(nextTailIdx, std::memory_order_release);
+
+        return true;
+    }
+
+    // Removes the oldest element from the queue into the given one. Returns false if the
+    // queue is empty. To be called only by the consumer thread.
+    bool try_pop(T *const element)
+    {
+        const size_t headIdx = this->head.load(std::memory_order_relaxed);
+
+        if (headIdx == this->tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        *element = this->elements[headIdx];
+        this->head.store(((headIdx + 1) % this->elements.size()), std::memory_order_release);
+
+        return true;
+    }
+
+private:
+    // One slot more than the capacity, so that a full queue can be told apart from an
+    // empty one.
+    std::vector<T> elements;
+
+    // The index of the oldest element, written by the consumer; and of the slot after the
+    // newest, written by the producer. On cache lines of their own, so that the two threads
+    // don't contend for the line each time the other one moves its index.
+    alignas(K_BUFFER_ALIGNMENT) std::atomic<size_t> head;
+    alignas(K_BUFFER_ALIGNMENT) std::atomic<size_t> tail;
+};
+
+#endif
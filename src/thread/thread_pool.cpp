@@ -0,0 +1,121 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * A fixed set of worker threads for running tasks in parallel.
+ *
+ */
+
+#include "../../src/thread/thread_pool.h"
+
+thread_pool_c::thread_pool_c(const uint numThreads) :
+    nextTaskIdx(0)
+{
+    for (uint i = 1; i < numThreads; i++)
+    {
+        this->workers.emplace_back(&thread_pool_c::worker_loop, this);
+    }
+
+    return;
+}
+
+thread_pool_c::~thread_pool_c()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->shuttingDown = true;
+    }
+
+    this->jobAvailable.notify_all();
+
+    for (auto &worker: this->workers)
+    {
+        worker.join();
+    }
+
+    return;
+}
+
+uint thread_pool_c::num_threads(void) const
+{
+    return (this->workers.size() + 1);
+}
+
+void thread_pool_c::run_tasks(void)
+{
+    uint taskIdx = 0;
+    while ((taskIdx = this->nextTaskIdx.fetch_add(1)) < this->numTasks)
+    {
+        this->task.call(this->task.function, taskIdx);
+    }
+
+    return;
+}
+
+void thread_pool_c::run_job(const uint numTasks, const task_ref_s &task)
+{
+    // With no other threads to share the work with, skip the synchronization.
+    if (this->workers.empty() || (numTasks <= 1))
+    {
+        for (uint i = 0; i < numTasks; i++)
+        {
+            task.call(task.function, i);
+        }
+
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        this->task = task;
+        this->numTasks = numTasks;
+        this->nextTaskIdx = 0;
+        this->numBusyWorkers = this->workers.size();
+        this->jobId++;
+    }
+
+    this->jobAvailable.notify_all();
+
+    this->run_tasks();
+
+    // Wait for the workers to finish any tasks they picked up.
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->jobFinished.wait(lock, [this]{ return (this->numBusyWorkers == 0); });
+
+        this->task = {NULL, NULL};
+    }
+
+    return;
+}
+
+void thread_pool_c::worker_loop(void)
+{
+    u64 lastJobId = 0;
+
+    while (1)
+    {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->jobAvailable.wait(lock, [&]{ return (this->shuttingDown || (this->jobId != lastJobId)); });
+
+            if (this->shuttingDown)
+            {
+                return;
+            }
+
+            lastJobId = this->jobId;
+        }
+
+        this->run_tasks();
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+
+            if (--this->numBusyWorkers == 0)
+            {
+                this->jobFinished.notify_one();
+            }
+        }
+    }
+}
@@ -0,0 +1,83 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * A fixed set of worker threads for running tasks in parallel.
+ *
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include "../../src/common.h"
+
+class thread_pool_c
+{
+public:
+    // Creates a pool of the given number of threads, including the calling thread;
+    // i.e. numThreads - 1 worker threads are spawned.
+    thread_pool_c(const uint numThreads);
+    ~thread_pool_c();
+
+    // Calls the given function once for each task index in 0..(numTasks - 1), spread
+    // across the pool's threads (the calling thread among them), and returns once all
+    // of the calls have finished. Not to be called from within a task. The function is
+    // called through a reference rather than wrapped in a std::function, which would
+    // have to allocate for lambdas that capture more than a pointer or two.
+    template <typename F>
+    void run(const uint numTasks, const F &task)
+    {
+        const task_ref_s taskRef = {&task, [](const void *const function, const uint taskIdx)
+        {
+            (*static_cast<const F*>(function))(taskIdx);
+        }};
+
+        this->run_job(numTasks, taskRef);
+
+        return;
+    }
+
+    uint num_threads(void) const;
+
+private:
+    // A reference to a function to be called for each task index; see run().
+    struct task_ref_s
+    {
+        const void *function;
+        void (*call)(const void *const function, const uint taskIdx);
+    };
+
+    // Runs the given job; see run().
+    void run_job(const uint numTasks, const task_ref_s &task);
+
+    // The loop that each worker thread runs until the pool is destroyed.
+    void worker_loop(void);
+
+    // Runs tasks of the current job until there are none left.
+    void run_tasks(void);
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::condition_variable jobFinished;
+
+    // The current job.
+    task_ref_s task = {NULL, NULL};
+    uint numTasks = 0;
+    std::atomic<uint> nextTaskIdx;
+
+    // Incremented for each new job, so that the workers can tell when a job is new.
+    u64 jobId = 0;
+
+    // The number of worker threads that are still working on the current job.
+    uint numBusyWorkers = 0;
+
+    bool shuttingDown = false;
+};
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * Scoped timers that accumulate the time spent in each phase of training.
+ *
+ */
+
+#include <atomic>
+#include "../../src/timer/phase_timer.h"
+
+// The accumulated time of each phase, in nanoseconds.
+static std::atomic<u64> phaseNanoseconds[uint(timer_phase_e::count)];
+
+const char* kphase_timer_name(const timer_phase_e phase)
+{
+    switch (phase)
+    {
+        case timer_phase_e::validation:     return "validation";
+        case timer_phase_e::batch_wait:     return "batch_wait";
+        case timer_phase_e::training:       return "training";
+        case timer_phase_e::accuracy:       return "accuracy";
+        case timer_phase_e::load_batch:     return "load_batch";
+        case timer_phase_e::forward:        return "forward";
+        case timer_phase_e::back:           return "back";
+        case timer_phase_e::loss:           return "loss";
+        case timer_phase_e::update:         return "update";
+        case timer_phase_e::reduce:         return "reduce";
+        case timer_phase_e::batch_prep:     return "batch_prep";
+        default: return "unknown";
+    }
+}
+
+bool kphase_timers_enabled(void)
+{
+    #ifdef LIMPYNET_PHASE_TIMERS
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+void kphase_timer_add(const timer_phase_e phase, const u64 nanoseconds)
+{
+    phaseNanoseconds[uint(phase)].fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    return;
+}
+
+double kphase_timer_seconds(const timer_phase_e phase)
+{
+    return (phaseNanoseconds[uint(phase)].load(std::memory_order_relaxed) / 1e9);
+}
+
+void kphase_timers_reset(void)
+{
+    for (auto &nanoseconds: phaseNanoseconds)
+    {
+        nanoseconds.store(0, std::memory_order_relaxed);
+    }
+
+    return;
+}
@@ -0,0 +1,92 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * Scoped timers that accumulate the time spent in each phase of training.
+ *
+ */
+
+#ifndef PHASE_TIMER_H
+#define PHASE_TIMER_H
+
+#include <chrono>
+#include "../../src/common.h"
+
+// The phases of training whose time is accumulated. The first few are the stages of an
+// epoch, timed on the thread that runs the epoch loop; the next are the stages of a
+// training step, timed on whichever threads run them, so that with several training
+// threads, their times add up to more than the time the step took. The last is timed on
+// the data pipeline's thread, alongside the others.
+enum class timer_phase_e
+{
+    // Stages of an epoch.
+    validation = 0,
+    batch_wait,
+    training,
+    accuracy,
+
+    // Stages of a training step.
+    load_batch,
+    forward,
+    back,
+    loss,
+    update,
+    reduce,
+
+    // Stages of the data pipeline.
+    batch_prep,
+
+    count
+};
+
+// Returns the name of the given phase, e.g. for printing.
+const char* kphase_timer_name(const timer_phase_e phase);
+
+// Returns true if the timers have been compiled in (see below).
+bool kphase_timers_enabled(void);
+
+// Adds the given number of nanoseconds to the given phase's time. Safe to call from several
+// threads at once.
+void kphase_timer_add(const timer_phase_e phase, const u64 nanoseconds);
+
+// Returns the time, in seconds, spent in the given phase since the timers were last reset.
+double kphase_timer_seconds(const timer_phase_e phase);
+
+// Zeroes the time of each phase.
+void kphase_timers_reset(void);
+
+// Adds the time from its creation to its destruction to the given phase.
+class scoped_phase_timer_c
+{
+public:
+    scoped_phase_timer_c(const timer_phase_e phase) :
+        phase(phase),
+        startTime(std::chrono::steady_clock::now())
+    {
+        return;
+    }
+
+    ~scoped_phase_timer_c()
+    {
+        const auto elapsed = (std::chrono::steady_clock::now() - this->startTime);
+        kphase_timer_add(this->phase, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+
+        return;
+    }
+
+private:
+    const timer_phase_e phase;
+    const std::chrono::steady_clock::time_point startTime;
+};
+
+// Times the rest of the enclosing scope as part of the given phase. The timers are only
+// compiled in if LIMPYNET_PHASE_TIMERS is defined (see limpynet.pro); otherwise, this
+// expands to nothing.
+#ifdef LIMPYNET_PHASE_TIMERS
+    #define K_PHASE_TIMER_NAME_(line) phaseTimer_##line
+    #define K_PHASE_TIMER_NAME(line) K_PHASE_TIMER_NAME_(line)
+    #define K_TIME_PHASE(phase) const scoped_phase_timer_c K_PHASE_TIMER_NAME(__LINE__)(phase)
+#else
+    #define K_TIME_PHASE(phase)
+#endif
+
+#endif
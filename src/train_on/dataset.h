@@ -0,0 +1,49 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * An interface to sets of labeled training samples, however they're stored.
+ *
+ */
+
+#ifndef DATASET_H
+#define DATASET_H
+
+#include "../../src/random/philox.h"
+#include "../../src/common.h"
+
+// A set of labeled samples to train on, each a fixed-size grid of bytes (e.g. an image's
+// pixels), that's gone through an epoch at a time in a shuffled order. How the samples are
+// stored, and how thoroughly they get shuffled, is up to the implementation: e.g. a set held
+// in memory can be shuffled as a whole, whereas one streamed from disk can only be shuffled a
+// part at a time. Cf. mnist_dataset_c and streaming_dataset_c.
+//
+// Any randomness that an implementation needs, it draws from the random numbers it's given,
+// so that the same seed gives the same order.
+class dataset_c
+{
+public:
+    virtual ~dataset_c() {}
+
+    // The number of samples in the set; i.e. in each epoch.
+    virtual uint num_samples(void) const = 0;
+
+    // The shape of each sample, as rows x cols bytes.
+    virtual uint sample_rows(void) const = 0;
+    virtual uint sample_cols(void) const = 0;
+
+    uint sample_size(void) const { return (this->sample_rows() * this->sample_cols()); }
+
+    // Starts a new epoch, in an order drawn from the given random numbers. Any samples left
+    // over from the previous epoch are dropped.
+    virtual void begin_epoch(philox_rng_c &randomNumbers) = 0;
+
+    // Copies the epoch's next samples, up to maxSamples of them, into the given arrays: their
+    // bytes one sample after the other into samples, and their labels into labels. Returns
+    // the number of samples copied, which is less than maxSamples only once the epoch has run
+    // out of samples; so that over an epoch, each batch but the last comes out full. A set that
+    // fails to get at its samples (e.g. on a read error) reports the error and returns 0.
+    virtual uint fetch_batch(u8 *const samples, uint *const labels, const uint maxSamples,
+                             philox_rng_c &randomNumbers) = 0;
+};
+
+#endif
@@ -0,0 +1,233 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * Prepares batches of MNIST training samples on a background thread.
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include "../../src/train_on/mnist/mnist_batch_pipeline.h"
+#include "../../src/timer/phase_timer.h"
+
+// How many samples' worth of batches the ring holds, at least; and how many batches, at least. The
+// pipeline can get this far ahead of the trainer. Sized in samples rather than in batches, so that
+// with small batches, which the trainer goes through quickly, the ring is deep enough for the
+// pipeline to fill a run of batches each time it gets to run.
+static const uint MIN_RING_SAMPLES = 256;
+static const uint MIN_RING_BATCHES = 4;
+
+// The last word of the pipeline's Philox stream indices; sets them apart from the streams that
+// the net initializes its weights from with the same seed (cf. nnetwork_c::add_layer()).
+static const u32 PIPELINE_STREAM = 1;
+
+// Returns the number of batches of the given size to put in the ring.
+static uint num_ring_batches(const uint batchSize)
+{
+    return std::max(MIN_RING_BATCHES, ((MIN_RING_SAMPLES + batchSize - 1) / batchSize));
+}
+
+mnist_batch_pipeline_c::mnist_batch_pipeline_c(dataset_c &dataset, const uint batchSize, const uint numEpochs,
+                                               const u64 seed, const uint maxShift) :
+    dataset(dataset),
+    batchSize(std::max(1u, batchSize)),
+    numEpochs(numEpochs),
+    seed(seed),
+    maxShift(maxShift),
+    batches(num_ring_batches(this->batchSize)),
+    filledBatches(this->batches.size()),
+    freeBatches(this->batches.size())
+{
+    const uint imageSize = dataset.sample_size();
+
+    for (uint i = 0; i < this->batches.size(); i++)
+    {
+        mnist_batch_s &batch = this->batches.at(i);
+
+        batch.pixels.resize(this->batchSize * imageSize);
+        batch.images.reserve(this->batchSize);
+        batch.labels.reserve(this->batchSize);
+
+        this->freeBatches.try_push(i);
+    }
+
+    this->numFreeBatches.store(this->batches.size());
+
+    this->fetchedImages.resize(this->batchSize * imageSize);
+    this->fetchedLabels.resize(this->batchSize);
+
+    this->stopping.store(false);
+    this->producer = std::thread(&mnist_batch_pipeline_c::producer_loop, this);
+
+    return;
+}
+
+mnist_batch_pipeline_c::~mnist_batch_pipeline_c()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->releaseMutex);
+        this->stopping.store(true);
+    }
+
+    this->batchReleased.notify_one();
+    this->producer.join();
+
+    return;
+}
+
+uint mnist_batch_pipeline_c::batches_per_epoch(void) const
+{
+    return ((this->dataset.num_samples() + this->batchSize - 1) / this->batchSize);
+}
+
+const mnist_batch_s& mnist_batch_pipeline_c::next_batch(void)
+{
+    k_assert((this->currentBatchIdx < 0), "Expected the previous batch to have been released.");
+
+    // The trainer is idle until the batch arrives, so rather than sleep, keep checking; but
+    // let other threads run in the meantime.
+    uint batchIdx = 0;
+    while (!this->filledBatches.try_pop(&batchIdx))
+    {
+        std::this_thread::yield();
+    }
+
+    this->currentBatchIdx = batchIdx;
+
+    return this->batches.at(batchIdx);
+}
+
+void mnist_batch_pipeline_c::release_batch(void)
+{
+    k_assert((this->currentBatchIdx >= 0), "Expected a batch to release.");
+
+    // The free queue has room for every batch, so this can't fail.
+    this->freeBatches.try_push(this->currentBatchIdx);
+    this->currentBatchIdx = -1;
+
+    // Wake the pipeline once half of the ring is free, in case it's waiting; so that it fills a
+    // run of batches each time it wakes, rather than switch in for every batch. Taking the mutex
+    // after the count is raised means that the pipeline either sees the count before it starts
+    // waiting, or gets the signal.
+    if (++this->numFreeBatches == this->wake_threshold())
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->releaseMutex);
+        }
+
+        this->batchReleased.notify_one();
+    }
+
+    return;
+}
+
+int mnist_batch_pipeline_c::wake_threshold(void) const
+{
+    return ((this->batches.size() + 1) / 2);
+}
+
+void mnist_batch_pipeline_c::producer_loop(void)
+{
+    for (uint epoch = 0; epoch < this->numEpochs; epoch++)
+    {
+        philox_rng_c randomNumbers(this->seed, epoch, 0, PIPELINE_STREAM);
+
+        {
+            K_TIME_PHASE(timer_phase_e::batch_prep);
+            this->dataset.begin_epoch(randomNumbers);
+        }
+
+        for (uint m = 0; m < this->batches_per_epoch(); m++)
+        {
+            // Wait for the trainer to hand back a batch. The pipeline is a whole ring ahead of the
+            // trainer when this happens, so rather than take CPU time from the trainer, sleep until
+            // release_batch() signals that half of the ring is free; but no longer, since with small
+            // batches the trainer gets through the ring fast.
+            uint batchIdx = 0;
+            if (!this->freeBatches.try_pop(&batchIdx))
+            {
+                std::unique_lock<std::mutex> lock(this->releaseMutex);
+                this->batchReleased.wait(lock, [this]
+                {
+                    return (this->stopping.load() ||
+                            (this->numFreeBatches.load() >= this->wake_threshold()));
+                });
+
+                if (this->stopping.load())
+                {
+                    return;
+                }
+
+                // The count is only raised after a batch has been pushed, so this can't fail.
+                this->freeBatches.try_pop(&batchIdx);
+            }
+
+            this->numFreeBatches--;
+
+            const bool batchOk = this->prepare_batch(this->batches.at(batchIdx), randomNumbers);
+
+            // The filled queue has room for every batch, so this can't fail.
+            this->filledBatches.try_push(batchIdx);
+
+            // A batch that came out empty tells the trainer that the set has failed; there's nothing more to give.
+            if (!batchOk)
+            {
+                return;
+            }
+        }
+    }
+
+    return;
+}
+
+bool mnist_batch_pipeline_c::prepare_batch(mnist_batch_s &batch, philox_rng_c &randomNumbers)
+{
+    K_TIME_PHASE(timer_phase_e::batch_prep);
+
+    const uint numImages = this->dataset.fetch_batch(this->fetchedImages.data(), this->fetchedLabels.data(),
+                                                     this->batchSize, randomNumbers);
+
+    const int rows = this->dataset.sample_rows();
+    const int cols = this->dataset.sample_cols();
+    const uint imageSize = (rows * cols);
+
+    batch.images.resize(numImages);
+    batch.labels.resize(numImages);
+
+    for (uint b = 0; b < numImages; b++)
+    {
+        const u8 *const source = (this->fetchedImages.data() + (b * imageSize));
+        u8 *const dest = (batch.pixels.data() + (b * imageSize));
+
+        if (!this->maxShift)
+        {
+            memcpy(dest, source, imageSize);
+        }
+        else
+        {
+            const int range = ((2 * this->maxShift) + 1);
+            const int dx = (int(randomNumbers.next_u32() % range) - int(this->maxShift));
+            const int dy = (int(randomNumbers.next_u32() % range) - int(this->maxShift));
+
+            // Copy the part of each row that stays in the image, and blank the rest.
+            memset(dest, 0, imageSize);
+            for (int y = std::max(0, dy); y < std::min(rows, (rows + dy)); y++)
+            {
+                const int firstX = std::max(0, dx);
+                const int numPixels = (cols - std::abs(dx));
+
+                if (numPixels > 0)
+                {
+                    memcpy((dest + (y * cols) + firstX), (source + ((y - dy) * cols) + (firstX - dx)), numPixels);
+                }
+            }
+        }
+
+        batch.images.at(b) = array_view_s<u8>(dest, imageSize);
+        batch.labels.at(b) = this->fetchedLabels.at(b);
+    }
+
+    // The set has as many samples as it says it has, so this only happens if it failed to give them.
+    return (numImages > 0);
+}
@@ -0,0 +1,113 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * Prepares batches of MNIST training samples on a background thread.
+ *
+ */
+
+#ifndef MNIST_BATCH_PIPELINE_H
+#define MNIST_BATCH_PIPELINE_H
+
+#include <condition_variable>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../../src/train_on/dataset.h"
+#include "../../src/memory/aligned_buffer.h"
+#include "../../src/memory/array_view.h"
+#include "../../src/thread/spsc_queue.h"
+#include "../../src/random/philox.h"
+#include "../../src/common.h"
+
+// A batch of training samples, ready to be passed to nnetwork_c::train_batch().
+struct mnist_batch_s
+{
+    // The batch's images, one after the other.
+    aligned_buffer_c<u8> pixels;
+
+    // Views of the images in the pixel buffer, and the digit each depicts.
+    std::vector<array_view_s<u8>> images;
+    std::vector<uint> labels;
+
+    uint size(void) const { return this->labels.size(); }
+};
+
+// Runs a thread that goes through the training set in a shuffled order, one epoch after the
+// other, and fetches each batch's images from the set (optionally shifting them by a random
+// number of pixels, for augmentation) into one of a ring of preallocated batches, for the
+// trainer to pick up. The set can be any dataset_c, e.g. one held in memory or one streamed
+// from disk; how the shuffling is done is up to the set. The
+// batches are passed to the trainer, and back once it's done with them, through lock-free
+// queues; so as long as the pipeline keeps ahead of the trainer, the trainer finds each batch
+// ready when it asks for it.
+//
+// The shuffling and the shifts are drawn from Philox streams keyed by the given seed, so that
+// the same seed gives the same batches.
+class mnist_batch_pipeline_c
+{
+public:
+    // Prepares the given number of epochs' worth of batches of the given size from the given
+    // set, which is the pipeline's to use for as long as it exists. If maxShift is non-zero,
+    // each image is moved by up to that many pixels horizontally and vertically, with the
+    // vacated pixels left blank.
+    mnist_batch_pipeline_c(dataset_c &dataset, const uint batchSize, const uint numEpochs,
+                           const u64 seed, const uint maxShift);
+    ~mnist_batch_pipeline_c();
+
+    // Returns the next batch in line, waiting for it if it's not ready yet. The batch stays
+    // valid until it's handed back with release_batch(), which must be done before asking for
+    // the next one. An empty batch means that the set failed to give its samples (e.g. on a
+    // read error), and that no more batches will come.
+    const mnist_batch_s& next_batch(void);
+    void release_batch(void);
+
+    uint batches_per_epoch(void) const;
+
+private:
+    // The loop that the pipeline's thread runs until it has prepared all of the batches, or
+    // until the pipeline is destroyed.
+    void producer_loop(void);
+
+    // Fills the given batch with the next batch's worth of images fetched from the set. Returns
+    // false, with the batch left empty, if the set gave no images.
+    bool prepare_batch(mnist_batch_s &batch, philox_rng_c &randomNumbers);
+
+    // The number of free batches at which a waiting pipeline is woken up: half of the ring.
+    int wake_threshold(void) const;
+
+    dataset_c &dataset;
+    const uint batchSize;
+    const uint numEpochs;
+    const u64 seed;
+    const uint maxShift;
+
+    // The ring of batches (enough of them to hold at least a few hundred samples), and the
+    // queues by which their indices are passed from the pipeline to the trainer (once filled),
+    // and back (once trained on).
+    std::vector<mnist_batch_s> batches;
+    spsc_queue_c<uint> filledBatches;
+    spsc_queue_c<uint> freeBatches;
+
+    // The images and labels of the batch being prepared, as fetched from the set.
+    aligned_buffer_c<u8> fetchedImages;
+    std::vector<uint> fetchedLabels;
+
+    // The index of the batch the trainer is currently holding, or -1 if none.
+    int currentBatchIdx = -1;
+
+    // The number of batches in the free queue; by which release_batch() tells when to wake the
+    // pipeline. Raised after a batch is pushed and lowered after one is popped, so it can lag
+    // the queue, and momentarily dip below zero.
+    std::atomic<int> numFreeBatches;
+
+    // Signalled by release_batch() and on destruction, to wake the pipeline if it's waiting for
+    // batches to be handed back.
+    std::mutex releaseMutex;
+    std::condition_variable batchReleased;
+
+    std::atomic<bool> stopping;
+    std::thread producer;
+};
+
+#endif
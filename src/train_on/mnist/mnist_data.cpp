@@ -6,29 +6,23 @@
  */
 
 #include <algorithm>
-#include <string>
-#include <vector>
+#include <numeric>
 #include <cstring>
+#include <vector>
 #include "../../src/train_on/mnist/mnist_data.h"
-#include "../../src/file/file.h"
 #include "../../src/common.h"
 
-mnist_data_c::mnist_data_c()
+mnist_data_c::mnist_data_c(const bool loadTrainingSet)
 {
-    /// FIXME: Filenames/path are hardcoded, for now.
-    this->trainingImages = this->load_mnist_data("mnist/train-images.idx3-ubyte", 60000*28*28, 3);
-    this->trainingLabels = this->load_mnist_data("mnist/train-labels.idx1-ubyte", 60000, 1);
-    this->validationImages = this->load_mnist_data("mnist/t10k-images.idx3-ubyte", 10000*28*28, 3);
-    this->validationLabels = this->load_mnist_data("mnist/t10k-labels.idx1-ubyte", 10000, 1);
-
-    // The original images have values in the range 0..255. Convert them into the
-    // range 0..1 for faster training.
+    if (loadTrainingSet)
     {
-        const auto toReal = [](real &v){ v = (v / 255.0); };
-        std::for_each(this->trainingImages.data.begin(), this->trainingImages.data.end(), toReal);
-        std::for_each(this->validationImages.data.begin(), this->validationImages.data.end(), toReal);
+        this->trainingImages = this->load_mnist_data(MNIST_TRAINING_IMAGES_FILENAME, 60000*28*28, 3);
+        this->trainingLabels = this->load_mnist_data(MNIST_TRAINING_LABELS_FILENAME, 60000, 1);
     }
 
+    this->validationImages = this->load_mnist_data(MNIST_VALIDATION_IMAGES_FILENAME, 10000*28*28, 3);
+    this->validationLabels = this->load_mnist_data(MNIST_VALIDATION_LABELS_FILENAME, 10000, 1);
+
     return;
 }
 
@@ -38,53 +32,65 @@ mnist_container_s mnist_data_c::load_mnist_data(const char *const filename, cons
 
     mnist_container_s mnistContents;
 
-    const file_handle_t fh = kfile_open_file(filename, "rb");
+    // The file is memory-mapped, and its header validated, by the IDX reader; the data are
+    // then used in place.
+    mnistContents.file = std::make_shared<const idx_file_c>(filename);
+    k_assert(mnistContents.file->is_open(), "Failed to load the MNIST file.");
+
+    const std::vector<uint> &dims = mnistContents.file->dimensions();
+    k_assert((dims.size() == numDimensions), "Unexpected dimensionality in MNIST file.");
 
-    // Parse the header.
+    mnistContents.elementCount = dims.at(0);
+    if (numDimensions == 3)
     {
-        const uint magicNumber = kfile_read_value<u32>(fh, false);
-        k_assert((( magicNumber & 0xffff0000)       == 0),    "Expected first two bytes of MNIST magic number to be 0.");
-        k_assert((((magicNumber & 0x0000ff00) >> 8) == 0x08), "Expected the MNIST data to be of type unsigned byte.");
-
-        /// TODO. Support data types other than u8. Also, test to make sure the
-        /// file contains the same data type as what this template was called with.
-        switch (numDimensions)
-        {
-            case 1:
-            {
-                mnistContents.elementCount = kfile_read_value<u32>(fh, false);
-                k_assert((mnistContents.elementCount == numItems), "Unexpected data count in MNIST file.");
-
-                break;
-            }
-            case 3:
-            {
-                mnistContents.elementCount = kfile_read_value<u32>(fh, false);
-                mnistContents.rows = kfile_read_value<u32>(fh, false);
-                mnistContents.cols = kfile_read_value<u32>(fh, false);
-                k_assert(((mnistContents.elementCount * mnistContents.rows * mnistContents.cols) == numItems),
-                         "Unexpected data count in MNIST file.");
-
-                break;
-            }
-            default: k_assert(0, "Bad dimensions count."); break;
-        }
+        mnistContents.rows = dims.at(1);
+        mnistContents.cols = dims.at(2);
     }
 
-    // Load the data.
+    mnistContents.data = mnistContents.file->payload();
+    k_assert((mnistContents.data.size() == numItems), "Unexpected data count in MNIST file.");
+
+    return mnistContents;
+}
+
+mnist_dataset_c::mnist_dataset_c(const mnist_container_s &images, const mnist_container_s &labels) :
+    images(images),
+    labels(labels),
+    imageIdxs(images.num_elements())
+{
+    k_assert((images.num_elements() == labels.num_elements()), "Expected as many labels as images.");
+
+    return;
+}
+
+void mnist_dataset_c::begin_epoch(philox_rng_c &randomNumbers)
+{
+    // Shuffle the images (Fisher-Yates), so that the epoch visits each of them once.
+    std::iota(this->imageIdxs.begin(), this->imageIdxs.end(), 0);
+    for (uint i = this->imageIdxs.size(); i > 1; i--)
     {
-        for (uint i = 0; i < mnistContents.elementCount; i++)
-        {
-            for (uint r = 0; r < (mnistContents.rows * mnistContents.cols); r++)
-            {
-                mnistContents.data.push_back(kfile_read_value<u8>(fh, false));
-            }
-        }
-        k_assert((mnistContents.data.size() == numItems),
-                 "Seem to have read an incorrect number of data points from the MNIST file.");
+        std::swap(this->imageIdxs.at(i - 1), this->imageIdxs.at(randomNumbers.next_u32() % i));
     }
 
-    kfile_close_file(fh);
+    this->numFetched = 0;
 
-    return mnistContents;
+    return;
+}
+
+uint mnist_dataset_c::fetch_batch(u8 *const samples, uint *const labels, const uint maxSamples, philox_rng_c &)
+{
+    const uint numSamples = std::min(maxSamples, uint(this->imageIdxs.size() - this->numFetched));
+    const uint sampleSize = this->sample_size();
+
+    for (uint i = 0; i < numSamples; i++)
+    {
+        const uint imageIdx = this->imageIdxs.at(this->numFetched + i);
+
+        memcpy((samples + (size_t(i) * sampleSize)), this->images.view_of_element(imageIdx).data(), sampleSize);
+        labels[i] = this->labels.view_of_element(imageIdx)[0];
+    }
+
+    this->numFetched += numSamples;
+
+    return numSamples;
 }
@@ -9,13 +9,30 @@
 #define MNIST_DATA_H
 
 #include <vector>
+#include <memory>
+#include "../../src/memory/array_view.h"
+#include "../../src/train_on/dataset.h"
+#include "../../src/file/idx_file.h"
 #include "../../src/types.h"
 
-// Contains raw data loaded from a MNIST file; and provides ordered access to it.
+/// FIXME: Filenames/path are hardcoded, for now.
+static const char MNIST_TRAINING_IMAGES_FILENAME[] = "mnist/train-images.idx3-ubyte";
+static const char MNIST_TRAINING_LABELS_FILENAME[] = "mnist/train-labels.idx1-ubyte";
+static const char MNIST_VALIDATION_IMAGES_FILENAME[] = "mnist/t10k-images.idx3-ubyte";
+static const char MNIST_VALIDATION_LABELS_FILENAME[] = "mnist/t10k-labels.idx1-ubyte";
+
+// Provides ordered access to the data in a MNIST file. The data are read in place from the
+// memory-mapped file, as its original bytes (e.g. pixel values 0..255) rather than as real
+// numbers, to keep their memory footprint small; they're scaled on their way into the net
+// (cf. nnetwork_c::train_batch()).
 struct mnist_container_s
 {
+    // The file the data are in. Shared, so that copies of the container can refer to the
+    // same mapping.
+    std::shared_ptr<const idx_file_c> file;
+
     // All of the contents as a flat array.
-    std::vector<real> data;
+    array_view_s<u8> data;
 
     // The number of discrete elements; in this case, MNIST images/labels.
     uint elementCount = 0;
@@ -25,43 +42,30 @@ struct mnist_container_s
     uint rows = 1;
     uint cols = 1;
 
-    void operator=(const mnist_container_s &other)
-    {
-        this->elementCount = other.elementCount;
-        this->rows = other.rows;
-        this->cols = other.cols;
-        this->data = other.data;
-    }
-
     uint num_elements(void) const
     {
         return this->elementCount;
     }
 
-    // Returns a copy of the idx'th element's data.
-    std::vector<real> contents_of_element(const uint idx) const
+    // Returns a view of the idx'th element's data, without copying it. The view is valid
+    // for as long as the container's file is open.
+    array_view_s<u8> view_of_element(const uint idx) const
     {
-        std::vector<real> c;
-
-        const uint offset = (idx * this->rows * this->cols);
+        const uint elementSize = (this->rows * this->cols);
 
-        for (uint y = 0; y < this->rows; y++)
-        {
-            for (uint x = 0; x < this->cols; x++)
-            {
-                c.push_back(this->data.at(offset + (x + y * this->cols)));
-            }
-        }
+        k_assert((idx < this->elementCount), "Element index out of bounds.");
 
-        return c;
+        return array_view_s<u8>((this->data.data() + (idx * elementSize)), elementSize);
     }
 };
 
-// Pools together the training and validation image/label sets in MNIST.
+// Pools together the training and validation image/label sets in MNIST. The training set can
+// be left out, e.g. when it's to be streamed from disk instead (cf. streaming_dataset_c), in
+// which case its containers are left empty.
 class mnist_data_c
 {
 public:
-    mnist_data_c();
+    explicit mnist_data_c(const bool loadTrainingSet = true);
 
     // Ten categories, for the digits 0 through 9.
     const int numCategories = 10;
@@ -72,12 +76,35 @@ public:
     mnist_container_s validationLabels;
 
 private:
-    // Loads data in the MNIST IDX format from the given file. Will expect the given
-    // number of items to be found, and for the file to have the given dimensionality.
-    /// Note that at the moment, only works with u8 data, and will assume that files
-    /// with one dimension contain image labels, and files with three dimensions have
-    /// the images themselves. In other words, this isn't a general IDX format reader.
+    // Maps in data in the MNIST IDX format from the given file. Will expect the given
+    // number of data points to be found, and for the file to have the given dimensionality.
+    /// Note that at the moment, will assume that files with one dimension contain image
+    /// labels, and files with three dimensions have the images themselves.
     mnist_container_s load_mnist_data(const char *const filename, const uint numItems, const uint numDimensions);
 };
 
+// A set of MNIST images and their labels as a dataset_c, whose samples are read from the
+// containers' mappings. Each epoch goes through the whole set in a fully shuffled order.
+class mnist_dataset_c : public dataset_c
+{
+public:
+    mnist_dataset_c(const mnist_container_s &images, const mnist_container_s &labels);
+
+    uint num_samples(void) const override { return this->images.num_elements(); }
+    uint sample_rows(void) const override { return this->images.rows; }
+    uint sample_cols(void) const override { return this->images.cols; }
+
+    void begin_epoch(philox_rng_c &randomNumbers) override;
+    uint fetch_batch(u8 *const samples, uint *const labels, const uint maxSamples,
+                     philox_rng_c &randomNumbers) override;
+
+private:
+    const mnist_container_s images;
+    const mnist_container_s labels;
+
+    // The order of the images in the current epoch, and how far into it the epoch has got.
+    std::vector<uint> imageIdxs;
+    uint numFetched = 0;
+};
+
 #endif
@@ -3,21 +3,64 @@
  *
  */
 
+#include <functional>
+#include <algorithm>
+#include <limits>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
 #include <cstdio>
+#include <unistd.h>
+#include "../../src/train_on/mnist/mnist_batch_pipeline.h"
 #include "../../src/train_on/mnist/mnist_data.h"
+#include "../../src/train_on/streaming_dataset.h"
+#include "../../src/train_on/sharded_dataset.h"
 #include "../../src/train_on/train_on.h"
 #include "../../src/nnetwork/nnetwork.h"
+#include "../../src/nnetwork/quantized_nnetwork.h"
+#include "../../src/nnetwork/kernels/kernels.h"
 #include "../../src/cmd_line/cmd_line.h"
+#include "../../src/thread/thread_pool.h"
+#include "../../src/server/inference_server.h"
+#include "../../src/timer/phase_timer.h"
 
 // Initialize the net for 28 x 28 images as input, and 10 (digits 0 through 9)
 // for output. Also add any layers and parameters the user may have supplied on
-// the command line.
-bool k_initialize_net_for_user_data(nnetwork_c *const net, const int argc, char *const argv[])
+// the command line; or, if the user asked for a saved net to be loaded (-l),
+// take the layers from that instead.
+template <typename T>
+bool k_initialize_net_for_user_data(nnetwork_c<T> *const net, const int argc, char *const argv[])
 {
     printf("Initializing for MNIST...\n");
 
     k_assert((net->num_layers() == 0), "Expected an empty net for initialization.");
 
+    const char *const modelFilename = k_command_line_option_argument(argc, argv, 'l');
+    if (modelFilename)
+    {
+        if (!net->load(modelFilename))
+        {
+            return false;
+        }
+
+        const uint numLoadedLayers = net->num_layers();
+
+        if (!k_parse_command_line(argc, argv, net))
+        {
+            return false;
+        }
+
+        if ((net->num_layers() != numLoadedLayers) ||
+            (net->num_neurons_in_layer(0) != 784) ||
+            (net->num_neurons_in_layer(numLoadedLayers - 1) != 10))
+        {
+            NBENE(("The loaded net isn't compatible with MNIST, or has layers added to it on the command line."));
+            return false;
+        }
+
+        return true;
+    }
+
     net->add_layer(784, activation_function_e::none);
     if (!k_parse_command_line(argc, argv, net))
     {
@@ -30,7 +73,8 @@ bool k_initialize_net_for_user_data(nnetwork_c *const net, const int argc, char
 
 // Display random digits from the MNIST validation set in the terminal, and for
 // each image show the user the net's prediction for the label.
-static void quiz(nnetwork_c &net, const mnist_data_c &mnistSet)
+template <typename T>
+static void quiz(nnetwork_c<T> &net, const mnist_data_c &mnistSet)
 {
     printf("<Press enter to start the quiz, or CTRL+C to quit.>\n");
     getchar();
@@ -41,8 +85,8 @@ static void quiz(nnetwork_c &net, const mnist_data_c &mnistSet)
         const auto &labelSource = mnistSet.validationLabels;
 
         const uint imageIdx = (net.random_number() * imageSource.num_elements());
-        const auto image = imageSource.contents_of_element(imageIdx);
-        const auto label = labelSource.contents_of_element(imageIdx).at(0);
+        const auto image = imageSource.view_of_element(imageIdx);
+        const uint label = labelSource.view_of_element(imageIdx)[0];
 
         net.propagate(image);
         const uint predictedLabel = net.strongest_output_neuron_idx();
@@ -52,7 +96,7 @@ static void quiz(nnetwork_c &net, const mnist_data_c &mnistSet)
         {
             for (uint x = 0; x < imageSource.cols; x++)
             {
-                const int ch = image.at(x + y * imageSource.cols) * 255;
+                const int ch = image[x + y * imageSource.cols];
                 printf("%c", (ch < 30)? ' ' : (ch < 150)? '.' : (ch < 220)? '*' : '#');
             }
             printf("\n");
@@ -65,80 +109,497 @@ static void quiz(nnetwork_c &net, const mnist_data_c &mnistSet)
     return;
 }
 
-bool k_train_net_on_user_data(nnetwork_c *const net)
+// Quantizes the net to int8, calibrating it on the first part of the MNIST validation set, and
+// prints how the quantized net compares to the original in accuracy and speed on the rest of
+// the set.
+template <typename T>
+static bool report_quantization(const nnetwork_c<T> &net, const mnist_data_c &mnistSet)
 {
-    mnist_data_c mnistSet;
+    const auto &imageSource = mnistSet.validationImages;
+    const auto &labelSource = mnistSet.validationLabels;
 
-    printf("Training on MNIST (%d/%d)...\n",
-           mnistSet.trainingImages.num_elements(), mnistSet.validationImages.num_elements());
+    const uint numCalibrationImages = std::min(1000u, (imageSource.num_elements() / 10));
 
-    for (uint i = 0; i < net->num_training_epochs(); i++)
+    std::vector<array_view_s<u8>> calibrationImages;
+    for (uint i = 0; i < numCalibrationImages; i++)
     {
-        // Test the net on MNIST images that it won't see during training.
-        uint numValidationCorrect = 0;
+        calibrationImages.push_back(imageSource.view_of_element(i));
+    }
+
+    quantized_nnetwork_c quantizedNet;
+    if (!quantizedNet.quantize(net, calibrationImages))
+    {
+        return false;
+    }
+
+    size_t floatWeightBytes = 0;
+    for (uint i = 0; i < net.num_layers(); i++)
+    {
+        floatWeightBytes += (net.layer(i).weights.size() * sizeof(T));
+    }
+
+    // Runs each of the remaining validation images through the given predictor, returning the
+    // number predicted correctly and storing the time taken in seconds.
+    const auto evaluate = [&](const std::function<uint(const array_view_s<u8>)> &predict, double *const seconds)
+    {
+        const auto startTime = std::chrono::steady_clock::now();
+
+        uint numCorrect = 0;
+        for (uint i = numCalibrationImages; i < imageSource.num_elements(); i++)
+        {
+            numCorrect += (predict(imageSource.view_of_element(i)) == labelSource.view_of_element(i)[0]);
+        }
+
+        *seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+        return numCorrect;
+    };
+
+    inference_context_s<T> context = net.make_inference_context();
+    quantized_inference_context_s quantizedContext = quantizedNet.make_inference_context();
+
+    double floatSeconds = 0, quantizedSeconds = 0;
+    const uint floatCorrect = evaluate([&](const array_view_s<u8> image){ return net.predict(context, image); }, &floatSeconds);
+    const uint quantizedCorrect = evaluate([&](const array_view_s<u8> image){ return quantizedNet.predict(quantizedContext, image); }, &quantizedSeconds);
+
+    const uint numImages = (imageSource.num_elements() - numCalibrationImages);
+    const real floatAccuracy = ((floatCorrect / (real)numImages) * 100);
+    const real quantizedAccuracy = ((quantizedCorrect / (real)numImages) * 100);
+
+    printf("Quantized the net to int8 (%s kernels), calibrating on %u validation images.\n", kkernels_int8().name, numCalibrationImages);
+    printf("\tWeights: %.1f KB -> %.1f KB.\n", (floatWeightBytes / 1024.0), (quantizedNet.weight_bytes() / 1024.0));
+    printf("\tValidation accuracy on the other %u images: %.3f%% -> %.3f%% (%+.3f).\n",
+           numImages, floatAccuracy, quantizedAccuracy, (quantizedAccuracy - floatAccuracy));
+    printf("\tSingle-threaded throughput: %.0f -> %.0f images/s.\n", (numImages / floatSeconds), (numImages / quantizedSeconds));
+
+    return true;
+}
+
+// Returns the time, in milliseconds, that each phase has taken since the phase timers were last reset, and resets them.
+static std::vector<double> take_phase_times(void)
+{
+    std::vector<double> phaseMs(uint(timer_phase_e::count));
+
+    for (uint p = 0; p < phaseMs.size(); p++)
+    {
+        phaseMs.at(p) = (kphase_timer_seconds(timer_phase_e(p)) * 1000);
+    }
+
+    kphase_timers_reset();
+
+    return phaseMs;
+}
+
+// Prints the epoch's accuracies, followed by the time that each phase of the epoch took (as per take_phase_times());
+// and, if given a file, appends the epoch's results to it as a line of JSON.
+static void report_epoch(const uint epochIdx, const uint numEpochs, const real trainingAccuracy, const real validationAccuracy,
+                         const std::vector<double> &phaseMs, FILE *const statsFile)
+{
+    const uint firstStepPhase = uint(timer_phase_e::load_batch);
+    const uint firstPipelinePhase = uint(timer_phase_e::batch_prep);
+    const uint numPhases = uint(timer_phase_e::count);
+
+    printf("Epoch %d of %d: train = %.3f%%, validate = %.3f%%.\n",
+           (epochIdx + 1), numEpochs, trainingAccuracy, validationAccuracy);
+
+    if (kphase_timers_enabled())
+    {
+        printf("\tTime (ms):");
+        for (uint p = 0; p < numPhases; p++)
+        {
+            const timer_phase_e phase = timer_phase_e(p);
+
+            printf("%s %s %.1f", ((p == firstStepPhase)? "; per thread:" : (p == firstPipelinePhase)? "; pipeline:" : (p? "," : "")),
+                   kphase_timer_name(phase), phaseMs.at(p));
+        }
+        printf(".\n");
+    }
+
+    fflush(stdout);
+
+    if (statsFile)
+    {
+        fprintf(statsFile, "{\"epoch\": %u, \"train_accuracy\": %.3f, \"validation_accuracy\": %.3f",
+                (epochIdx + 1), trainingAccuracy, validationAccuracy);
+
+        if (kphase_timers_enabled())
+        {
+            fprintf(statsFile, ", \"phase_ms\": {");
+            for (uint p = 0; p < numPhases; p++)
+            {
+                const timer_phase_e phase = timer_phase_e(p);
+
+                fprintf(statsFile, "%s\"%s\": %.3f", (p? ", " : ""), kphase_timer_name(phase), phaseMs.at(p));
+            }
+            fprintf(statsFile, "}");
+        }
+
+        fprintf(statsFile, "}\n");
+        fflush(statsFile);
+    }
+
+    return;
+}
+
+// Returns the indices of a random selection of the MNIST validation images, as many as there are images in the set.
+// Picked up front, so that the validating threads don't share the net's random number generator.
+template <typename T>
+static std::vector<uint> pick_validation_images(nnetwork_c<T> &net, const mnist_data_c &mnistSet)
+{
+    const uint numImages = mnistSet.validationImages.num_elements();
+
+    std::vector<uint> imageIdxs(numImages);
+    for (uint &imageIdx: imageIdxs)
+    {
+        imageIdx = (net.random_number() * numImages);
+    }
+
+    return imageIdxs;
+}
+
+// Tests the net on the given MNIST validation images, which it won't have seen during training, and returns the number
+// of them that it identifies correctly. The images are spread across the threads of the given pool, each of which passes
+// its share through the net in its own inference context.
+template <typename T>
+static uint count_correct_validations(const nnetwork_c<T> &net, const mnist_data_c &mnistSet, const std::vector<uint> &imageIdxs,
+                                      thread_pool_c &threadPool)
+{
+    const auto &imageSource = mnistSet.validationImages;
+    const auto &labelSource = mnistSet.validationLabels;
+
+    const uint numTasks = threadPool.num_threads();
+    const uint imagesPerTask = ((imageIdxs.size() + numTasks - 1) / numTasks);
+    std::vector<uint> numCorrectPerTask(numTasks, 0);
+
+    threadPool.run(numTasks, [&](const uint taskIdx)
+    {
+        const uint first = std::min(size_t(taskIdx * imagesPerTask), imageIdxs.size());
+        const uint last = std::min(size_t(first + imagesPerTask), imageIdxs.size());
+
+        inference_context_s<T> context = net.make_inference_context();
+        uint numCorrect = 0;
+
+        for (uint m = first; m < last; m++)
         {
-            const auto &imageSource = mnistSet.validationImages;
-            const auto &labelSource = mnistSet.validationLabels;
+            const uint imageIdx = imageIdxs.at(m);
+            const uint label = labelSource.view_of_element(imageIdx)[0];
 
-            for (uint m = 0; m < imageSource.num_elements(); m++)
+            // Pass the image through the net, and compare its output to what was expected.
+            const uint predictedLabel = net.predict(context, imageSource.view_of_element(imageIdx));
+            if ((predictedLabel == label) &&
+                net.output_neuron_fires(context, predictedLabel))
             {
-                const uint imageIdx = (net->random_number() * imageSource.num_elements());
-                const auto image = imageSource.contents_of_element(imageIdx);
-
-                // The expected output is a vector where all values are zero except
-                // for that of the nth element, where n = the image's category number.
-                std::vector<real> expectedOutput;
-                expectedOutput.resize(mnistSet.numCategories, 0);
-                expectedOutput.at(int(labelSource.contents_of_element(imageIdx).at(0))) = 1;
-
-                // Pass the image through the net, and compare its output to what was expected.
-                net->propagate(image);
-                if (net->activation_vector() == expectedOutput)
-                {
-                    numValidationCorrect++;
-                }
+                numCorrect++;
             }
         }
 
-        // Train the net.
-        /// FIXME. Needlessly duplicates code from above.
-        uint numTrainingCorrect = 0;
+        numCorrectPerTask.at(taskIdx) = numCorrect;
+    });
+
+    uint numValidationCorrect = 0;
+    for (const uint numCorrect: numCorrectPerTask)
+    {
+        numValidationCorrect += numCorrect;
+    }
+
+    return numValidationCorrect;
+}
+
+// Trains the net for its number of epochs on the given training set, validating it on the MNIST validation set as it
+// goes, and reports each epoch's results.
+template <typename T>
+static bool train_on_dataset(nnetwork_c<T> *const net, const mnist_data_c &mnistSet, dataset_c &trainingSet,
+                             const int argc, char *const argv[])
+{
+    if (trainingSet.sample_size() != net->num_neurons_in_layer(0))
+    {
+        NBENE(("The training images don't match the net's input layer."));
+        return false;
+    }
+
+    printf("Training on MNIST (%d/%d)...\n",
+           trainingSet.num_samples(), mnistSet.validationImages.num_elements());
+
+    FILE *statsFile = NULL;
+    const char *const statsFilename = k_command_line_option_argument(argc, argv, 'p');
+    if (statsFilename)
+    {
+        statsFile = fopen(statsFilename, "w");
+        if (!statsFile)
+        {
+            NBENE(("Failed to open '%s' for writing.", statsFilename));
+            return false;
+        }
+    }
+
+    // Have the training batches prepared in the background, shuffled and optionally augmented, while the net
+    // trains on the previous ones.
+    const char *const shiftArgument = k_command_line_option_argument(argc, argv, 'a');
+    mnist_batch_pipeline_c batchPipeline(trainingSet, net->batch_size(), net->num_training_epochs(), net->random_seed(),
+                                         (shiftArgument? strtol(shiftArgument, NULL, 10) : 0));
+
+    // With -V, each epoch's net is validated on a thread of its own while the next epoch trains, rather than before the
+    // epoch on the training threads. The thread works on a snapshot of the net's weights, taken as the epoch ends, and
+    // reports the epoch once it's done.
+    const bool validateInBackground = k_command_line_has_option(argc, argv, 'V');
+    const uint numEpochs = net->num_training_epochs();
+    nnetwork_c<T> snapshot;
+    std::thread validator;
+
+    kphase_timers_reset();
+
+    // Set if the training set fails to give its samples, e.g. on a read error; the set will have said why.
+    bool trainingSetFailed = false;
+
+    for (uint i = 0; i < numEpochs; i++)
+    {
+        uint numValidationCorrect = 0;
+        if (!validateInBackground)
         {
-            const auto &imageSource = mnistSet.trainingImages;
-            const auto &labelSource = mnistSet.trainingLabels;
+            K_TIME_PHASE(timer_phase_e::validation);
+
+            numValidationCorrect = count_correct_validations(*net, mnistSet, pick_validation_images(*net, mnistSet), net->thread_pool());
+        }
 
-            // Loop through about each of the MNIST training images.
-            for (uint m = 0; m < imageSource.num_elements(); m++)
+        // Train the net, on batches prepared by the pipeline.
+        uint numTrainingCorrect = 0;
+        {
+            for (uint m = 0; m < batchPipeline.batches_per_epoch(); m++)
             {
-                const uint imageIdx = (net->random_number() * imageSource.num_elements());
-                const auto image = imageSource.contents_of_element(imageIdx);
+                const mnist_batch_s *batch = NULL;
+                {
+                    K_TIME_PHASE(timer_phase_e::batch_wait);
+                    batch = &batchPipeline.next_batch();
+                }
+
+                if (!batch->size())
+                {
+                    batchPipeline.release_batch();
+                    trainingSetFailed = true;
+                    break;
+                }
 
-                std::vector<real> expectedOutput;
-                expectedOutput.resize(mnistSet.numCategories, 0);
-                expectedOutput.at(int(labelSource.contents_of_element(imageIdx).at(0))) = 1;
+                {
+                    K_TIME_PHASE(timer_phase_e::training);
+                    net->train_batch(batch->images, batch->labels);
+                }
 
-                // See whether the net as-is can correctly identify this image.
-                net->propagate(image);
-                if (net->activation_vector() == expectedOutput)
+                // The outputs the net produced for the batch were computed before its weights were adjusted, so they
+                // tell us whether the net as-is could correctly identify these images.
+                K_TIME_PHASE(timer_phase_e::accuracy);
+                for (uint b = 0; b < batch->size(); b++)
                 {
-                    numTrainingCorrect++;
+                    const uint predictedLabel = net->strongest_output_neuron_idx_in_batch(b);
+
+                    if ((predictedLabel == batch->labels.at(b)) &&
+                        net->output_neuron_fires_in_batch(b, predictedLabel))
+                    {
+                        numTrainingCorrect++;
+                    }
                 }
 
-                // Then train it some more on it.
-                net->train(image, expectedOutput);
+                batchPipeline.release_batch();
             }
         }
 
-        const real trainingAccuracy = ((numTrainingCorrect / (real)mnistSet.trainingImages.num_elements()) * 100);
-        const real validationAccuracy = ((numValidationCorrect / (real)mnistSet.validationImages.num_elements()) * 100);
+        if (trainingSetFailed)
+        {
+            break;
+        }
+
+        const real trainingAccuracy = ((numTrainingCorrect / (real)trainingSet.num_samples()) * 100);
+        const std::vector<double> phaseMs = take_phase_times();
+
+        if (!validateInBackground)
+        {
+            const real validationAccuracy = ((numValidationCorrect / (real)mnistSet.validationImages.num_elements()) * 100);
+
+            report_epoch(i, numEpochs, trainingAccuracy, validationAccuracy, phaseMs, statsFile);
+
+            continue;
+        }
+
+        // The previous epoch's validation will normally have finished long ago, but its thread needs to be done with
+        // the snapshot before the snapshot can be retaken.
+        if (validator.joinable())
+        {
+            validator.join();
+        }
+
+        net->snapshot_into(snapshot);
+
+        validator = std::thread([&, i, trainingAccuracy, phaseMs](const std::vector<uint> imageIdxs)
+        {
+            // The snapshot's thread pool is only this thread, so the validation doesn't take cores from the training.
+            // Its time is reported as the epoch's validation time, although it's not part of the epoch's.
+            const auto startTime = std::chrono::steady_clock::now();
+            const uint numCorrect = count_correct_validations(snapshot, mnistSet, imageIdxs, snapshot.thread_pool());
+            const double validationMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+            std::vector<double> epochPhaseMs = phaseMs;
+            epochPhaseMs.at(uint(timer_phase_e::validation)) = validationMs;
+
+            const real validationAccuracy = ((numCorrect / (real)mnistSet.validationImages.num_elements()) * 100);
+
+            report_epoch(i, numEpochs, trainingAccuracy, validationAccuracy, epochPhaseMs, statsFile);
+        }, pick_validation_images(*net, mnistSet));
+    }
+
+    if (validator.joinable())
+    {
+        validator.join();
+    }
+
+    if (statsFile)
+    {
+        fclose(statsFile);
+    }
+
+    return !trainingSetFailed;
+}
+
+// Returns true if the given file can be opened for writing; without modifying it, and without leaving it behind if
+// it didn't already exist. For finding out before training whether the trained net can be saved.
+static bool is_writable_file(const char *const filename)
+{
+    const bool existed = (access(filename, F_OK) == 0);
+
+    FILE *const file = fopen(filename, "ab");
+    if (!file)
+    {
+        return false;
+    }
+
+    fclose(file);
+
+    if (!existed)
+    {
+        remove(filename);
+    }
+
+    return true;
+}
+
+template <typename T>
+bool k_train_net_on_user_data(nnetwork_c<T> *const net, const int argc, char *const argv[])
+{
+    // With -c, the training set is streamed from disk through a shuffle buffer of the given number of images, rather
+    // than mapped in whole; so that its size needn't fit in memory. With -d, it's taken from the shards packed with -P
+    // under the given prefix; of which, with -W i/n, only those of worker i of n.
+    const char *const streamArgument = k_command_line_option_argument(argc, argv, 'c');
+    const char *const shardsPrefix = k_command_line_option_argument(argc, argv, 'd');
+
+    // Rather than find out after training that the net can't be saved.
+    const char *const saveFilename = k_command_line_option_argument(argc, argv, 'w');
+    if (saveFilename &&
+        !is_writable_file(saveFilename))
+    {
+        NBENE(("Can't open '%s' for writing the net into.", saveFilename));
+        return false;
+    }
+
+    mnist_data_c mnistSet(!streamArgument && !shardsPrefix);
+
+    if (shardsPrefix)
+    {
+        uint workerIdx = 0;
+        uint numWorkers = 1;
+        const char *const workerArgument = k_command_line_option_argument(argc, argv, 'W');
+        if (workerArgument &&
+            ((sscanf(workerArgument, "%u/%u", &workerIdx, &numWorkers) != 2) ||
+             (workerIdx >= numWorkers)))
+        {
+            NBENE(("Invalid worker '%s'; expected i/n, where i is from 0 to n-1.", workerArgument));
+            return false;
+        }
+
+        sharded_dataset_c trainingSet(shardsPrefix, workerIdx, numWorkers);
+
+        if (!trainingSet.is_open() ||
+            !train_on_dataset(net, mnistSet, trainingSet, argc, argv))
+        {
+            return false;
+        }
+    }
+    else if (streamArgument)
+    {
+        char *end = NULL;
+        const long shuffleBufferSize = strtol(streamArgument, &end, 10);
+        if ((end == streamArgument) ||
+            (*end != '\0') ||
+            (shuffleBufferSize <= 0) ||
+            (shuffleBufferSize > long(std::numeric_limits<uint>::max())))
+        {
+            NBENE(("Invalid shuffle buffer size '%s'; expected a positive number of images.", streamArgument));
+            return false;
+        }
+
+        streaming_dataset_c trainingSet(MNIST_TRAINING_IMAGES_FILENAME, MNIST_TRAINING_LABELS_FILENAME, shuffleBufferSize);
+
+        if (!trainingSet.is_open() ||
+            !train_on_dataset(net, mnistSet, trainingSet, argc, argv))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        mnist_dataset_c trainingSet(mnistSet.trainingImages, mnistSet.trainingLabels);
 
-        printf("Epoch %d of %d: train = %.3f%%, validate = %.3f%%.\n",
-               (i + 1), net->num_training_epochs(), trainingAccuracy, validationAccuracy);
+        if (!train_on_dataset(net, mnistSet, trainingSet, argc, argv))
+        {
+            return false;
+        }
     }
 
     printf("Training finished.\n");
 
+    if (saveFilename)
+    {
+        if (!net->save(saveFilename))
+        {
+            return false;
+        }
+
+        printf("Saved the net to '%s'.\n", saveFilename);
+    }
+
+    if (k_command_line_has_option(argc, argv, 'q') &&
+        !report_quantization(*net, mnistSet))
+    {
+        return false;
+    }
+
+    // Serve the net's predictions to other processes, if so asked; otherwise, quiz the user.
+    const char *const serverAddress = k_command_line_option_argument(argc, argv, 's');
+    if (serverAddress)
+    {
+        const char *const maxWaitArgument = k_command_line_option_argument(argc, argv, 'm');
+        const uint maxWaitMs = (maxWaitArgument? strtol(maxWaitArgument, NULL, 10) : 2);
+
+        return kserver_run(*net, serverAddress, net->batch_size(), maxWaitMs);
+    }
+
     quiz(*net, mnistSet);
 
     return true;
 }
+
+// Packs the MNIST training set into shards under the prefix given with -P, shuffled by the seed given with --seed (or
+// by a seed of 0).
+bool k_pack_user_data(const int argc, char *const argv[])
+{
+    const char *const prefix = k_command_line_option_argument(argc, argv, 'P');
+
+    u64 seed = 0;
+    k_command_line_seed(argc, argv, &seed);
+
+    printf("Packing the MNIST training set into shards...\n");
+
+    return kshards_pack(MNIST_TRAINING_IMAGES_FILENAME, MNIST_TRAINING_LABELS_FILENAME, prefix, seed);
+}
+
+template bool k_initialize_net_for_user_data(nnetwork_c<float> *const, const int, char *const[]);
+template bool k_initialize_net_for_user_data(nnetwork_c<double> *const, const int, char *const[]);
+template bool k_train_net_on_user_data(nnetwork_c<float> *const, const int, char *const[]);
+template bool k_train_net_on_user_data(nnetwork_c<double> *const, const int, char *const[]);
@@ -0,0 +1,340 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * A dataset that's been packed into shards, for splitting between training processes.
+ *
+ */
+
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include "../../src/train_on/sharded_dataset.h"
+#include "../../src/file/idx_file.h"
+#include "../../src/random/philox.h"
+
+static const char SHARD_FILE_MAGIC[8] = {'L', 'I', 'M', 'P', 'S', 'H', 'R', 'D'};
+static const u32 SHARD_FILE_VERSION = 1;
+
+// The boundary that each part of a shard starts on; a page, so that the blocks line up with the
+// pages they're mapped and read in as.
+static const uint SHARD_ALIGNMENT = 4096;
+
+// About how many bytes of samples to pack into each shard.
+static const u64 SHARD_BYTES = (8 * 1024 * 1024);
+
+struct shard_file_header_s
+{
+    char magic[8];
+    u32 version;
+
+    // Which of the set's shards this is, and how many there are.
+    u32 shardIdx;
+    u32 numShards;
+
+    // The number of samples in the shard, and the shape of each, as rows x cols bytes.
+    u32 numSamples;
+    u32 rows;
+    u32 cols;
+
+    // Byte offsets from the start of the file.
+    u64 labelsOffset;
+    u64 samplesOffset;
+
+    // A 64-bit FNV-1a hash of the labels block followed by the samples block.
+    u64 checksum;
+};
+
+// Returns the given byte offset rounded up to the next SHARD_ALIGNMENT boundary.
+static u64 aligned_offset(const u64 offset)
+{
+    return (((offset + SHARD_ALIGNMENT - 1) / SHARD_ALIGNMENT) * SHARD_ALIGNMENT);
+}
+
+// Returns the 64-bit FNV-1a hash of the given bytes, continuing from the given hash (pass
+// FNV_OFFSET_BASIS to start a new one).
+static const u64 FNV_OFFSET_BASIS = 14695981039346656037ull;
+static u64 fnv1a_hash(const u8 *const data, const size_t numBytes, u64 hash)
+{
+    for (size_t i = 0; i < numBytes; i++)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// Returns the filename of the given shard of the set with the given prefix.
+static std::string shard_filename(const char *const prefix, const uint shardIdx)
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "-%04u.shard", shardIdx);
+
+    return (std::string(prefix) + suffix);
+}
+
+bool kshards_pack(const char *const samplesFilename, const char *const labelsFilename,
+                  const char *const prefix, const u64 seed)
+{
+    const idx_file_c samplesFile(samplesFilename);
+    const idx_file_c labelsFile(labelsFilename);
+
+    if (!samplesFile.is_open() ||
+        !labelsFile.is_open())
+    {
+        return false;
+    }
+
+    if ((samplesFile.dimensions().size() < 2) ||
+        (labelsFile.dimensions().size() != 1) ||
+        (samplesFile.num_items() != labelsFile.num_items()) ||
+        !samplesFile.num_items())
+    {
+        NBENE(("Expected '%s' to hold a label for each sample in '%s'.", labelsFilename, samplesFilename));
+        return false;
+    }
+
+    const array_view_s<u8> srcSamples = samplesFile.payload();
+    const array_view_s<u8> srcLabels = labelsFile.payload();
+    const uint numSamples = samplesFile.num_items();
+    const uint sampleSize = samplesFile.item_size();
+    const uint rows = samplesFile.dimensions().at(1);
+
+    // Shuffle the samples (Fisher-Yates), then deal them out into shards of near-equal size.
+    std::vector<uint> order(numSamples);
+    std::iota(order.begin(), order.end(), 0);
+    philox_rng_c randomNumbers(seed, 0);
+    for (uint i = order.size(); i > 1; i--)
+    {
+        std::swap(order.at(i - 1), order.at(randomNumbers.next_u32() % i));
+    }
+
+    const uint numShards = std::max(u64(1), (((u64(numSamples) * sampleSize) + SHARD_BYTES - 1) / SHARD_BYTES));
+    if (numShards > 10000)
+    {
+        NBENE(("'%s' would need more shards than can be named (%u).", samplesFilename, numShards));
+        return false;
+    }
+
+    std::vector<u8> shardLabels;
+    std::vector<u8> shardSamples;
+    const std::vector<u8> padding(SHARD_ALIGNMENT, 0);
+
+    for (uint s = 0; s < numShards; s++)
+    {
+        const uint firstSample = ((u64(numSamples) * s) / numShards);
+        const uint endSample = ((u64(numSamples) * (s + 1)) / numShards);
+        const uint numShardSamples = (endSample - firstSample);
+
+        shardLabels.resize(numShardSamples);
+        shardSamples.resize(size_t(numShardSamples) * sampleSize);
+        for (uint i = 0; i < numShardSamples; i++)
+        {
+            const uint srcIdx = order.at(firstSample + i);
+
+            shardLabels[i] = srcLabels[srcIdx];
+            memcpy((shardSamples.data() + (size_t(i) * sampleSize)), (srcSamples.data() + (size_t(srcIdx) * sampleSize)), sampleSize);
+        }
+
+        shard_file_header_s header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SHARD_FILE_MAGIC, sizeof(header.magic));
+        header.version = SHARD_FILE_VERSION;
+        header.shardIdx = s;
+        header.numShards = numShards;
+        header.numSamples = numShardSamples;
+        header.rows = rows;
+        header.cols = (sampleSize / rows);
+        header.labelsOffset = aligned_offset(sizeof(header));
+        header.samplesOffset = aligned_offset(header.labelsOffset + shardLabels.size());
+        header.checksum = fnv1a_hash(shardSamples.data(), shardSamples.size(),
+                                     fnv1a_hash(shardLabels.data(), shardLabels.size(), FNV_OFFSET_BASIS));
+
+        const std::string filename = shard_filename(prefix, s);
+        FILE *const file = fopen(filename.c_str(), "wb");
+        if (!file)
+        {
+            NBENE(("Failed to open '%s' for writing.", filename.c_str()));
+            return false;
+        }
+
+        // Writes the given bytes at the given offset, padding with zeroes from the current position.
+        u64 position = 0;
+        bool writeOk = true;
+        const auto write_at = [&](const u64 offset, const void *const src, const size_t numBytes)
+        {
+            k_assert((offset >= position), "Overlapping blocks in the shard file.");
+
+            writeOk = (writeOk &&
+                       (fwrite(padding.data(), 1, (offset - position), file) == (offset - position)) &&
+                       (!numBytes || (fwrite(src, 1, numBytes, file) == numBytes)));
+
+            position = (offset + numBytes);
+        };
+
+        write_at(0, &header, sizeof(header));
+        write_at(header.labelsOffset, shardLabels.data(), shardLabels.size());
+        write_at(header.samplesOffset, shardSamples.data(), shardSamples.size());
+        write_at(aligned_offset(position), NULL, 0);
+
+        if ((fclose(file) != 0) ||
+            !writeOk)
+        {
+            NBENE(("Failed to write '%s'.", filename.c_str()));
+            return false;
+        }
+
+        printf("Wrote '%s' (%u samples).\n", filename.c_str(), numShardSamples);
+    }
+
+    return true;
+}
+
+sharded_dataset_c::sharded_dataset_c(const char *const prefix, const uint workerIdx, const uint numWorkers)
+{
+    k_assert((workerIdx < numWorkers), "Worker index out of bounds.");
+
+    // The worker's first shard tells how many shards there are in the set, and thus which others are
+    // the worker's.
+    const uint numShards = this->open_shard(prefix, workerIdx);
+
+    for (uint shardIdx = (workerIdx + numWorkers); numShards && (shardIdx < numShards); shardIdx += numWorkers)
+    {
+        const uint numShardsInShard = this->open_shard(prefix, shardIdx);
+
+        if (numShardsInShard != numShards)
+        {
+            // A shard that failed to open has already said why.
+            if (numShardsInShard)
+            {
+                NBENE(("The shards of '%s' don't go together.", prefix));
+            }
+
+            this->shards.clear();
+            this->samples.clear();
+
+            return;
+        }
+    }
+
+    this->sampleIdxs.resize(this->samples.size());
+
+    return;
+}
+
+uint sharded_dataset_c::open_shard(const char *const prefix, const uint shardIdx)
+{
+    const std::string filename = shard_filename(prefix, shardIdx);
+
+    std::unique_ptr<mapped_file_c> file(new mapped_file_c);
+    if (!file->open(filename.c_str()))
+    {
+        return 0;
+    }
+
+    const u8 *const contents = file->data();
+    const size_t fileSize = file->size();
+
+    shard_file_header_s header;
+    if (fileSize < sizeof(header))
+    {
+        NBENE(("'%s' is too small to be a shard.", filename.c_str()));
+        return 0;
+    }
+
+    memcpy(&header, contents, sizeof(header));
+
+    if (memcmp(header.magic, SHARD_FILE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        NBENE(("'%s' isn't a shard.", filename.c_str()));
+        return 0;
+    }
+
+    if (header.version != SHARD_FILE_VERSION)
+    {
+        NBENE(("'%s' is of an unsupported version (%u).", filename.c_str(), header.version));
+        return 0;
+    }
+
+    const u64 samplesSize = (u64(header.numSamples) * header.rows * header.cols);
+    const bool isValid = ((header.shardIdx == shardIdx) &&
+                          (header.shardIdx < header.numShards) &&
+                          header.numSamples &&
+                          header.rows &&
+                          header.cols &&
+                          !(header.labelsOffset % SHARD_ALIGNMENT) &&
+                          !(header.samplesOffset % SHARD_ALIGNMENT) &&
+                          ((header.labelsOffset + header.numSamples) <= fileSize) &&
+                          ((header.samplesOffset + samplesSize) <= fileSize));
+
+    if (!isValid)
+    {
+        NBENE(("'%s' has a malformed header.", filename.c_str()));
+        return 0;
+    }
+
+    // The shards of a set all have samples of the same shape.
+    if (this->is_open() &&
+        ((header.rows != this->rows) ||
+         (header.cols != this->cols)))
+    {
+        NBENE(("'%s' has samples of a different shape than the set's other shards.", filename.c_str()));
+        return 0;
+    }
+
+    const u8 *const labels = (contents + header.labelsOffset);
+    const u8 *const samples = (contents + header.samplesOffset);
+
+    if (fnv1a_hash(samples, samplesSize, fnv1a_hash(labels, header.numSamples, FNV_OFFSET_BASIS)) != header.checksum)
+    {
+        NBENE(("'%s' is corrupted; its contents don't match its checksum.", filename.c_str()));
+        return 0;
+    }
+
+    this->rows = header.rows;
+    this->cols = header.cols;
+
+    const uint sampleSize = (header.rows * header.cols);
+    for (uint i = 0; i < header.numSamples; i++)
+    {
+        this->samples.push_back({(samples + (size_t(i) * sampleSize)), labels[i]});
+    }
+
+    this->shards.push_back(std::move(file));
+
+    return header.numShards;
+}
+
+void sharded_dataset_c::begin_epoch(philox_rng_c &randomNumbers)
+{
+    // Shuffle the samples (Fisher-Yates), so that the epoch visits each of them once.
+    std::iota(this->sampleIdxs.begin(), this->sampleIdxs.end(), 0);
+    for (uint i = this->sampleIdxs.size(); i > 1; i--)
+    {
+        std::swap(this->sampleIdxs.at(i - 1), this->sampleIdxs.at(randomNumbers.next_u32() % i));
+    }
+
+    this->numFetched = 0;
+
+    return;
+}
+
+uint sharded_dataset_c::fetch_batch(u8 *const samples, uint *const labels, const uint maxSamples, philox_rng_c &)
+{
+    const uint numSamples = std::min(maxSamples, uint(this->sampleIdxs.size() - this->numFetched));
+    const uint sampleSize = this->sample_size();
+
+    for (uint i = 0; i < numSamples; i++)
+    {
+        const sample_ref_s &ref = this->samples.at(this->sampleIdxs.at(this->numFetched + i));
+
+        memcpy((samples + (size_t(i) * sampleSize)), ref.sample, sampleSize);
+        labels[i] = ref.label;
+    }
+
+    this->numFetched += numSamples;
+
+    return numSamples;
+}
@@ -0,0 +1,84 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * A dataset that's been packed into shards, for splitting between training processes.
+ *
+ */
+
+#ifndef SHARDED_DATASET_H
+#define SHARDED_DATASET_H
+
+#include <vector>
+#include <memory>
+#include "../../src/train_on/dataset.h"
+#include "../../src/file/mapped_file.h"
+#include "../../src/common.h"
+
+// Packs the samples and labels of a pair of IDX files (e.g. MNIST's) into shard files named
+// <prefix>-0000.shard, <prefix>-0001.shard, and so on, for sharded_dataset_c to train on. The
+// samples are shuffled (by the given seed) before being split into shards, so that each shard
+// is a random draw from the whole set. Returns false on failure.
+//
+// The layout of a shard (all values in the host's byte order):
+//
+//   - a header (shard_file_header_s), which indexes the shard: which of the set's shards it is,
+//     the number and shape of its samples, and where its blocks are;
+//   - the samples' labels, a byte each;
+//   - the samples' bytes, one sample after the other.
+//
+// Each part starts on a SHARD_ALIGNMENT boundary, so that the blocks can be read with aligned,
+// sequential reads. The header carries a checksum of the blocks, which is verified when the
+// shard is opened. The samples are kept as their original bytes, as elsewhere, since they're
+// scaled on their way into the net at no extra cost, and as bytes they take a quarter to an
+// eighth of the space that they would as reals.
+bool kshards_pack(const char *const samplesFilename, const char *const labelsFilename,
+                  const char *const prefix, const u64 seed);
+
+// Memory-maps a worker's share of the shards packed by kshards_pack(), and serves their samples
+// as a dataset_c. With numWorkers workers, worker #workerIdx takes every numWorkers'th shard,
+// starting from shard #workerIdx; so each process of a group can train on its own part of the
+// set, while processes sharing a machine share the shards' pages in its page cache. Only the
+// worker's own shards are mapped. Each epoch goes through the worker's samples in a fully
+// shuffled order.
+class sharded_dataset_c : public dataset_c
+{
+public:
+    // Opens the given worker's shards of the set with the given prefix. If there are no shards
+    // for the worker, or any of them is invalid, is_open() returns false.
+    sharded_dataset_c(const char *const prefix, const uint workerIdx, const uint numWorkers);
+
+    bool is_open(void) const { return !this->shards.empty(); }
+
+    uint num_samples(void) const override { return this->samples.size(); }
+    uint sample_rows(void) const override { return this->rows; }
+    uint sample_cols(void) const override { return this->cols; }
+
+    void begin_epoch(philox_rng_c &randomNumbers) override;
+    uint fetch_batch(u8 *const samples, uint *const labels, const uint maxSamples,
+                     philox_rng_c &randomNumbers) override;
+
+private:
+    // Maps the given shard, and validates its header against the set's shape and its blocks
+    // against its checksum. On success, appends its samples to this->samples and returns the
+    // number of shards in the set; on failure, returns 0.
+    uint open_shard(const char *const prefix, const uint shardIdx);
+
+    // Where a sample and its label are in the mapped shards.
+    struct sample_ref_s
+    {
+        const u8 *sample;
+        u8 label;
+    };
+
+    std::vector<std::unique_ptr<mapped_file_c>> shards;
+    std::vector<sample_ref_s> samples;
+
+    uint rows = 0;
+    uint cols = 0;
+
+    // The order of the samples in the current epoch, and how far into it the epoch has got.
+    std::vector<uint> sampleIdxs;
+    uint numFetched = 0;
+};
+
+#endif
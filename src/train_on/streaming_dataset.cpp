@@ -0,0 +1,361 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * A dataset that's streamed from disk, for training sets larger than memory.
+ *
+ */
+
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <cstring>
+#include "../../src/train_on/streaming_dataset.h"
+#include "../../src/file/idx_file.h"
+
+// The number of bytes of samples in each chunk read in from disk, and the number of chunks that
+// can be in flight between the reader and the shuffle buffer at a time.
+static const uint CHUNK_BYTES = (1024 * 1024);
+static const uint NUM_CHUNKS = 4;
+
+// Reads the given number of bytes from the given offset of the given file into dst. Returns false
+// on failure.
+static bool read_at(FILE *const file, const u64 offset, void *const dst, const size_t numBytes)
+{
+    #ifdef _WIN32
+        if (_fseeki64(file, offset, SEEK_SET) != 0)
+        {
+            return false;
+        }
+    #else
+        if (fseeko(file, off_t(offset), SEEK_SET) != 0)
+        {
+            return false;
+        }
+    #endif
+
+    return (fread(dst, 1, numBytes, file) == numBytes);
+}
+
+// Returns the size in bytes of the given file, or 0 on failure.
+static u64 file_size(FILE *const file)
+{
+    #ifdef _WIN32
+        const bool seekOk = (_fseeki64(file, 0, SEEK_END) == 0);
+        const i64 size = (seekOk? _ftelli64(file) : -1);
+    #else
+        const bool seekOk = (fseeko(file, 0, SEEK_END) == 0);
+        const i64 size = (seekOk? i64(ftello(file)) : -1);
+    #endif
+
+    return ((size > 0)? u64(size) : 0);
+}
+
+streaming_dataset_c::streaming_dataset_c(const char *const samplesFilename, const char *const labelsFilename,
+                                         const uint shuffleBufferSize) :
+    filledChunks(NUM_CHUNKS),
+    freeChunks(NUM_CHUNKS),
+    shuffleBufferSize(std::max(1u, shuffleBufferSize))
+{
+    // With no epoch begun, there are no samples to come.
+    this->readerDone.store(true);
+    this->stopping.store(false);
+    this->readFailed.store(false);
+
+    std::vector<uint> samplesDims, labelsDims;
+
+    this->samplesFile = this->open_idx_file(samplesFilename, &samplesDims, &this->samplesOffset);
+    this->labelsFile = this->open_idx_file(labelsFilename, &labelsDims, &this->labelsOffset);
+
+    if (!this->is_open() ||
+        (samplesDims.size() < 2) ||
+        (labelsDims.size() != 1) ||
+        (samplesDims.at(0) != labelsDims.at(0)))
+    {
+        if (this->is_open())
+        {
+            NBENE(("Expected '%s' to hold a label for each sample in '%s'.", labelsFilename, samplesFilename));
+        }
+
+        this->close_files();
+
+        return;
+    }
+
+    // An empty set, or one of empty samples, has nothing to stream.
+    if (!kidx_payload_size(samplesDims))
+    {
+        NBENE(("'%s' holds no samples, or its samples are empty.", samplesFilename));
+
+        this->close_files();
+
+        return;
+    }
+
+    // A sample's rows are its second dimension, and its columns whatever comes after.
+    this->numSamples = samplesDims.at(0);
+    this->rows = samplesDims.at(1);
+    this->cols = (kidx_payload_size(samplesDims) / (size_t(this->numSamples) * this->rows));
+
+    this->chunkSize = std::max(1u, (CHUNK_BYTES / this->sample_size()));
+    this->chunkOrder.resize((this->numSamples + this->chunkSize - 1) / this->chunkSize);
+
+    this->chunks.resize(NUM_CHUNKS);
+    for (uint i = 0; i < this->chunks.size(); i++)
+    {
+        this->chunks.at(i).samples.resize(size_t(this->chunkSize) * this->sample_size());
+        this->chunks.at(i).labels.resize(this->chunkSize);
+
+        this->freeChunks.try_push(i);
+    }
+
+    // A buffer larger than the set would never fill past the set's size.
+    this->shuffleBufferSize = std::min(this->shuffleBufferSize, this->numSamples);
+
+    this->shuffleSamples.resize(size_t(this->shuffleBufferSize) * this->sample_size());
+    this->shuffleLabels.resize(this->shuffleBufferSize);
+
+    return;
+}
+
+streaming_dataset_c::~streaming_dataset_c()
+{
+    this->stop_reader();
+    this->close_files();
+
+    return;
+}
+
+void streaming_dataset_c::close_files(void)
+{
+    if (this->samplesFile)
+    {
+        fclose(this->samplesFile);
+        this->samplesFile = NULL;
+    }
+
+    if (this->labelsFile)
+    {
+        fclose(this->labelsFile);
+        this->labelsFile = NULL;
+    }
+
+    return;
+}
+
+FILE* streaming_dataset_c::open_idx_file(const char *const filename, std::vector<uint> *const dims, size_t *const payloadOffset) const
+{
+    FILE *const file = fopen(filename, "rb");
+    if (!file)
+    {
+        NBENE(("Failed to open '%s' for reading.", filename));
+        return NULL;
+    }
+
+    // Read in what could be the header, and parse as much of it as the header turns out to be.
+    const u64 fileSize = file_size(file);
+    const size_t headerBytes = std::min(u64(IDX_MAX_HEADER_SIZE), fileSize);
+    u8 header[IDX_MAX_HEADER_SIZE];
+
+    if (!read_at(file, 0, header, headerBytes) ||
+        !kidx_parse_header(header, headerBytes, filename, dims, payloadOffset))
+    {
+        fclose(file);
+        return NULL;
+    }
+
+    if ((fileSize - *payloadOffset) < kidx_payload_size(*dims))
+    {
+        NBENE(("'%s' is too small for the payload its header describes.", filename));
+        fclose(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+void streaming_dataset_c::begin_epoch(philox_rng_c &randomNumbers)
+{
+    k_assert(this->is_open(), "Expected the dataset's files to be open.");
+
+    this->stop_reader();
+
+    // Shuffle the chunks (Fisher-Yates); the reader then goes through them in this order.
+    std::iota(this->chunkOrder.begin(), this->chunkOrder.end(), 0);
+    for (uint i = this->chunkOrder.size(); i > 1; i--)
+    {
+        std::swap(this->chunkOrder.at(i - 1), this->chunkOrder.at(randomNumbers.next_u32() % i));
+    }
+
+    this->readerDone.store(false);
+    this->stopping.store(false);
+    this->reader = std::thread(&streaming_dataset_c::reader_loop, this);
+
+    return;
+}
+
+uint streaming_dataset_c::fetch_batch(u8 *const samples, uint *const labels, const uint maxSamples,
+                                      philox_rng_c &randomNumbers)
+{
+    const uint sampleSize = this->sample_size();
+
+    if (this->readFailed.load())
+    {
+        NBENE(("Failed to read from the dataset's files."));
+        return 0;
+    }
+
+    uint numFetched = 0;
+    for (; numFetched < maxSamples; numFetched++)
+    {
+        this->fill_shuffle_buffer();
+
+        if (!this->numBuffered)
+        {
+            break;
+        }
+
+        // Draw a sample from the buffer at random, and fill its slot with the buffer's last sample.
+        const uint pick = (randomNumbers.next_u32() % this->numBuffered);
+        const uint last = --this->numBuffered;
+
+        memcpy((samples + (size_t(numFetched) * sampleSize)), (this->shuffleSamples.data() + (size_t(pick) * sampleSize)), sampleSize);
+        labels[numFetched] = this->shuffleLabels[pick];
+
+        if (pick != last)
+        {
+            memcpy((this->shuffleSamples.data() + (size_t(pick) * sampleSize)), (this->shuffleSamples.data() + (size_t(last) * sampleSize)), sampleSize);
+            this->shuffleLabels[pick] = this->shuffleLabels[last];
+        }
+    }
+
+    return numFetched;
+}
+
+void streaming_dataset_c::fill_shuffle_buffer(void)
+{
+    const uint sampleSize = this->sample_size();
+
+    while (this->numBuffered < this->shuffleBufferSize)
+    {
+        // Once the current chunk has been emptied, hand it back to the reader, and move on to the next one.
+        if ((this->currentChunkIdx >= 0) &&
+            (this->currentChunkPos == this->chunks.at(this->currentChunkIdx).numSamples))
+        {
+            // The free queue has room for every chunk, so this can't fail.
+            this->freeChunks.try_push(this->currentChunkIdx);
+            this->currentChunkIdx = -1;
+        }
+
+        if (this->currentChunkIdx < 0)
+        {
+            uint chunkIdx = 0;
+            bool gotChunk = false;
+            while (!(gotChunk = this->filledChunks.try_pop(&chunkIdx)))
+            {
+                // The reader pushes its last chunk before it says it's done; so once it's done, one more
+                // look at the queue tells whether there are any chunks left this epoch.
+                if (this->readerDone.load())
+                {
+                    gotChunk = this->filledChunks.try_pop(&chunkIdx);
+                    break;
+                }
+
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+
+            if (!gotChunk)
+            {
+                return;
+            }
+
+            this->currentChunkIdx = chunkIdx;
+            this->currentChunkPos = 0;
+        }
+
+        const dataset_chunk_s &chunk = this->chunks.at(this->currentChunkIdx);
+        const uint numToCopy = std::min((chunk.numSamples - this->currentChunkPos), (this->shuffleBufferSize - this->numBuffered));
+
+        memcpy((this->shuffleSamples.data() + (size_t(this->numBuffered) * sampleSize)),
+               (chunk.samples.data() + (size_t(this->currentChunkPos) * sampleSize)),
+               (size_t(numToCopy) * sampleSize));
+        memcpy((this->shuffleLabels.data() + this->numBuffered), (chunk.labels.data() + this->currentChunkPos), numToCopy);
+
+        this->numBuffered += numToCopy;
+        this->currentChunkPos += numToCopy;
+    }
+
+    return;
+}
+
+void streaming_dataset_c::reader_loop(void)
+{
+    const uint sampleSize = this->sample_size();
+
+    for (const uint chunkId: this->chunkOrder)
+    {
+        // Wait for the shuffle buffer to hand back a chunk buffer.
+        uint chunkIdx = 0;
+        while (!this->freeChunks.try_pop(&chunkIdx))
+        {
+            if (this->stopping.load())
+            {
+                return;
+            }
+
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+
+        dataset_chunk_s &chunk = this->chunks.at(chunkIdx);
+        const uint firstSample = (chunkId * this->chunkSize);
+        chunk.numSamples = std::min(this->chunkSize, (this->numSamples - firstSample));
+
+        const bool readOk = (read_at(this->samplesFile, (this->samplesOffset + (u64(firstSample) * sampleSize)),
+                                     chunk.samples.data(), (size_t(chunk.numSamples) * sampleSize)) &&
+                             read_at(this->labelsFile, (this->labelsOffset + firstSample),
+                                     chunk.labels.data(), chunk.numSamples));
+
+        // Leave the error to be reported by the trainer's thread, and end the epoch here. The free queue has room for
+        // every chunk, so handing the chunk back can't fail.
+        if (!readOk)
+        {
+            this->freeChunks.try_push(chunkIdx);
+            this->readFailed.store(true);
+            break;
+        }
+
+        // The filled queue has room for every chunk, so this can't fail.
+        this->filledChunks.try_push(chunkIdx);
+    }
+
+    this->readerDone.store(true);
+
+    return;
+}
+
+void streaming_dataset_c::stop_reader(void)
+{
+    if (!this->reader.joinable())
+    {
+        return;
+    }
+
+    this->stopping.store(true);
+    this->reader.join();
+
+    // With the reader stopped, this thread has both ends of the queues to itself.
+    uint chunkIdx = 0;
+    while (this->filledChunks.try_pop(&chunkIdx))
+    {
+        this->freeChunks.try_push(chunkIdx);
+    }
+
+    if (this->currentChunkIdx >= 0)
+    {
+        this->freeChunks.try_push(this->currentChunkIdx);
+        this->currentChunkIdx = -1;
+    }
+
+    this->numBuffered = 0;
+
+    return;
+}
@@ -0,0 +1,115 @@
+/*
+ * 2018 Tarpeeksi Hyvae Soft
+ *
+ * A dataset that's streamed from disk, for training sets larger than memory.
+ *
+ */
+
+#ifndef STREAMING_DATASET_H
+#define STREAMING_DATASET_H
+
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "../../src/train_on/dataset.h"
+#include "../../src/memory/aligned_buffer.h"
+#include "../../src/thread/spsc_queue.h"
+#include "../../src/common.h"
+
+// A chunk of consecutive samples read in from the files, and their labels.
+struct dataset_chunk_s
+{
+    aligned_buffer_c<u8> samples;
+    aligned_buffer_c<u8> labels;
+    uint numSamples = 0;
+};
+
+// Streams the samples and labels of a pair of IDX files (e.g. MNIST's) from disk, rather than
+// mapping or loading the files whole, so that its memory use doesn't depend on the files' size.
+//
+// The files are read in chunks of consecutive samples, a fixed number of bytes each, by a thread
+// that keeps a few chunks ahead of the trainer. Each epoch goes through the chunks in a shuffled
+// order, and the chunks' samples pass through a shuffle buffer of a given number of samples, out
+// of which the samples are drawn at random (as per e.g. TensorFlow's tf.data shuffle()); so the
+// order is shuffled across the whole set at the chunk level, and within about the buffer's span
+// at the sample level. The memory used is that of the buffer and of the chunks in flight.
+class streaming_dataset_c : public dataset_c
+{
+public:
+    // Opens the given IDX files of samples and of their labels, for streaming through a shuffle
+    // buffer of the given number of samples (at most the set's size). If the files can't be opened
+    // or don't go together, is_open() returns false.
+    streaming_dataset_c(const char *const samplesFilename, const char *const labelsFilename, const uint shuffleBufferSize);
+    ~streaming_dataset_c();
+
+    bool is_open(void) const { return (this->samplesFile && this->labelsFile); }
+
+    uint num_samples(void) const override { return this->numSamples; }
+    uint sample_rows(void) const override { return this->rows; }
+    uint sample_cols(void) const override { return this->cols; }
+
+    void begin_epoch(philox_rng_c &randomNumbers) override;
+    uint fetch_batch(u8 *const samples, uint *const labels, const uint maxSamples,
+                     philox_rng_c &randomNumbers) override;
+
+private:
+    // Opens the given IDX file and parses its header. Returns NULL on failure.
+    FILE* open_idx_file(const char *const filename, std::vector<uint> *const dims, size_t *const payloadOffset) const;
+
+    void close_files(void);
+
+    // The loop of the reader thread: reads the current epoch's chunks, in order, into the free
+    // chunk buffers, until it's been through them all or is told to stop.
+    void reader_loop(void);
+
+    // Stops the reader thread, if it's running, and takes back the chunk buffers that it or the
+    // shuffle buffer were holding.
+    void stop_reader(void);
+
+    // Moves samples from the chunks that have been read in into the shuffle buffer until the buffer
+    // is full or the epoch has no more samples to give, waiting for the reader if need be.
+    void fill_shuffle_buffer(void);
+
+    FILE *samplesFile = NULL;
+    FILE *labelsFile = NULL;
+    size_t samplesOffset = 0;
+    size_t labelsOffset = 0;
+
+    uint numSamples = 0;
+    uint rows = 1;
+    uint cols = 1;
+
+    // The number of samples in each chunk (but possibly the last), and the chunks' order in the
+    // current epoch.
+    uint chunkSize = 0;
+    std::vector<uint> chunkOrder;
+
+    // The chunk buffers, and the queues by which their indices are passed from the reader (once
+    // filled) to the shuffle buffer, and back (once emptied).
+    std::vector<dataset_chunk_s> chunks;
+    spsc_queue_c<uint> filledChunks;
+    spsc_queue_c<uint> freeChunks;
+
+    // The chunk that the shuffle buffer is being filled from, or -1 if none; and the index of
+    // its next sample.
+    int currentChunkIdx = -1;
+    uint currentChunkPos = 0;
+
+    // The samples waiting to be drawn, and their labels.
+    aligned_buffer_c<u8> shuffleSamples;
+    aligned_buffer_c<u8> shuffleLabels;
+    uint shuffleBufferSize = 0;
+    uint numBuffered = 0;
+
+    // Set by the reader once it's read in the epoch's last chunk.
+    std::atomic<bool> readerDone;
+
+    // Set by the reader if reading from the files fails, after which the set yields no more samples.
+    std::atomic<bool> readFailed;
+
+    std::atomic<bool> stopping;
+    std::thread reader;
+};
+
+#endif
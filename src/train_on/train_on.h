@@ -6,18 +6,26 @@
 #ifndef TRAIN_ON_H
 #define TRAIN_ON_H
 
-class nnetwork_c;
+template <typename T> class nnetwork_c;
 
 // Called by main() to initialize the net for whatever data the user has. You'd
 // implement this function specifically for the kind of data you have in mind.
 // Returns true/false to reflect whether the function considers the initialization
 // to have succeeded.
-bool k_initialize_net_for_user_data(nnetwork_c *const net, const int argc, char *const argv[]);
+template <typename T>
+bool k_initialize_net_for_user_data(nnetwork_c<T> *const net, const int argc, char *const argv[]);
 
 // Gets called by main() to train the net on whatever data the user has. You'd
 // implement this function specifically for the kind of data you have in mind.
 // Returns true/false to reflect whether the function considers the training to
 // have succeeded.
-bool k_train_net_on_user_data(nnetwork_c *const net);
+template <typename T>
+bool k_train_net_on_user_data(nnetwork_c<T> *const net, const int argc, char *const argv[]);
+
+// Gets called by main(), in place of the above, if the user asked (-P) for the training
+// data to be packed into a form that's faster to train on (e.g. cf. kshards_pack()) rather
+// than for a net to be trained. Returns true/false to reflect whether the packing
+// succeeded.
+bool k_pack_user_data(const int argc, char *const argv[]);
 
 #endif